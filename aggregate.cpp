@@ -0,0 +1,371 @@
+/**
+ * @file aggregate.cpp - implementation of grouping and aggregation: HashAggregate
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "aggregate.h"
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <thread>
+#include "statistics.h"
+
+static bool less(const Value &a, const Value &b) {
+    if (a.data_type == ColumnAttribute::INT)
+        return a.n < b.n;
+    return a.s < b.s;
+}
+
+HashAggregate::HashAggregate(const ColumnNames &group_columns, const ColumnAttributes &group_attributes,
+                             const Aggregates &aggregates, const ColumnAttributes &aggregate_attributes, size_t budget)
+        : group_columns(group_columns), group_attributes(group_attributes), aggregates(aggregates),
+          aggregate_attributes(aggregate_attributes), budget(budget), depth(0), groups(), slots(), bytes(0),
+          partitions() {}
+
+HashAggregate::~HashAggregate() {
+    for (auto &partition : this->partitions) {
+        for (auto table : partition) {
+            try {
+                table->drop();
+            } catch (...) {
+                // a leftover temporary file is no reason to fail the statement
+            }
+            delete table;
+        }
+    }
+}
+
+u_int64_t HashAggregate::hash(const std::vector<Value> &key) {
+    u_int64_t h = 0xcbf29ce484222325ULL;
+    for (auto const &value : key)
+        h = (h ^ HyperLogLog::hash(value)) * 0x100000001b3ULL;
+    return h;
+}
+
+bool HashAggregate::equal(const std::vector<Value> &a, const std::vector<Value> &b) {
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].data_type == ColumnAttribute::INT ? a[i].n != b[i].n : a[i].s != b[i].s)
+            return false;
+    }
+    return true;
+}
+
+// a rough count of what a group costs in memory, with its share of the slots
+size_t HashAggregate::group_bytes(const Group &group) {
+    size_t bytes = sizeof(Group) + 2 * sizeof(int32_t) + group.accumulators.size() * sizeof(Accumulator);
+    for (auto const &value : group.key)
+        bytes += sizeof(Value) + value.s.size();
+    return bytes;
+}
+
+// keeps the load factor under 0.7 so probe sequences stay short
+void HashAggregate::grow() {
+    this->slots.assign(std::max<size_t>(16, this->slots.size() * 2), -1);
+    size_t mask = this->slots.size() - 1;
+    for (size_t index = 0; index < this->groups.size(); index++) {
+        size_t i = this->groups[index].hash & mask;
+        while (this->slots[i] >= 0)
+            i = (i + 1) & mask;
+        this->slots[i] = (int32_t) index;
+    }
+}
+
+HashAggregate::Group &HashAggregate::find(const std::vector<Value> &key, u_int64_t hash, bool &added) {
+    if ((this->groups.size() + 1) * 10 > this->slots.size() * 7)
+        this->grow();
+    size_t mask = this->slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        int32_t index = this->slots[i];
+        if (index < 0) {
+            this->slots[i] = (int32_t) this->groups.size();
+            this->groups.push_back(Group{hash, key, std::vector<Accumulator>(this->aggregates.size())});
+            this->bytes += group_bytes(this->groups.back());
+            added = true;
+            return this->groups.back();
+        }
+        Group &group = this->groups[index];
+        if (group.hash == hash && equal(group.key, key)) {
+            added = false;
+            return group;
+        }
+    }
+}
+
+void HashAggregate::accumulate(Accumulator &accumulator, const Value &value, Aggregate::Function function) {
+    switch (function) {
+        case Aggregate::SUM:
+            accumulator.sum += value.n;
+            break;
+        case Aggregate::MIN:
+            if (accumulator.count == 0 || less(value, accumulator.value))
+                accumulator.value = value;
+            break;
+        case Aggregate::MAX:
+            if (accumulator.count == 0 || less(accumulator.value, value))
+                accumulator.value = value;
+            break;
+        default:
+            break;
+    }
+    accumulator.count++;
+}
+
+void HashAggregate::combine(Accumulator &into, const Accumulator &from, Aggregate::Function function) {
+    if (from.count == 0)
+        return;
+    if ((function == Aggregate::MIN && (into.count == 0 || less(from.value, into.value)))
+        || (function == Aggregate::MAX && (into.count == 0 || less(into.value, from.value))))
+        into.value = from.value;
+    into.count += from.count;
+    into.sum += from.sum;
+}
+
+void HashAggregate::add(const ValueDict &row) {
+    std::vector<Value> key;
+    for (auto const &column_name : this->group_columns)
+        key.push_back(row.at(column_name));
+    bool added;
+    Group &group = this->find(key, hash(key), added);
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const Aggregate &aggregate = this->aggregates[i];
+        this->accumulate(group.accumulators[i], aggregate.column_name.empty() ? Value() : row.at(aggregate.column_name),
+                         aggregate.function);
+    }
+    if (added && this->bytes > this->budget)
+        this->spill();
+}
+
+// without a free-threaded environment the tables' Db handles can't be shared, and inside a
+// transaction the workers' reads (not in it) could wait on its locks, so both stay on this thread
+void HashAggregate::add_all(DbRelation &table, const Handles &handles, const ColumnNames &column_names) {
+    u_int32_t env_flags = 0;
+    _DB_ENV->get_open_flags(&env_flags);
+    size_t n_threads = 1;
+    if ((env_flags & DB_THREAD) && !TransactionManager::in_transaction())
+        n_threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                         handles.size() / PARALLEL_MIN_ROWS));
+
+    std::vector<HashAggregate *> workers;
+    for (size_t t = 0; t < n_threads; t++)
+        workers.push_back(n_threads == 1 ? this : new HashAggregate(this->group_columns, this->group_attributes,
+                                                                    this->aggregates, this->aggregate_attributes,
+                                                                    this->budget / n_threads));
+    std::vector<std::exception_ptr> errors(n_threads);
+    const Snapshot *snapshot = VersionManager::current();
+    auto work = [&](size_t t) {
+        SharedSnapshot shared(snapshot); // the workers see the rows the statement's select did
+        try {
+            size_t end = handles.size() * (t + 1) / n_threads;
+            for (size_t first = handles.size() * t / n_threads; first < end; first += DbRelation::PROJECT_BATCH) {
+                size_t last = end - first > DbRelation::PROJECT_BATCH ? first + DbRelation::PROJECT_BATCH : end;
+                ValueDicts rows;
+                try {
+                    table.project_rows(handles.begin() + first, handles.begin() + last, &column_names, rows);
+                    for (auto row : rows)
+                        workers[t]->add(*row);
+                } catch (...) {
+                    for (auto row : rows)
+                        delete row;
+                    throw;
+                }
+                for (auto row : rows)
+                    delete row;
+            }
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    if (n_threads == 1) {
+        work(0);
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < n_threads; t++)
+            threads.push_back(std::thread(work, t));
+        for (auto &thread : threads)
+            thread.join();
+        for (auto worker : workers) {
+            if (errors[0] == nullptr) {
+                try {
+                    this->merge(*worker);
+                } catch (...) {
+                    errors[0] = std::current_exception();
+                }
+            }
+            delete worker;
+        }
+    }
+    for (auto const &error : errors)
+        if (error != nullptr)
+            std::rethrow_exception(error);
+}
+
+void HashAggregate::merge(HashAggregate &other) {
+    for (auto const &from : other.groups) {
+        bool added;
+        Group &group = this->find(from.key, from.hash, added);
+        for (size_t i = 0; i < this->aggregates.size(); i++)
+            this->combine(group.accumulators[i], from.accumulators[i], this->aggregates[i].function);
+        if (added && this->bytes > this->budget)
+            this->spill();
+    }
+    other.clear();
+    if (!other.partitions.empty()) {
+        this->partitions.resize(N_PARTITIONS);
+        for (uint p = 0; p < N_PARTITIONS; p++)
+            this->partitions[p].insert(this->partitions[p].end(), other.partitions[p].begin(),
+                                       other.partitions[p].end());
+        other.partitions.clear();
+    }
+}
+
+void HashAggregate::clear() {
+    this->groups.clear();
+    this->slots.clear();
+    this->bytes = 0;
+}
+
+ColumnNames HashAggregate::spill_columns() const {
+    ColumnNames column_names(this->group_columns);
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        column_names.push_back("_count" + std::to_string(i));
+        column_names.push_back("_sum" + std::to_string(i));
+        column_names.push_back("_value" + std::to_string(i));
+    }
+    return column_names;
+}
+
+// a partial SUM may not fit in an INT, so it is spilled as decimal TEXT
+ColumnAttributes HashAggregate::spill_attributes() const {
+    ColumnAttributes column_attributes(this->group_attributes);
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        Aggregate::Function function = this->aggregates[i].function;
+        column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+        column_attributes.push_back(function == Aggregate::MIN || function == Aggregate::MAX
+                                    ? this->aggregate_attributes[i] : ColumnAttribute(ColumnAttribute::INT));
+    }
+    return column_attributes;
+}
+
+ValueDict HashAggregate::spill_row(const Group &group) const {
+    ValueDict row;
+    for (size_t i = 0; i < this->group_columns.size(); i++)
+        row[this->group_columns[i]] = group.key[i];
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const Accumulator &accumulator = group.accumulators[i];
+        row["_count" + std::to_string(i)] = Value((int32_t) accumulator.count);
+        row["_sum" + std::to_string(i)] = Value(std::to_string(accumulator.sum));
+        row["_value" + std::to_string(i)] = accumulator.value;
+    }
+    return row;
+}
+
+void HashAggregate::add_partial(const ValueDict &row) {
+    std::vector<Value> key;
+    for (auto const &column_name : this->group_columns)
+        key.push_back(row.at(column_name));
+    bool added;
+    Group &group = this->find(key, hash(key), added);
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        Accumulator partial;
+        partial.count = row.at("_count" + std::to_string(i)).n;
+        partial.sum = std::stoll(row.at("_sum" + std::to_string(i)).s);
+        partial.value = row.at("_value" + std::to_string(i));
+        this->combine(group.accumulators[i], partial, this->aggregates[i].function);
+    }
+    if (added && this->bytes > this->budget && this->depth < MAX_DEPTH)
+        this->spill();
+}
+
+// partitioned by the high bits of the hash (the next four at each depth); the slots use the low ones
+void HashAggregate::spill() {
+    if (this->partitions.empty())
+        this->partitions.resize(N_PARTITIONS);
+    ColumnNames column_names = this->spill_columns();
+    ColumnAttributes column_attributes = this->spill_attributes();
+    for (auto const &group : this->groups) {
+        std::vector<SpillTable *> &partition = this->partitions[(group.hash >> (32 + 4 * this->depth)) % N_PARTITIONS];
+        if (partition.empty())
+            partition.push_back(new SpillTable(column_names, column_attributes));
+        ValueDict row = this->spill_row(group);
+        partition.front()->write(&row);
+    }
+    this->clear();
+}
+
+ValueDict *HashAggregate::result(const Group &group) const {
+    ValueDict *row = new ValueDict();
+    for (size_t i = 0; i < this->group_columns.size(); i++)
+        (*row)[this->group_columns[i]] = group.key[i];
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const Aggregate &aggregate = this->aggregates[i];
+        const Accumulator &accumulator = group.accumulators[i];
+        switch (aggregate.function) {
+            case Aggregate::COUNT:
+                (*row)[aggregate.result_name] = Value((int32_t) accumulator.count);
+                break;
+            case Aggregate::SUM:
+                if (accumulator.sum < INT32_MIN || accumulator.sum > INT32_MAX) {
+                    delete row;
+                    throw DbRelationError(aggregate.result_name + " is out of INT range");
+                }
+                (*row)[aggregate.result_name] = Value((int32_t) accumulator.sum);
+                break;
+            default:
+                (*row)[aggregate.result_name] = accumulator.value;
+        }
+    }
+    return row;
+}
+
+// once anything has been spilled, everything is: then each partition in turn is read
+// back and aggregated, about 1/N_PARTITIONS of the groups at a time, by an aggregation
+// of its own that spills and partitions them again if they still outgrow the budget
+ValueDicts *HashAggregate::results() {
+    ValueDicts *rows = new ValueDicts();
+    try {
+        if (this->partitions.empty()) {
+            for (auto const &group : this->groups)
+                rows->push_back(this->result(group));
+            this->clear();
+            return rows;
+        }
+        this->spill();
+        for (auto &partition : this->partitions) {
+            HashAggregate part(this->group_columns, this->group_attributes, this->aggregates,
+                               this->aggregate_attributes, this->budget);
+            part.depth = this->depth + 1;
+            for (auto table : partition) {
+                while (ValueDict *row = table->next()) {
+                    try {
+                        part.add_partial(*row);
+                    } catch (...) {
+                        delete row;
+                        throw;
+                    }
+                    delete row;
+                }
+            }
+            while (!partition.empty()) {
+                SpillTable *table = partition.back();
+                partition.pop_back();
+                try {
+                    table->drop();
+                } catch (...) {
+                    // as in the destructor
+                }
+                delete table;
+            }
+            ValueDicts *part_rows = part.results();
+            rows->insert(rows->end(), part_rows->begin(), part_rows->end());
+            delete part_rows;
+        }
+    } catch (...) {
+        for (auto row : *rows)
+            delete row;
+        delete rows;
+        throw;
+    }
+    return rows;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file aggregate.h - Grouping rows and computing aggregates over each group, for GROUP BY.
+ * Aggregate
+ * HashAggregate
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <vector>
+#include "heap_storage.h"
+#include "sort.h"
+
+/**
+ * @class Aggregate - one aggregate function of a select list, e.g. SUM(x)
+ */
+class Aggregate {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX
+    };
+
+    Aggregate(Function function, Identifier column_name, Identifier result_name) : function(function),
+            column_name(column_name), result_name(result_name) {}
+
+    Function function;
+    Identifier column_name;     // empty for COUNT(*)
+    Identifier result_name;     // what the result column is called
+};
+
+typedef std::vector<Aggregate> Aggregates;
+
+/**
+ * @class HashAggregate - groups rows in a hash table and aggregates each group in one pass
+ *
+ * The hash table is open-addressed (linear probing) and keyed on the group columns.
+ * When its groups outgrow the memory budget, their partial aggregates are spilled,
+ * partitioned by hash, to SpillTables; results() then aggregates one partition at a time,
+ * partitioning again (on other bits of the hash) any partition that still doesn't fit.
+ */
+class HashAggregate {
+public:
+    static const uint N_PARTITIONS = 16;
+    static const size_t PARALLEL_MIN_ROWS = 10000;    // per worker thread in add_all
+    static const uint MAX_DEPTH = 8;                    // times the 32 high bits of a hash can be partitioned
+
+    /**
+     * @param group_columns         the GROUP BY columns (none for a single group)
+     * @param group_attributes      their attributes
+     * @param aggregates            the aggregates to compute for each group
+     * @param aggregate_attributes  the attributes of the columns they aggregate (anything for COUNT(*))
+     * @param budget                bytes of groups to hold in memory
+     */
+    HashAggregate(const ColumnNames &group_columns, const ColumnAttributes &group_attributes,
+                  const Aggregates &aggregates, const ColumnAttributes &aggregate_attributes,
+                  size_t budget = ExternalSort::memory_budget);
+
+    virtual ~HashAggregate();
+
+    HashAggregate(const HashAggregate &other) = delete;
+
+    HashAggregate &operator=(const HashAggregate &other) = delete;
+
+    /**
+     * Add a row (it needs the group columns and the aggregated columns).
+     */
+    virtual void add(const ValueDict &row);
+
+    /**
+     * Add the rows of a table, on several threads when there are enough of them:
+     * each worker aggregates a share of the handles by itself, then they are merged.
+     * @param column_names  the columns each row needs
+     */
+    virtual void add_all(DbRelation &table, const Handles &handles, const ColumnNames &column_names);
+
+    /**
+     * Take over another aggregation's groups (including any it spilled), leaving it empty.
+     */
+    virtual void merge(HashAggregate &other);
+
+    /**
+     * One row per group: its group columns and its aggregates, by result_name (freed by caller).
+     * @throws DbRelationError  if a SUM does not fit in an INT
+     */
+    virtual ValueDicts *results();
+
+protected:
+    class Accumulator {
+    public:
+        Accumulator() : count(0), sum(0), value() {}
+
+        int64_t count;
+        int64_t sum;
+        Value value;            // MIN or MAX so far, once count > 0
+    };
+
+    class Group {
+    public:
+        u_int64_t hash;
+        std::vector<Value> key;
+        std::vector<Accumulator> accumulators;
+    };
+
+    ColumnNames group_columns;
+    ColumnAttributes group_attributes;
+    Aggregates aggregates;
+    ColumnAttributes aggregate_attributes;
+    size_t budget;
+    uint depth;                     // how many times these groups have been partitioned already
+
+    std::vector<Group> groups;
+    std::vector<int32_t> slots;     // index into groups, or -1 for an empty slot
+    size_t bytes;                   // estimated size of groups and slots
+    std::vector<std::vector<SpillTable *>> partitions;  // empty until the first spill
+
+    // the group for key, added if it is new
+    Group &find(const std::vector<Value> &key, u_int64_t hash, bool &added);
+
+    void grow();
+
+    void accumulate(Accumulator &accumulator, const Value &value, Aggregate::Function function);
+
+    void combine(Accumulator &into, const Accumulator &from, Aggregate::Function function);
+
+    // write every group's partial aggregates to its partition, and empty the table
+    void spill();
+
+    void clear();
+
+    // a spilled group: its key, then for each aggregate _count<i>, _sum<i> and _value<i>
+    ColumnNames spill_columns() const;
+
+    ColumnAttributes spill_attributes() const;
+
+    ValueDict spill_row(const Group &group) const;
+
+    void add_partial(const ValueDict &row);
+
+    ValueDict *result(const Group &group) const;
+
+    static u_int64_t hash(const std::vector<Value> &key);
+
+    static bool equal(const std::vector<Value> &a, const std::vector<Value> &b);
+
+    static size_t group_bytes(const Group &group);
+};
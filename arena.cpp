@@ -0,0 +1,169 @@
+/**
+ * @file arena.cpp - implementation of StatementArena, ArenaScope
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "arena.h"
+#include <cstdlib>
+#include <new>
+
+/**
+ * StatementArena implementation
+ */
+const size_t StatementArena::CHUNK_SZ;
+const size_t StatementArena::ALIGNMENT;
+thread_local StatementArena *StatementArena::current = nullptr;
+std::map<const char *, StatementArena::Chunk> StatementArena::all_held;
+RWLatch StatementArena::all_held_latch;
+
+StatementArena &StatementArena::mine() {
+    static thread_local StatementArena arena;
+    return arena;
+}
+
+StatementArena::~StatementArena() {
+    this->release();
+    if (this->spare != nullptr) {
+        ExclusiveLatch latch(all_held_latch);
+        all_held.erase(this->spare);
+    }
+    std::free(this->spare);
+}
+
+size_t StatementArena::get_reserved() {
+    return mine().reserved;
+}
+
+void *StatementArena::allocate(size_t size) {
+    size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    Header *header;
+    if (current == nullptr) {
+        header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+        if (header == nullptr)
+            throw std::bad_alloc();
+        header->size = size;
+    } else {
+        header = current->carve(size);
+    }
+    return header + 1;
+}
+
+void StatementArena::free(void *p) {
+    if (p == nullptr)
+        return;
+    Header *header = static_cast<Header*>(p) - 1;
+    if (current != nullptr && current->holds(header)) {
+        Header *&head = current->free_lists[header->size];
+        header->next_free = head;
+        head = header;
+        return;
+    }
+    // only the owning thread touches an arena; anyone else's free waits for its release
+    if (any_holds(header))
+        return;
+    std::free(header);
+}
+
+void StatementArena::hold(char *chunk, size_t size) {
+    ExclusiveLatch latch(all_held_latch);
+    all_held[chunk] = Chunk{chunk + size, this};
+    this->held[chunk] = chunk + size;
+}
+
+bool StatementArena::holds(const void *p) const {
+    const char *address = static_cast<const char*>(p);
+    auto chunk = this->held.upper_bound(address);
+    if (chunk == this->held.begin())
+        return false;
+    --chunk;
+    return address < chunk->second;
+}
+
+bool StatementArena::any_holds(const void *p) {
+    const char *address = static_cast<const char*>(p);
+    SharedLatch latch(all_held_latch);
+    auto chunk = all_held.upper_bound(address);
+    if (chunk == all_held.begin())
+        return false;
+    --chunk;
+    return address < chunk->second.end;
+}
+
+StatementArena::Header *StatementArena::carve(size_t size) {
+    auto free_list = this->free_lists.find(size);
+    if (free_list != this->free_lists.end() && free_list->second != nullptr) {
+        Header *header = free_list->second;
+        free_list->second = header->next_free;
+        return header;
+    }
+
+    size_t needed = sizeof(Header) + size;
+    char *memory;
+    if (needed > CHUNK_SZ / 4) {
+        // big enough for a chunk of its own, so the regular chunk stays where it was
+        memory = static_cast<char*>(std::malloc(needed));
+        if (memory == nullptr)
+            throw std::bad_alloc();
+        this->hold(memory, needed);
+        this->big_chunks.push_back(memory);
+        this->reserved += needed;
+    } else {
+        if (this->at == nullptr || (size_t) (this->end - this->at) < needed) {
+            char *chunk = this->spare;
+            this->spare = nullptr;
+            if (chunk == nullptr)
+                chunk = static_cast<char*>(std::malloc(CHUNK_SZ));
+            if (chunk == nullptr)
+                throw std::bad_alloc();
+            this->hold(chunk, CHUNK_SZ);
+            this->chunks.push_back(chunk);
+            this->reserved += CHUNK_SZ;
+            this->at = chunk;
+            this->end = chunk + CHUNK_SZ;
+        }
+        memory = this->at;
+        this->at += needed;
+    }
+    Header *header = reinterpret_cast<Header*>(memory);
+    header->size = size;
+    return header;
+}
+
+// one regular chunk is kept as the spare, so small statements never go to the heap; it is
+// still counted in all_held, so until it is used again a free of what it held is ignored
+void StatementArena::release() {
+    if (this->spare == nullptr && !this->chunks.empty())
+        this->spare = this->chunks.front();
+    {
+        ExclusiveLatch latch(all_held_latch); // before the chunks go back, or their next owner's frees look like ours
+        for (auto const &chunk : this->held)
+            if (chunk.first != this->spare)
+                all_held.erase(chunk.first);
+    }
+    this->held.clear();
+    this->free_lists.clear();
+    for (auto chunk : this->chunks)
+        if (chunk != this->spare)
+            std::free(chunk);
+    for (auto chunk : this->big_chunks)
+        std::free(chunk);
+    this->chunks.clear();
+    this->big_chunks.clear();
+    this->reserved = 0;
+    this->at = this->end = nullptr;
+}
+
+/**
+ * ArenaScope implementation
+ */
+ArenaScope::ArenaScope() : outermost(StatementArena::current == nullptr) {
+    if (this->outermost)
+        StatementArena::current = &StatementArena::mine();
+}
+
+ArenaScope::~ArenaScope() {
+    if (this->outermost) {
+        StatementArena::current->release();
+        StatementArena::current = nullptr;
+    }
+}
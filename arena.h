@@ -0,0 +1,125 @@
+/**
+ * @file arena.h - Memory for the temporaries of one statement, released when it ends.
+ * StatementArena
+ * ArenaScope
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "db_cxx.h"
+#include "latch.h"
+
+/**
+ * @class StatementArena - a per-thread arena for a statement's short-lived allocations
+ *
+ * While an ArenaScope is open on a thread, allocate() carves memory out of that thread's
+ * arena: big chunks handed out by bumping a pointer, with freed pieces kept on a free list
+ * per size so a scan that gets and frees a block at a time keeps reusing the same memory.
+ * When the outermost ArenaScope ends, all of it goes back at once.
+ *
+ * Without a scope (or on another thread, e.g. BlockIO's), allocate() uses the heap. free()
+ * tells which is which by the address alone, from the chunks the arenas hold now, without
+ * reading the memory it is given. Memory from the arena must not outlive the statement: once
+ * its chunk is gone (or reused), a free can no longer tell it from heap memory.
+ */
+class StatementArena {
+public:
+    static const size_t CHUNK_SZ = 256 * 1024;
+    static const size_t ALIGNMENT = 16;
+
+    /**
+     * Memory for size bytes, aligned for anything, from this thread's arena if a
+     * statement is running on it, otherwise from the heap.
+     */
+    static void *allocate(size_t size);
+
+    /**
+     * Give back memory from allocate() (nullptr is fine). Arena memory freed on another
+     * thread is simply left for the arena to release.
+     */
+    static void free(void *p);
+
+    /**
+     * Whether this thread is running a statement.
+     */
+    static bool active() { return current != nullptr; }
+
+    /**
+     * Bytes of chunks this thread's arena is using for the statement now.
+     */
+    static size_t get_reserved();
+
+protected:
+    // in front of every allocation
+    class Header {
+    public:
+        size_t size;                // rounded up to ALIGNMENT
+        Header *next_free;          // on the arena's free list
+    };
+
+    // where a chunk ends, and whose it is
+    class Chunk {
+    public:
+        const char *end;
+        StatementArena *arena;
+    };
+
+    StatementArena() : chunks(), big_chunks(), spare(nullptr), at(nullptr), end(nullptr), free_lists(), reserved(0),
+            held() {}
+
+    ~StatementArena();
+
+    std::vector<char *> chunks;     // of CHUNK_SZ each
+    std::vector<char *> big_chunks; // one allocation each
+    char *spare;                    // a chunk kept from the last statement for the next
+    char *at;                       // next free byte of the last regular chunk
+    char *end;
+    std::unordered_map<size_t, Header *> free_lists;
+    size_t reserved;
+    std::map<const char *, const char *> held;      // this arena's chunks in use: start to end
+
+    static thread_local StatementArena *current;   // this thread's arena while a scope is open
+    static std::map<const char *, Chunk> all_held; // every arena's chunks in use, by start
+    static RWLatch all_held_latch;
+
+    static StatementArena &mine();
+
+    Header *carve(size_t size);
+
+    // start using a chunk of size bytes (until release)
+    void hold(char *chunk, size_t size);
+
+    // whether memory lies in one of this arena's chunks (only its own thread may ask)
+    bool holds(const void *p) const;
+
+    // whether memory lies in any arena's chunk
+    static bool any_holds(const void *p);
+
+    // give back everything (but a spare chunk)
+    void release();
+
+    friend class ArenaScope;
+};
+
+/**
+ * @class ArenaScope - for its lifetime, a statement runs on this thread: its temporaries come
+ * from the thread's StatementArena, released when the outermost scope ends
+ */
+class ArenaScope {
+public:
+    ArenaScope();
+
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope &other) = delete;
+
+    ArenaScope &operator=(const ArenaScope &other) = delete;
+
+private:
+    bool outermost;
+};
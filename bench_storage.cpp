@@ -0,0 +1,276 @@
+/**
+ * @file bench_storage.cpp - benchmarks for the heap storage engine
+ *
+ * Usage: bench5300 dbenvpath [-r rows] [-s int|mixed|dict] [-p page_size] [-c] [-seed n] [-b cache_mb]
+ *
+ * Runs each workload against a fresh table and prints one JSON object per line:
+ *      {"bench": "heap_insert", "schema": "mixed", "rows": 10000, "page_size": 4096, "compressed": false,
+ *       "ops": 10000, "seconds": 0.42, "ops_per_sec": 23809.5, "p50_us": 38.1, "p90_us": 51.0, "p99_us": 97.2,
+ *       "max_us": 810.4}
+ * Rows are generated from a fixed seed, so runs with the same arguments do the same work.
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "db_cxx.h"
+#include "heap_storage.h"
+#include "storage_stats.h"
+
+DbEnv *_DB_ENV;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @class BenchResult - timings for one workload
+ */
+class BenchResult {
+public:
+    BenchResult(std::string name, std::string schema, uint rows, uint page_size, bool compressed = false)
+            : name(name), schema(schema), rows(rows), page_size(page_size), compressed(compressed), ops(0),
+              seconds(0.0) {}
+
+    /**
+     * Record a sample of n operations that together took the given time.
+     */
+    void add(double sample_seconds, uint n = 1) {
+        seconds += sample_seconds;
+        ops += n;
+        latencies_us.push_back(sample_seconds * 1e6 / n);
+    }
+
+    /**
+     * Print as a single line of JSON.
+     */
+    void print(std::ostream &out) {
+        std::sort(latencies_us.begin(), latencies_us.end());
+        out << "{\"bench\": \"" << name << "\", \"schema\": \"" << schema << "\", \"rows\": " << rows
+            << ", \"page_size\": " << page_size << ", \"compressed\": " << (compressed ? "true" : "false")
+            << ", \"ops\": " << ops << ", \"seconds\": " << seconds
+            << ", \"ops_per_sec\": " << (seconds > 0 ? ops / seconds : 0.0)
+            << ", \"p50_us\": " << percentile(0.50) << ", \"p90_us\": " << percentile(0.90)
+            << ", \"p99_us\": " << percentile(0.99) << ", \"max_us\": " << percentile(1.0) << "}" << std::endl;
+    }
+
+protected:
+    std::string name;
+    std::string schema;
+    uint rows;
+    uint page_size;
+    bool compressed;
+    u_int64_t ops;
+    double seconds;
+    std::vector<double> latencies_us;
+
+    double percentile(double p) {
+        if (latencies_us.empty())
+            return 0.0;
+        size_t i = (size_t) (p * (latencies_us.size() - 1) + 0.5);
+        return latencies_us[i];
+    }
+};
+
+static double elapsed(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Schema for the workloads: "int" is three INT columns, "mixed" adds two TEXT columns,
+ * and "dict" is "mixed" with its low-cardinality status column DICTIONARY-encoded.
+ */
+static void make_schema(const std::string &schema, ColumnNames &names, ColumnAttributes &attributes) {
+    names = {"id", "a", "b"};
+    attributes.assign(3, ColumnAttribute(ColumnAttribute::INT));
+    if (schema != "int") {
+        names.push_back("status");
+        attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT,
+                                             schema == "dict" ? ColumnAttribute::DICTIONARY : ColumnAttribute::PLAIN));
+        names.push_back("note");
+        attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    }
+}
+
+static std::vector<ValueDict> make_rows(const std::string &schema, uint rows, uint seed) {
+    static const char *statuses[] = {"new", "open", "closed", "archived"};
+    std::mt19937 random(seed);
+    std::vector<ValueDict> result;
+    for (uint i = 0; i < rows; i++) {
+        ValueDict row;
+        row["id"] = Value((int32_t) i);
+        row["a"] = Value((int32_t) (random() % 1000));
+        row["b"] = Value((int32_t) random());
+        if (schema != "int") {
+            row["status"] = Value(std::string(statuses[random() % 4]));
+            row["note"] = Value(std::string(8 + random() % 120, (char) ('a' + random() % 26)));
+        }
+        result.push_back(row);
+    }
+    return result;
+}
+
+// fill pages with records until they are full, then read every record back
+static void bench_slotted_page(const std::string &schema, uint rows, uint page_size, std::ostream &out) {
+    const uint BATCH = 64;
+    BenchResult add("slotted_page_add", schema, rows, page_size);
+    BenchResult get("slotted_page_get", schema, rows, page_size);
+    char record[160];
+    std::memset(record, 'x', sizeof(record));
+    Dbt data(record, schema == "int" ? 12 : 96);
+    std::vector<char> buffer(page_size);
+
+    uint done = 0;
+    while (done < rows) {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        Dbt block(buffer.data(), page_size);
+        SlottedPage page(block, 1, true);
+        uint in_page = 0;
+        bool full = false;
+        while (!full && done < rows) {
+            uint n = 0;
+            Clock::time_point start = Clock::now();
+            try {
+                for (; n < BATCH && done + n < rows; n++)
+                    page.add(&data);
+            } catch (DbBlockNoRoomError &e) {
+                full = true;
+            }
+            if (n > 0)
+                add.add(elapsed(start), n);
+            done += n;
+            in_page += n;
+        }
+        for (uint id = 1; id <= in_page; id += BATCH) {
+            uint n = std::min(BATCH, in_page - id + 1);
+            Clock::time_point start = Clock::now();
+            for (uint i = 0; i < n; i++)
+                delete page.get((RecordID) (id + i));
+            get.add(elapsed(start), n);
+        }
+    }
+    add.print(out);
+    get.print(out);
+}
+
+// insert, scan, project and select(where) against a fresh HeapTable (with compressed blocks if asked)
+static void bench_heap_table(const std::string &schema, uint rows, uint page_size, bool compressed, uint seed,
+                             std::ostream &out) {
+    ColumnNames names;
+    ColumnAttributes attributes;
+    make_schema(schema, names, attributes);
+    std::vector<ValueDict> data = make_rows(schema, rows, seed);
+
+    HeapTable table("_bench_" + schema, names, attributes, page_size, compressed);
+    table.create();
+
+    BenchResult insert("heap_insert", schema, rows, page_size, compressed);
+    for (auto const &row : data) {
+        Clock::time_point start = Clock::now();
+        table.insert(&row);
+        insert.add(elapsed(start));
+    }
+    insert.print(out);
+
+    BenchResult scan("heap_scan", schema, rows, page_size, compressed);
+    Handles *handles = nullptr;
+    for (uint i = 0; i < 5; i++) {
+        delete handles;
+        Clock::time_point start = Clock::now();
+        handles = table.select();
+        scan.add(elapsed(start), (uint) handles->size());
+    }
+    scan.print(out);
+
+    BenchResult project("heap_project", schema, rows, page_size, compressed);
+    for (auto const &handle : *handles) {
+        Clock::time_point start = Clock::now();
+        delete table.project(handle);
+        project.add(elapsed(start));
+    }
+    project.print(out);
+
+    BenchResult project_columns("heap_project_columns", schema, rows, page_size, compressed);
+    ColumnNames two = {"id", "a"};
+    for (auto const &handle : *handles) {
+        Clock::time_point start = Clock::now();
+        delete table.project(handle, &two);
+        project_columns.add(elapsed(start));
+    }
+    project_columns.print(out);
+    delete handles;
+
+    // each select(where) is a full scan; time a handful of them
+    BenchResult select("heap_select_where", schema, rows, page_size, compressed);
+    std::mt19937 random(seed + 1);
+    for (uint i = 0; i < 5; i++) {
+        ValueDict where;
+        where["a"] = Value((int32_t) (random() % 1000));
+        Clock::time_point start = Clock::now();
+        Handles *matches = table.select(&where);
+        select.add(elapsed(start));
+        delete matches;
+    }
+    select.print(out);
+
+    table.drop();
+}
+
+int main(int argc, char **argv) {
+    const char *usage = "Usage: bench5300 dbenvpath [-r rows] [-s int|mixed|dict] [-p page_size] [-c] [-seed n] [-b cache_mb]";
+    if (argc < 2) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    uint rows = 10000;
+    uint seed = 5300;
+    uint page_size = DbBlock::BLOCK_SZ;
+    bool compressed = false;
+    std::vector<std::string> schemas = {"int", "mixed"};
+    for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rows = (uint) std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            std::string schema = argv[++i];
+            if (schema != "int" && schema != "mixed" && schema != "dict") {
+                std::cerr << usage << std::endl;
+                return 1;
+            }
+            schemas = {schema};
+        } else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            page_size = (uint) std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-c") == 0) {
+            compressed = true;
+        } else if (std::strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = (uint) std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            BufferPool::cache_bytes = (u_int64_t) std::atoll(argv[++i]) * 1024 * 1024;
+        } else {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+    }
+
+    _DB_ENV = new DbEnv(0U);
+    BufferPool::configure(_DB_ENV);
+    try {
+        _DB_ENV->open(argv[1], DB_CREATE | DB_INIT_MPOOL, 0);
+        for (auto const &schema : schemas) {
+            bench_slotted_page(schema, rows, page_size, std::cout);
+            bench_heap_table(schema, rows, page_size, compressed, seed, std::cout);
+        }
+    } catch (DbException &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    _DB_ENV->close(0);
+    return 0;
+}
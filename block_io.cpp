@@ -0,0 +1,48 @@
+/**
+ * @file block_io.cpp - implementation of BlockIO
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "block_io.h"
+#include "storage_engine.h"
+#include "transaction.h"
+
+const uint BlockIO::N_THREADS;
+
+bool BlockIO::available() {
+    if (TransactionManager::in_transaction() || _DB_ENV == nullptr)
+        return false;
+    u_int32_t env_flags = 0;
+    _DB_ENV->get_open_flags(&env_flags);
+    return (env_flags & DB_THREAD) != 0;
+}
+
+BlockIO &BlockIO::instance() {
+    static BlockIO *io = new BlockIO();
+    return *io;
+}
+
+// the threads are started by the first request, so a process that never queues one has none
+void BlockIO::enqueue(std::function<void()> request) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->started) {
+        for (uint i = 0; i < N_THREADS; i++)
+            std::thread(&BlockIO::run, this).detach();
+        this->started = true;
+    }
+    this->requests.push_back(request);
+    this->queued.notify_one();
+}
+
+void BlockIO::run() {
+    while (true) {
+        std::function<void()> request;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->queued.wait(lock, [this]() { return !this->requests.empty(); });
+            request = this->requests.front();
+            this->requests.pop_front();
+        }
+        request(); // a packaged_task: whatever it throws goes to its future
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ * @file block_io.h - A queue of block reads and writes run on background threads.
+ * BlockIO
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "db_cxx.h"
+
+/**
+ * @class BlockIO - the process's block I/O submission queue
+ *
+ * Requests are run in submission order by a small pool of I/O threads, so a caller can
+ * keep several block reads (or a batch of writes) in flight while it works on the blocks
+ * it already has. The threads call BerkeleyDB like any other thread would: the Db handles
+ * they use must be free-threaded, and they run outside any transaction.
+ */
+class BlockIO {
+public:
+    static const uint N_THREADS = 4;
+
+    /**
+     * Whether this thread may hand its block I/O to the queue: only if the environment is
+     * free-threaded, and not inside a transaction (the I/O threads would not be in it).
+     */
+    static bool available();
+
+    /**
+     * Queue a request; its result, or what it threw, comes back through the future.
+     */
+    template<typename T>
+    static std::future<T> submit(std::function<T()> request) {
+        std::shared_ptr<std::packaged_task<T()>> task = std::make_shared<std::packaged_task<T()>>(request);
+        std::future<T> result = task->get_future();
+        instance().enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+protected:
+    BlockIO() : started(false) {}
+
+    std::mutex mutex;                   // guards everything below
+    std::condition_variable queued;
+    std::deque<std::function<void()>> requests;
+    bool started;
+
+    // the one queue (never freed: its threads run for the life of the process)
+    static BlockIO &instance();
+
+    void enqueue(std::function<void()> request);
+
+    void run();
+};
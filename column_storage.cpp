@@ -0,0 +1,599 @@
+/**
+ * @file column_storage.cpp - implementation of ColumnPage and ColumnTable
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "column_storage.h"
+#include "storage_stats.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+typedef uint16_t u16;
+typedef u_int32_t u32;
+
+/**
+ * ColumnPage implementation
+ */
+const u32 ColumnPage::MAX_VALUES;
+
+// column blocks are always CLASSIC, so the fields start right after the block header
+ColumnPage::ColumnPage(Dbt &block, BlockID block_id, u32 width, bool is_new, bool owns_data)
+        : SlottedPage(block, block_id, is_new, owns_data, CLASSIC), width(width) {
+    if (is_new) {
+        this->end_free = 0; // no room for records
+        put_header();
+        put_field(COUNT, 0);
+        put_field(USED, 0);
+        put_field(MIN, (u32) INT_MAX);
+        put_field(MAX, (u32) INT_MIN);
+    }
+}
+
+u32 ColumnPage::max_value_size(u32 block_size) {
+    u32 header = block_size > SlottedPage::NARROW_MAX ? 8 : 4;
+    return std::min<u32>(0xFFFF, block_size - header - 4 * sizeof(u32) - sizeof(u16));
+}
+
+bool ColumnPage::has_room_for(u32 size) const {
+    u32 needed = this->width == 0 ? sizeof(u16) + size : this->width;
+    return get_count() < MAX_VALUES && values_offset() + get_field(USED) + needed <= this->block_size;
+}
+
+u32 ColumnPage::append(const char *value, u32 size) {
+    if (!has_room_for(size))
+        throw DbBlockNoRoomError("not enough room for a new value");
+    u32 used = get_field(USED);
+    char *to = bytes() + values_offset() + used;
+    if (this->width == 0) {
+        u16 length = static_cast<u16>(size);
+        std::memcpy(to, &length, sizeof(length));
+        std::memcpy(to + sizeof(length), value, size);
+        used += sizeof(length) + size;
+    } else {
+        std::memcpy(to, value, this->width);
+        used += this->width;
+    }
+    u32 count = get_count();
+    put_field(USED, used);
+    put_field(COUNT, count + 1);
+    return count;
+}
+
+const char *ColumnPage::get_value(u32 index, u32 &size) const {
+    if (index >= get_count())
+        throw DbRelationError("no such value in column block");
+    const char *from = bytes() + values_offset();
+    if (this->width != 0) {
+        size = this->width;
+        return from + index * this->width;
+    }
+    u16 length;
+    for (u32 i = 0; i < index; i++) {
+        std::memcpy(&length, from, sizeof(length));
+        from += sizeof(length) + length;
+    }
+    std::memcpy(&length, from, sizeof(length));
+    size = length;
+    return from + sizeof(length);
+}
+
+void ColumnPage::get_values(std::vector<std::pair<const char *, u32>> &values) const {
+    u32 count = get_count();
+    values.clear();
+    values.reserve(count);
+    const char *from = bytes() + values_offset();
+    for (u32 i = 0; i < count; i++) {
+        if (this->width != 0) {
+            values.push_back(std::make_pair(from, this->width));
+            from += this->width;
+        } else {
+            u16 length;
+            std::memcpy(&length, from, sizeof(length));
+            values.push_back(std::make_pair(from + sizeof(length), (u32) length));
+            from += sizeof(length) + length;
+        }
+    }
+}
+
+void ColumnPage::truncate(u32 count) {
+    if (count >= get_count())
+        return;
+    u32 used = 0;
+    if (this->width != 0) {
+        used = count * this->width;
+    } else {
+        const char *from = bytes() + values_offset();
+        for (u32 i = 0; i < count; i++) {
+            u16 length;
+            std::memcpy(&length, from + used, sizeof(length));
+            used += sizeof(length) + length;
+        }
+    }
+    put_field(USED, used);
+    put_field(COUNT, count);
+}
+
+void ColumnPage::put_value(u32 index, const char *value) {
+    if (this->width == 0)
+        throw DbRelationError("only fixed-width values can be overwritten");
+    if (index >= get_count())
+        throw DbRelationError("no such value in column block");
+    std::memcpy(bytes() + values_offset() + index * this->width, value, this->width);
+}
+
+void ColumnPage::widen(int32_t n) {
+    if (n < (int32_t) get_field(MIN))
+        put_field(MIN, (u32) n);
+    if (n > (int32_t) get_field(MAX))
+        put_field(MAX, (u32) n);
+}
+
+/**
+ * ColumnTable implementation
+ */
+const char ColumnTable::LIVE;
+const char ColumnTable::DEAD;
+
+ColumnTable::ColumnTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                         u_int32_t block_size)
+        : DbRelation(table_name, column_names, column_attributes), rows(table_name, block_size), files() {
+    for (auto const &column_name : this->column_names)
+        this->files.push_back(new HeapFile(table_name + "." + column_name, block_size));
+}
+
+ColumnTable::~ColumnTable() {
+    for (auto file : this->files)
+        delete file;
+}
+
+void ColumnTable::create() {
+    ExclusiveLatch latch(this->rows.latch());
+    for (u32 i = 0; i < this->files.size(); i++) {
+        this->files[i]->create();
+        this->format(*this->files[i], this->width(i));
+    }
+    this->rows.create();
+    this->format(this->rows, 1);
+}
+
+void ColumnTable::create_if_not_exists() {
+    try {
+        this->open(); // Attempt to open, which succeeds if the files exist
+    } catch (const std::exception &e) {
+        this->create();
+    }
+}
+
+void ColumnTable::drop() {
+    ExclusiveLatch latch(this->rows.latch());
+    this->rows.drop();
+    for (auto file : this->files)
+        file->drop();
+}
+
+// the rows file is opened last, so once it is open so are all the others
+// (and a column file an append left behind has caught up)
+void ColumnTable::open() {
+    if (this->rows.is_open())
+        return;
+    ExclusiveLatch latch(this->rows.latch());
+    for (auto file : this->files)
+        file->open();
+    this->rows.open();
+    this->extend(this->rows.get_last_block_id());
+}
+
+void ColumnTable::close() {
+    this->rows.close();
+    for (auto file : this->files)
+        file->close();
+}
+
+Handle ColumnTable::insert(const ValueDict *row) {
+    this->open();
+    ValueDict *full_row = this->validate(row);
+    Handle handle;
+    try {
+        ExclusiveLatch latch(this->rows.latch());
+        handle = this->append(full_row);
+    } catch (...) {
+        delete full_row;
+        throw;
+    }
+    delete full_row;
+    return handle;
+}
+
+void ColumnTable::update(const Handle handle, const ValueDict *new_values) {
+    this->open();
+    ExclusiveLatch latch(this->rows.latch());
+    ValueDict *row = this->project_live(handle, this->column_names);
+    for (auto const &value : *new_values) {
+        if (std::find(this->column_names.begin(), this->column_names.end(), value.first) == this->column_names.end()) {
+            delete row;
+            throw DbRelationError("unknown column " + value.first);
+        }
+        (*row)[value.first] = value.second;
+    }
+    ValueDict *full_row;
+    try {
+        full_row = this->validate(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+    try {
+        this->append(full_row);
+    } catch (...) {
+        delete full_row;
+        throw;
+    }
+    delete full_row;
+    this->remove(handle);
+}
+
+void ColumnTable::del(const Handle handle) {
+    this->open();
+    ExclusiveLatch latch(this->rows.latch());
+    this->remove(handle);
+}
+
+Handles *ColumnTable::select() {
+    this->open();
+    Handles *handles = new Handles();
+    SharedLatch latch(this->rows.latch());
+    ReadAhead blocks(this->rows, this->rows.block_ids());
+    std::vector<std::pair<const char *, u32>> flags;
+    SlottedPage *block;
+    while ((block = blocks.next()) != nullptr) {
+        ColumnPage live(*block->get_block(), block->get_block_id(), 1);
+        live.get_values(flags);
+        for (u32 i = 0; i < flags.size(); i++)
+            if (*flags[i].first == LIVE)
+                handles->push_back(Handle(block->get_block_id(), i + 1));
+        delete block;
+    }
+    return handles;
+}
+
+// a block at a time: each where column's values are compared in one pass over its block,
+// INT columns first so a zone map can rule the block out before the others are read
+Handles *ColumnTable::select(const ValueDict *where) {
+    if (where == nullptr)
+        return this->select();
+    this->open();
+    Handles *handles = new Handles();
+    std::vector<std::pair<u32, Value>> terms;
+    for (auto const &column : *where) {
+        auto found = std::find(this->column_names.begin(), this->column_names.end(), column.first);
+        if (found == this->column_names.end()) {
+            delete handles;
+            throw DbRelationError("unknown column " + column.first);
+        }
+        u32 i = found - this->column_names.begin();
+        if (this->column_attributes[i].get_data_type() != column.second.data_type)
+            return handles; // never equal
+        terms.push_back(std::make_pair(i, column.second));
+    }
+    std::stable_partition(terms.begin(), terms.end(), [](const std::pair<u32, Value> &term) {
+        return term.second.data_type == ColumnAttribute::INT;
+    });
+
+    SharedLatch latch(this->rows.latch());
+    BlockID last = this->rows.get_last_block_id();
+    std::vector<std::pair<const char *, u32>> values;
+    std::vector<char> match;
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        bool skipped = false;
+        bool started = false;
+        for (auto const &term : terms) {
+            SlottedPage *block = this->files[term.first]->get(block_id);
+            ColumnPage page(*block->get_block(), block_id, this->width(term.first));
+            const Value &value = term.second;
+            if (value.data_type == ColumnAttribute::INT && !page.might_hold(value.n)) {
+                skipped = true;
+                delete block;
+                break;
+            }
+            page.get_values(values);
+            if (!started) {
+                match.assign(values.size(), 1);
+                started = true;
+            }
+            for (u32 i = 0; i < match.size() && i < values.size(); i++) {
+                if (!match[i])
+                    continue;
+                if (value.data_type == ColumnAttribute::INT) {
+                    int32_t n;
+                    std::memcpy(&n, values[i].first, sizeof(n));
+                    match[i] = n == value.n;
+                } else {
+                    match[i] = values[i].second == value.s.size() &&
+                               std::memcmp(values[i].first, value.s.data(), values[i].second) == 0;
+                }
+            }
+            delete block;
+        }
+        if (skipped) {
+            StorageStats::add(BLOCKS_SKIPPED);
+            continue;
+        }
+        SlottedPage *block = this->rows.get(block_id);
+        ColumnPage live(*block->get_block(), block_id, 1);
+        live.get_values(values);
+        for (u32 i = 0; i < values.size(); i++) {
+            if (*values[i].first != LIVE)
+                continue;
+            StorageStats::add(ROWS_EXAMINED);
+            if (!started || (i < match.size() && match[i]))
+                handles->push_back(Handle(block_id, i + 1));
+            else
+                StorageStats::add(ROWS_FILTERED);
+        }
+        delete block;
+    }
+    return handles;
+}
+
+ValueDict *ColumnTable::project(Handle handle) {
+    this->open();
+    SharedLatch latch(this->rows.latch());
+    return this->project_live(handle, this->column_names);
+}
+
+// only the named columns' blocks are read
+ValueDict *ColumnTable::project(Handle handle, const ColumnNames *column_names) {
+    if (column_names == nullptr || column_names->empty())
+        return this->project(handle);
+    for (auto const &column_name : *column_names)
+        if (std::find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+    this->open();
+    SharedLatch latch(this->rows.latch());
+    return this->project_live(handle, *column_names);
+}
+
+// a block at a time: the handles in a block have their rows checked live together, then
+// each column's block is read once and decoded in one pass for all of them
+void ColumnTable::project_rows(Handles::const_iterator begin, Handles::const_iterator end,
+                               const ColumnNames *column_names, ValueDicts &rows) {
+    if (column_names == nullptr || column_names->empty())
+        column_names = &this->column_names;
+    std::vector<u32> columns;
+    for (auto const &column_name : *column_names) {
+        auto found = std::find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (found == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+        columns.push_back(found - this->column_names.begin());
+    }
+    this->open();
+    SharedLatch latch(this->rows.latch());
+    std::vector<std::pair<const char *, u32>> values;
+    while (begin != end) {
+        BlockID block_id = begin->first;
+        Handles::const_iterator run_end = begin;
+        while (run_end != end && run_end->first == block_id)
+            run_end++;
+
+        SlottedPage *block = this->rows.get(block_id);
+        bool all_live = true;
+        {
+            ColumnPage live(*block->get_block(), block_id, 1);
+            live.get_values(values);
+            for (Handles::const_iterator handle = begin; handle != run_end; handle++)
+                all_live = all_live && handle->second != 0 && handle->second <= values.size() &&
+                           *values[handle->second - 1].first == LIVE;
+        }
+        delete block;
+        if (!all_live)
+            throw DbRelationError("record has been deleted");
+
+        size_t first = rows.size();
+        for (Handles::const_iterator handle = begin; handle != run_end; handle++)
+            rows.push_back(new ValueDict());
+        for (u32 i : columns) {
+            block = this->files[i]->get(block_id);
+            try {
+                ColumnPage page(*block->get_block(), block_id, this->width(i));
+                page.get_values(values);
+                size_t row = first;
+                for (Handles::const_iterator handle = begin; handle != run_end; handle++, row++) {
+                    u32 index = handle->second - 1;
+                    if (index >= values.size())
+                        throw DbRelationError("column files of " + this->table_name + " are out of step");
+                    (*rows[row])[this->column_names[i]] = this->decode(i, values[index].first, values[index].second);
+                }
+            } catch (...) {
+                delete block;
+                throw;
+            }
+            delete block;
+        }
+        StorageStats::add(ROWS_UNMARSHALED, rows.size() - first);
+        begin = run_end;
+    }
+}
+
+u32 ColumnTable::width(u32 column) {
+    return this->column_attributes[column].get_data_type() == ColumnAttribute::INT ? sizeof(int32_t) : 0;
+}
+
+std::string ColumnTable::encode(u32 column, const Value &value) {
+    if (this->column_attributes[column].get_data_type() == ColumnAttribute::INT)
+        return std::string(reinterpret_cast<const char *>(&value.n), sizeof(int32_t));
+    if (value.s.size() > ColumnPage::max_value_size(this->files[column]->get_block_size()))
+        throw DbRelationError("value too long for column " + this->column_names[column]);
+    return value.s;
+}
+
+Value ColumnTable::decode(u32 column, const char *bytes, u32 size) {
+    if (this->column_attributes[column].get_data_type() == ColumnAttribute::INT) {
+        int32_t n;
+        std::memcpy(&n, bytes, sizeof(n));
+        return Value(n);
+    }
+    return Value(std::string(bytes, size));
+}
+
+ValueDict *ColumnTable::validate(const ValueDict *row) {
+    ValueDict *full_row = new ValueDict();
+    for (u32 i = 0; i < this->column_names.size(); i++) {
+        const Identifier &column_name = this->column_names[i];
+        ValueDict::const_iterator column = row->find(column_name);
+        if (column == row->end()) {
+            delete full_row;
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+        }
+        if (column->second.data_type != this->column_attributes[i].get_data_type()) {
+            delete full_row;
+            throw DbRelationError("wrong type of value for column " + column_name);
+        }
+        (*full_row)[column_name] = column->second;
+    }
+    return full_row;
+}
+
+void ColumnTable::format(HeapFile &file, u32 width) {
+    SlottedPage *block = file.get(1);
+    try {
+        ColumnPage page(*block->get_block(), 1, width, true);
+        file.put(&page);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+}
+
+// Empty blocks are added to the column files first and the rows file last, so readers, who
+// go by the rows file's last block, never look for a block that a column file lacks. Adding
+// them may fail part way; the next call (or open) finishes the job.
+void ColumnTable::extend(BlockID last) {
+    for (u32 i = 0; i < this->files.size(); i++)
+        this->extend(*this->files[i], this->width(i), last);
+    this->extend(this->rows, 1, last);
+}
+
+void ColumnTable::extend(HeapFile &file, u32 width, BlockID last) {
+    while (file.get_last_block_id() < last) {
+        SlottedPage *block = file.get_new();
+        try {
+            ColumnPage page(*block->get_block(), block->get_block_id(), width, true);
+            file.put(&page);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        delete block;
+    }
+}
+
+// The row goes into the last block of every file, or into a new block of each if any of
+// them is full. Its values are written before it is marked live in the rows file, so a
+// failure part way leaves values past the last live row, which the next append cuts off.
+Handle ColumnTable::append(const ValueDict *row) {
+    std::vector<std::string> values;
+    for (u32 i = 0; i < this->column_names.size(); i++)
+        values.push_back(this->encode(i, row->at(this->column_names[i])));
+
+    BlockID block_id = this->rows.get_last_block_id();
+    this->extend(block_id); // in case a file fell behind
+    std::vector<SlottedPage *> blocks; // the rows file's, then each column's
+    Handle handle;
+    try {
+        blocks.push_back(this->rows.get(block_id));
+        for (auto file : this->files)
+            blocks.push_back(file->get(block_id));
+        u32 index = ColumnPage(*blocks[0]->get_block(), block_id, 1).get_count();
+        bool room = ColumnPage(*blocks[0]->get_block(), block_id, 1).has_room_for(1);
+        for (u32 i = 0; room && i < this->files.size(); i++) {
+            ColumnPage page(*blocks[i + 1]->get_block(), block_id, this->width(i));
+            if (page.get_count() < index)
+                throw DbRelationError("column files of " + this->table_name + " are out of step");
+            page.truncate(index);
+            room = page.has_room_for(values[i].size());
+        }
+        if (!room) {
+            for (auto block : blocks)
+                delete block;
+            blocks.clear();
+            this->extend(++block_id); // every file has the new block before any value goes in
+            blocks.push_back(this->rows.get(block_id));
+            for (auto file : this->files)
+                blocks.push_back(file->get(block_id));
+            index = 0;
+        }
+
+        for (u32 i = 0; i < this->files.size(); i++) {
+            ColumnPage page(*blocks[i + 1]->get_block(), block_id, this->width(i));
+            page.truncate(index);
+            page.append(values[i].data(), values[i].size());
+            if (this->column_attributes[i].get_data_type() == ColumnAttribute::INT)
+                page.widen(row->at(this->column_names[i]).n);
+            this->files[i]->put(&page);
+        }
+        ColumnPage live(*blocks[0]->get_block(), block_id, 1);
+        handle = Handle(block_id, live.append(&LIVE, 1) + 1);
+        this->rows.put(&live);
+    } catch (...) {
+        for (auto block : blocks)
+            delete block;
+        throw;
+    }
+    for (auto block : blocks)
+        delete block;
+    StorageStats::add(ROWS_MARSHALED);
+    return handle;
+}
+
+void ColumnTable::remove(Handle handle) {
+    SlottedPage *block = this->rows.get(handle.first);
+    try {
+        ColumnPage live(*block->get_block(), handle.first, 1);
+        u32 size;
+        if (handle.second == 0 || handle.second > live.get_count() ||
+            *live.get_value(handle.second - 1, size) != LIVE)
+            throw DbRelationError("record has been deleted");
+        live.put_value(handle.second - 1, &DEAD);
+        this->rows.put(&live);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+}
+
+ValueDict *ColumnTable::project_live(Handle handle, const ColumnNames &column_names) {
+    u32 index = handle.second - 1;
+    SlottedPage *block = this->rows.get(handle.first);
+    bool is_live;
+    {
+        ColumnPage live(*block->get_block(), handle.first, 1);
+        u32 size;
+        is_live = handle.second != 0 && index < live.get_count() && *live.get_value(index, size) == LIVE;
+    }
+    delete block;
+    if (!is_live)
+        throw DbRelationError("record has been deleted");
+
+    ValueDict *row = new ValueDict();
+    for (auto const &column_name : column_names) {
+        u32 i = std::find(this->column_names.begin(), this->column_names.end(), column_name) - this->column_names.begin();
+        block = this->files[i]->get(handle.first);
+        try {
+            ColumnPage page(*block->get_block(), handle.first, this->width(i));
+            u32 size;
+            const char *bytes = page.get_value(index, size);
+            (*row)[column_name] = this->decode(i, bytes, size);
+        } catch (...) {
+            delete block;
+            delete row;
+            throw;
+        }
+        delete block;
+    }
+    StorageStats::add(ROWS_UNMARSHALED);
+    return row;
+}
@@ -0,0 +1,221 @@
+/**
+ * @file column_storage.h - Implementation of storage_engine with a file per column.
+ * ColumnPage: SlottedPage
+ * ColumnTable: DbRelation
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class ColumnPage - a block of one column's values, in row order.
+ *
+ *      Column blocks are HeapFile blocks that start with a SlottedPage header of no records
+        and no free space (like an OverflowPage), followed by:
+            4 bytes: number of values
+            4 bytes: bytes of values
+            4 bytes: smallest INT value (the block's zone map; unused for other columns)
+            4 bytes: largest INT value
+            the values: each of the column's fixed width, or (width 0) a 2-byte length
+            followed by that many bytes
+ */
+class ColumnPage : public SlottedPage {
+public:
+    /**
+     * most values a block holds (so that a value's index + 1 is a RecordID)
+     */
+    static const u_int32_t MAX_VALUES = 65534;
+
+    /**
+     * @param width  bytes of each value, or 0 for length-prefixed values
+     */
+    ColumnPage(Dbt &block, BlockID block_id, u_int32_t width, bool is_new = false, bool owns_data = false);
+
+    virtual ~ColumnPage() {}
+
+    ColumnPage(const ColumnPage &other) = delete;
+
+    ColumnPage(ColumnPage &&temp) = delete;
+
+    ColumnPage &operator=(const ColumnPage &other) = delete;
+
+    ColumnPage &operator=(ColumnPage &temp) = delete;
+
+    u_int32_t get_count() const { return get_field(COUNT); }
+
+    /**
+     * Is there room for another value of size bytes?
+     */
+    virtual bool has_room_for(u_int32_t size) const;
+
+    /**
+     * Add a value after the last one.
+     * @returns  its index (from 0)
+     * @throws DbBlockNoRoomError  if there is no room for it
+     */
+    virtual u_int32_t append(const char *value, u_int32_t size);
+
+    /**
+     * The bytes of a value (pointing into the block), with their size returned by reference.
+     * Length-prefixed values are found by walking the ones before them.
+     */
+    virtual const char *get_value(u_int32_t index, u_int32_t &size) const;
+
+    /**
+     * The bytes and size of every value, in order, in one pass over the block.
+     */
+    virtual void get_values(std::vector<std::pair<const char *, u_int32_t>> &values) const;
+
+    /**
+     * Drop the values from index count on, e.g. ones an insert that failed part way left behind.
+     */
+    virtual void truncate(u_int32_t count);
+
+    /**
+     * Overwrite a value of a fixed-width column.
+     */
+    virtual void put_value(u_int32_t index, const char *value);
+
+    /**
+     * Widen the zone map to take in n.
+     */
+    virtual void widen(int32_t n);
+
+    /**
+     * Could the block hold the INT value n, by its zone map?
+     */
+    virtual bool might_hold(int32_t n) const {
+        return get_count() > 0 && (int32_t) get_field(MIN) <= n && n <= (int32_t) get_field(MAX);
+    }
+
+    /**
+     * Largest value a block of this size can hold with a 2-byte length.
+     */
+    static u_int32_t max_value_size(u_int32_t block_size);
+
+protected:
+    enum Field {
+        COUNT = 0, USED = 1, MIN = 2, MAX = 3
+    };
+
+    u_int32_t width;
+
+    u_int32_t field_offset(Field field) const { return header_entry_size() + field * sizeof(u_int32_t); }
+
+    u_int32_t values_offset() const { return field_offset(MAX) + sizeof(u_int32_t); }
+
+    u_int32_t get_field(Field field) const {
+        u_int32_t n;
+        std::memcpy(&n, bytes() + field_offset(field), sizeof(n));
+        return n;
+    }
+
+    void put_field(Field field, u_int32_t n) { std::memcpy(bytes() + field_offset(field), &n, sizeof(n)); }
+};
+
+/**
+ * @class ColumnTable - Column storage engine (implementation of DbRelation)
+ *
+ * For analytic tables that are mostly scanned a few columns at a time. Each column is kept
+ * in its own HeapFile, <table>.<column>, of ColumnPages: INT values 4 bytes each, TEXT
+ * values length-prefixed (DICTIONARY encoding is not used). A further file, <table>, has a
+ * byte per row saying whether it is live. Block k of every file holds the same rows, so a
+ * row's handle is (k, its index in the blocks + 1); when any of the blocks is full, every
+ * file gets a new one.
+ *
+ * select(where) reads just the where clause's columns, INT ones first, and passes over a
+ * block whose zone map shows it cannot hold an INT value asked for, without reading any
+ * more of its columns. project() reads just the columns asked for, and project_rows() reads
+ * each of their blocks once for all the rows asked for in it.
+ *
+ * A TEXT value has to fit in one block (see ColumnPage::max_value_size); there is no
+ * overflow file as a HeapTable has, and insert() rejects a longer one.
+ *
+ * Rows carry no RowVersion: a change is seen at once by every reader (as with rows a
+ * HeapTable wrote before it had row versions). del() marks the row dead and update() is a
+ * del() and an insert(), so the row gets a new handle. Zone maps only ever widen.
+ * Writers hold the table's latch exclusively, readers share it.
+ */
+class ColumnTable : public DbRelation {
+public:
+    /**
+     * @param block_size  block size for create(); an existing table keeps the size it was created with
+     */
+    ColumnTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                u_int32_t block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~ColumnTable();
+
+    ColumnTable(const ColumnTable &other) = delete;
+
+    ColumnTable(ColumnTable &&temp) = delete;
+
+    ColumnTable &operator=(const ColumnTable &other) = delete;
+
+    ColumnTable &operator=(ColumnTable &&temp) = delete;
+
+    virtual void create();
+
+    virtual void create_if_not_exists();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handle insert(const ValueDict *row);
+
+    virtual void update(const Handle handle, const ValueDict *new_values);
+
+    virtual void del(const Handle handle);
+
+    virtual Handles *select();
+
+    virtual Handles *select(const ValueDict *where);
+
+    virtual ValueDict *project(Handle handle);
+
+    virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
+
+    virtual void project_rows(Handles::const_iterator begin, Handles::const_iterator end,
+                              const ColumnNames *column_names, ValueDicts &rows);
+
+protected:
+    HeapFile rows;                      // a byte per row: 1 if live
+    std::vector<HeapFile *> files;      // one per column, in column order
+
+    static const char LIVE = 1;
+    static const char DEAD = 0;
+
+    // bytes of each of a column's values (0 for length-prefixed)
+    virtual u_int32_t width(u_int32_t column);
+
+    // a value as stored in its column's blocks
+    virtual std::string encode(u_int32_t column, const Value &value);
+
+    virtual Value decode(u_int32_t column, const char *bytes, u_int32_t size);
+
+    virtual ValueDict *validate(const ValueDict *row);
+
+    // lay out a new file's first block as a ColumnPage
+    virtual void format(HeapFile &file, u_int32_t width);
+
+    // add empty ColumnPages to every file that ends before block last
+    virtual void extend(BlockID last);
+
+    virtual void extend(HeapFile &file, u_int32_t width, BlockID last);
+
+    // the rest are for callers holding the table's latch (appending and removing exclusively)
+
+    virtual Handle append(const ValueDict *row);
+
+    virtual void remove(Handle handle);
+
+    virtual ValueDict *project_live(Handle handle, const ColumnNames &column_names);
+};
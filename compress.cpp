@@ -0,0 +1,137 @@
+/**
+ * @file compress.cpp - implementation of BlockCodec
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "compress.h"
+#include <cstring>
+#include <vector>
+
+typedef u_int32_t u32;
+typedef unsigned char byte;
+
+static inline u32 read32(const byte *p) {
+    u32 n;
+    std::memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+// write a length in the token's nibble-plus-255s encoding; false if out of room
+static inline bool put_length(byte *&op, const byte *oend, u32 length) {
+    while (length >= 255) {
+        if (op >= oend)
+            return false;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= oend)
+        return false;
+    *op++ = (byte) length;
+    return true;
+}
+
+// one sequence: literals, then (unless last) a match at offset back
+static bool put_sequence(byte *&op, const byte *oend, const byte *literals, u32 n_literals, u32 offset,
+                         u32 match_length, bool last) {
+    if (op >= oend)
+        return false;
+    byte *token = op++;
+    *token = (byte) ((n_literals >= 15 ? 15 : n_literals) << 4);
+    if (n_literals >= 15 && !put_length(op, oend, n_literals - 15))
+        return false;
+    if ((u32) (oend - op) < n_literals)
+        return false;
+    std::memcpy(op, literals, n_literals);
+    op += n_literals;
+    if (last)
+        return true;
+    if (oend - op < 2)
+        return false;
+    *op++ = (byte) (offset & 0xff);
+    *op++ = (byte) (offset >> 8);
+    u32 code = match_length - 4;
+    *token |= (byte) (code >= 15 ? 15 : code);
+    return code < 15 || put_length(op, oend, code - 15);
+}
+
+u32 BlockCodec::compress(const char *source, u32 n, char *dest, u32 capacity) {
+    const byte *src = (const byte *) source;
+    byte *op = (byte *) dest;
+    const byte *oend = op + capacity;
+    u32 anchor = 0;
+    if (n > LAST_LITERALS + MIN_MATCH + 3) {
+        std::vector<int> table(1 << HASH_LOG, -1);
+        u32 match_limit = n - LAST_LITERALS;            // matches must end before here
+        u32 search_limit = match_limit - MIN_MATCH - 3; // and start before here
+        u32 ip = 0;
+        while (ip < search_limit) {
+            u32 sequence = read32(src + ip);
+            u32 h = (sequence * 2654435761U) >> (32 - HASH_LOG);
+            int ref = table[h];
+            table[h] = (int) ip;
+            if (ref < 0 || ip - ref > MAX_OFFSET || read32(src + ref) != sequence) {
+                ip++;
+                continue;
+            }
+            u32 length = MIN_MATCH;
+            while (ip + length < match_limit && src[ref + length] == src[ip + length])
+                length++;
+            if (!put_sequence(op, oend, src + anchor, ip - anchor, ip - ref, length, false))
+                return 0;
+            ip += length;
+            anchor = ip;
+        }
+    }
+    if (!put_sequence(op, oend, src + anchor, n - anchor, 0, 0, true))
+        return 0;
+    return (u32) (op - (byte *) dest);
+}
+
+bool BlockCodec::decompress(const char *source, u32 n, char *dest, u32 expected) {
+    const byte *ip = (const byte *) source;
+    const byte *iend = ip + n;
+    byte *out = (byte *) dest;
+    u32 op = 0;
+    while (ip < iend) {
+        byte token = *ip++;
+        u32 length = token >> 4;
+        if (length == 15) {
+            byte b;
+            do {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        if ((u32) (iend - ip) < length || expected - op < length)
+            return false;
+        std::memcpy(out + op, ip, length);
+        ip += length;
+        op += length;
+        if (ip == iend)
+            break; // last sequence has no match
+        if (iend - ip < 2)
+            return false;
+        u32 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+        length = token & 15;
+        if (length == 15) {
+            byte b;
+            do {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += MIN_MATCH;
+        if (expected - op < length)
+            return false;
+        for (u32 i = 0; i < length; i++, op++)  // may overlap itself
+            out[op] = out[op - offset];
+    }
+    return op == expected;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file compress.h - Fast block codec for compressed heap files.
+ * BlockCodec
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include "db_cxx.h"
+
+/**
+ * @class BlockCodec - LZ77 compression of a block, in the LZ4 block format
+ *
+ * Greedy matching through a small hash table of 4-byte sequences: fast to
+ * compress, faster to decompress, and good at the zeroed free space and
+ * repeated column values typical of our blocks.
+ */
+class BlockCodec {
+public:
+    /**
+     * Compress n bytes of src into dst.
+     * @returns  size of the compressed data, or 0 if it needs more than capacity bytes
+     */
+    static u_int32_t compress(const char *src, u_int32_t n, char *dst, u_int32_t capacity);
+
+    /**
+     * Decompress n bytes of src into exactly expected bytes of dst.
+     * @returns  false if src is not a valid compressed block of that size
+     */
+    static bool decompress(const char *src, u_int32_t n, char *dst, u_int32_t expected);
+
+protected:
+    static const u_int32_t MIN_MATCH = 4;
+    static const u_int32_t HASH_LOG = 12;
+    static const u_int32_t LAST_LITERALS = 5;   // the format ends every block with at least this many literals
+    static const u_int32_t MAX_OFFSET = 65535;
+};
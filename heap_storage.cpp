@@ -1,7 +1,18 @@
 #include "heap_storage.h"
+#include "block_io.h"
+#include "column_storage.h"
+#include "compress.h"
+#include "redo_log.h"
+#include "storage_stats.h"
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <dirent.h>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <db_cxx.h>
 #include <vector>
 
@@ -9,87 +20,194 @@
 
 // Helper functions to work with bytes and records
 typedef uint16_t u16;
+typedef u_int32_t u32;
+
+// a TEXT length of OVERFLOW_MARK means the value is in overflow blocks
+static const u16 OVERFLOW_MARK = 0xFFFF;
 
 /**
  * SlottedPage implementation
  */
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) {
+const u32 SlottedPage::NARROW_MAX;
+const u32 SlottedPage::MAX_RECORDS;
+
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new, bool owns_data, Format format)
+        : DbBlock(block, block_id, is_new) {
+    this->block_size = block.get_size();
+    this->wide = this->block_size > SlottedPage::NARROW_MAX;
+    this->owns_data = owns_data;
     if (is_new) {
-        this->num_records = 0;
-        this->end_free = DbBlock::BLOCK_SZ - 1;
-        put_header();
+        initialize(format);
+        return;
+    }
+    u32 f = this->field_size();
+    this->format = get_n(0) == this->bitmap_mark() ? BITMAP : CLASSIC;
+    if (this->format == CLASSIC) {
+        this->num_records = get_n(0);
+        this->end_free = get_n(f);
+        this->live_records = this->dead_bytes = this->capacity = this->bitmap_offset = 0;
+        this->directory_offset = this->header_entry_size();
+    } else {
+        this->num_records = get_n(f);
+        this->end_free = get_n(2 * f);
+        this->live_records = get_n(3 * f);
+        this->dead_bytes = get_n(4 * f);
+        this->capacity = get_n(5 * f);
+        this->bitmap_offset = this->lsn_offset() + sizeof(u_int64_t);
+        this->directory_offset = this->bitmap_offset + (this->capacity + 63) / 64 * 8;
+    }
+}
+
+// the bitmap has a bit for as many records as could possibly fit: each takes at least
+// its header and a byte
+void SlottedPage::initialize(Format format) {
+    this->format = format;
+    this->num_records = 0;
+    this->end_free = this->block_size - 1;
+    this->live_records = this->dead_bytes = 0;
+    if (format == CLASSIC) {
+        this->capacity = this->bitmap_offset = 0;
+        this->directory_offset = this->header_entry_size();
     } else {
-        get_header(this->num_records, this->end_free);
+        this->capacity = std::min<u32>(SlottedPage::MAX_RECORDS, this->block_size / (this->header_entry_size() + 1));
+        this->bitmap_offset = this->lsn_offset() + sizeof(u_int64_t);
+        this->directory_offset = this->bitmap_offset + (this->capacity + 63) / 64 * 8;
+        std::memset(this->address(0), 0, this->directory_offset);
     }
+    put_header();
+}
+
+SlottedPage::~SlottedPage() {
+    if (this->owns_data)
+        StatementArena::free(this->block.get_data());
 }
 
 RecordID SlottedPage::add(const Dbt *data) {
     if (!has_room(data->get_size()))
         throw DbBlockNoRoomError("Not enough room for new record");
-    u16 id = ++this->num_records;
-    u16 size = static_cast<u16>(data->get_size());
+    if (this->num_records == SlottedPage::MAX_RECORDS || (this->format == BITMAP && this->num_records == this->capacity))
+        throw DbBlockNoRoomError("No more record ids in this block");
+    RecordID id = static_cast<RecordID>(++this->num_records);
+    u32 size = data->get_size();
     this->end_free -= size;
-    u16 loc = this->end_free + 1;
+    u32 loc = this->end_free + 1;
+    if (this->format == BITMAP) {
+        this->live_records++;
+        set_live(id, true);
+    }
     put_header();
     put_header(id, size, loc);
     std::memcpy(this->address(loc), data->get_data(), size);
+    StorageStats::add(RECORDS_ADDED);
     return id;
 }
 
 Dbt* SlottedPage::get(RecordID record_id) {
-    u16 size, loc;
+    u32 size, loc;
     get_header(size, loc, record_id);
     if (loc == 0) // Record has been deleted
         return nullptr;
     return new Dbt(this->address(loc), size);
 }
 
+// a record that grows moves into the free space, leaving its old bytes dead (like a deleted record's)
 void SlottedPage::put(RecordID record_id, const Dbt &data) {
-    u16 size, loc;
+    u32 size, loc;
     get_header(size, loc, record_id);
     if (data.get_size() > size) {
-        throw DbBlockNoRoomError("New data does not fit in the original space");
+        if (data.get_size() > this->free_space())
+            throw DbBlockNoRoomError("New data does not fit in the original space");
+        this->end_free -= data.get_size();
+        if (this->format == BITMAP)
+            this->dead_bytes += size;
+        loc = this->end_free + 1;
+        put_header();
+        put_header(record_id, data.get_size(), loc);
     }
     std::memcpy(this->address(loc), data.get_data(), data.get_size());
 }
 
 void SlottedPage::del(RecordID record_id) {
+    if (this->format == BITMAP) {
+        u32 size, loc;
+        get_header(size, loc, record_id);
+        if (loc == 0)
+            return; // already deleted
+        this->live_records--;
+        this->dead_bytes += size;
+        set_live(record_id, false);
+        put_header();
+    }
     put_header(record_id, 0, 0); // Mark the record as deleted
 }
 
 RecordIDs* SlottedPage::ids(void) {
     auto ids = new RecordIDs();
-    for (u16 id = 1; id <= this->num_records; ++id) {
-        u16 size, loc;
-        get_header(size, loc, id);
-        if (loc != 0) // If not deleted
-            ids->push_back(id);
-    }
+    ids->reserve(this->live_count());
+    for (RecordID id = this->next_id(0); id != 0; id = this->next_id(id))
+        ids->push_back(id);
     return ids;
 }
 
-bool SlottedPage::has_room(u16 size) {
+u32 SlottedPage::live_count() const {
+    if (this->format == BITMAP)
+        return this->live_records;
+    u32 n = 0;
+    for (RecordID id = this->next_id(0); id != 0; id = this->next_id(id))
+        n++;
+    return n;
+}
+
+void SlottedPage::set_live(u32 record_id, bool live) {
+    char &byte = this->bytes()[this->bitmap_offset + (record_id - 1) / 8];
+    char bit = static_cast<char>(1 << ((record_id - 1) % 8));
+    byte = live ? (byte | bit) : (byte & ~bit);
+}
+
+// the header layout is initialize()'s, with no records yet
+u32 SlottedPage::empty_room(u32 block_size, Format format) {
+    u32 f = block_size > SlottedPage::NARROW_MAX ? 4 : 2;
+    u32 entry = 2 * f;
+    u32 directory_offset = entry;
+    if (format == BITMAP) {
+        u32 capacity = std::min<u32>(SlottedPage::MAX_RECORDS, block_size / (entry + 1));
+        directory_offset = (6 * f + 7) / 8 * 8 + sizeof(u_int64_t) + (capacity + 63) / 64 * 8;
+    }
+    u32 end_free = block_size - 1;
+    return end_free < directory_offset + entry ? 0 : end_free - directory_offset - entry;
+}
+
+bool SlottedPage::has_room(u32 size) const {
     // Calculate available space considering the new record header
-    u16 required_space = size + sizeof(u16) * 2; // Size and location for header
-    u16 available_space = this->end_free - (this->num_records * sizeof(u16) * 2 + sizeof(u16) * 2);
-    return required_space <= available_space;
+    return size + this->header_entry_size() <= this->free_space();
 }
 
-void SlottedPage::get_header(u16 &size, u16 &loc, RecordID id) {
-    size = get_n(4 * id);
-    loc = get_n(4 * id + 2);
+void SlottedPage::get_header(u32 &size, u32 &loc, RecordID id) {
+    u32 offset = this->slot_offset(id);
+    size = get_n(offset);
+    loc = get_n(offset + this->field_size());
 }
 
-void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
-    if (id == 0) { // Block header
-        size = this->num_records;
-        loc = this->end_free;
+void SlottedPage::put_header(RecordID id, u32 size, u32 loc) {
+    u32 f = this->field_size();
+    if (id != 0) {
+        u32 offset = this->slot_offset(id);
+        put_n(offset, size);
+        put_n(offset + f, loc);
+    } else if (this->format == CLASSIC) { // Block header
+        put_n(0, this->num_records);
+        put_n(f, this->end_free);
+    } else {
+        put_n(0, this->bitmap_mark());
+        put_n(f, this->num_records);
+        put_n(2 * f, this->end_free);
+        put_n(3 * f, this->live_records);
+        put_n(4 * f, this->dead_bytes);
+        put_n(5 * f, this->capacity);
     }
-    put_n(4*id, size);
-    put_n(4*id + 2, loc);
 }
 
-void SlottedPage::slide(u_int16_t start, u_int16_t end) {
+void SlottedPage::slide(u32 start, u32 end) {
     // Calculate the amount to slide
     int slide_amount = end - start;
     if (slide_amount == 0) return; // No sliding needed
@@ -107,26 +225,74 @@ void SlottedPage::slide(u_int16_t start, u_int16_t end) {
     this->end_free += slide_amount; // Adjust this as necessary
 }
 
+/**
+ * OverflowPage implementation
+ */
+// overflow blocks are always CLASSIC, so the piece starts right after the block header
+OverflowPage::OverflowPage(Dbt &block, BlockID block_id, bool is_new, bool owns_data)
+        : SlottedPage(block, block_id, is_new, owns_data, CLASSIC) {
+    if (is_new) {
+        this->end_free = 0; // no room for records
+        put_header();
+        set_piece(0, nullptr, 0);
+    }
+}
+
+u32 OverflowPage::capacity(u32 block_size) {
+    u32 header = block_size > SlottedPage::NARROW_MAX ? 8 : 4;
+    return block_size - header - 2 * sizeof(u32);
+}
 
-u16 SlottedPage::get_n(u16 offset) {
-    return *reinterpret_cast<u16*>(this->address(offset));
+void OverflowPage::set_piece(BlockID next, const char *piece, u32 size) {
+    if (size > capacity(this->block_size))
+        throw DbBlockNoRoomError("overflow piece too big for block");
+    char *bytes = static_cast<char*>(this->address(piece_offset()));
+    std::memcpy(bytes, &next, sizeof(u32));
+    std::memcpy(bytes + sizeof(u32), &size, sizeof(u32));
+    if (size > 0)
+        std::memcpy(bytes + 2 * sizeof(u32), piece, size);
 }
 
-void SlottedPage::put_n(u16 offset, u16 n) {
-    *reinterpret_cast<u16*>(this->address(offset)) = n;
+BlockID OverflowPage::get_piece(std::string &value) {
+    char *bytes = static_cast<char*>(this->address(piece_offset()));
+    BlockID next;
+    u32 size;
+    std::memcpy(&next, bytes, sizeof(u32));
+    std::memcpy(&size, bytes + sizeof(u32), sizeof(u32));
+    value.append(bytes + 2 * sizeof(u32), size);
+    return next;
 }
 
-void* SlottedPage::address(u16 offset) {
-    return static_cast<void*>(static_cast<char*>(this->block.get_data()) + offset);
+BlockID OverflowPage::get_next() {
+    BlockID next;
+    std::memcpy(&next, this->address(piece_offset()), sizeof(u32));
+    return next;
 }
 
 /**
  * HeapFile implementation
  */
+const uint HeapFile::WRITE_BATCH;
+const char *const HeapFile::ASIDE_SUFFIX = ".aside.db";
+thread_local bool HeapFile::uncommitted_reads = false;
+thread_local uint HeapFile::write_intents = 0;
+
+HeapFile::~HeapFile() {
+    try {
+        this->flush();
+    } catch (...) {
+        // nobody left to tell
+    }
+    delete this->db; // closes it if still open
+}
+
 void HeapFile::create() {
     if (!closed) {
         throw std::runtime_error("File is already open");
     }
+    if (this->block_size < MIN_BLOCK_SZ || this->block_size > MAX_BLOCK_SZ) {
+        throw std::runtime_error("Block size must be between 512 bytes and 16MB");
+    }
     this->db_open(DB_CREATE | DB_EXCL);
     this->closed = false;
     // Create an empty block to act as the first block
@@ -136,9 +302,12 @@ void HeapFile::create() {
 
 void HeapFile::drop() {
     this->close();
-    if (std::remove(this->dbfilename.c_str()) != 0) {
-        throw std::runtime_error("Error deleting database file");
-    }
+    this->state->last_known = false;
+    // remove through the environment so the file is found in the env home (and logged, if transactional)
+    if (RedoLog::enabled() && this->logged)
+        RedoLog::log_drop(this->name);
+    _DB_ENV->dbremove(TransactionManager::current(), this->dbfilename.c_str(), nullptr,
+                      TransactionManager::auto_commit());
 }
 
 void HeapFile::open() {
@@ -153,41 +322,371 @@ void HeapFile::close() {
     if (closed) {
         return; // File is already closed
     }
-    db.close(0);
+    std::exception_ptr error;
+    try {
+        this->flush();
+    } catch (...) {
+        error = std::current_exception(); // still close it
+    }
+    this->db->close(0);
+    delete this->db; // a closed Db handle cannot be opened again
+    this->db = nullptr;
     closed = true;
+    if (error)
+        std::rethrow_exception(error);
 }
 
+// caller holds the latch of the current last block and of the next one (or latch() exclusively)
 SlottedPage* HeapFile::get_new() {
-    char block[DbBlock::BLOCK_SZ];
-    std::memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
+    char *block = static_cast<char*>(StatementArena::allocate(this->block_size));
+    std::memset(block, 0, this->block_size);
+    Dbt data(block, this->block_size);
 
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
+    BlockID block_id = this->state->last.load() + 1;
 
-    // Write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage* page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // Write it out with initialization applied
-    this->db.get(nullptr, &key, &data, 0); // Berkeley DB now manages the memory
+    // Write out an empty block; the page keeps our copy (no need to read it back)
+    SlottedPage* page = new SlottedPage(data, block_id, true, true);
+    u32 written;
+    try {
+        RedoWrite redo(this->logged, this->name, page, this->block_size);
+        written = this->db_put(block_id, &data); // Write it out with initialization applied
+    } catch (...) {
+        delete page;
+        throw;
+    }
+    this->state->last.store(block_id); // now scans may see it
+    if (TransactionManager::in_transaction()) {
+        std::string dbfilename = this->dbfilename;
+        HeapFileState *state = this->state;
+        TransactionManager::on_rollback(state, [dbfilename, state]() { recount(dbfilename, state); });
+    }
+    StorageStats::add(BLOCK_NEWS);
+    StorageStats::add(BYTES_WRITTEN, written);
     return page;
 }
 
 SlottedPage* HeapFile::get(BlockID block_id) {
-    Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0); // Get the block from Berkeley DB
-    return new SlottedPage(data, block_id);
+    StatTimer timer(BLOCK_GET_NS);
+    // read into memory the page owns, so it stays valid across later calls on this handle
+    char *block = static_cast<char*>(StatementArena::allocate(this->block_size));
+    u32 read;
+    try {
+        read = this->db_get(block_id, block); // Get the block from Berkeley DB
+    } catch (...) {
+        StatementArena::free(block);
+        throw;
+    }
+    StorageStats::add(BLOCK_GETS);
+    StorageStats::add(BYTES_READ, read);
+    Dbt data(block, this->block_size);
+    return new SlottedPage(data, block_id, false, true);
+}
+
+bool HeapFile::latch_block(BlockID block_id) {
+    if (TransactionManager::in_transaction()) {
+        write_intents++;
+        return false;
+    }
+    this->state->block_latch(block_id).lock();
+    return true;
+}
+
+void HeapFile::unlatch_block(BlockID block_id, bool latched) {
+    if (latched)
+        this->state->block_latch(block_id).unlock();
+    else
+        write_intents--;
 }
 
 void HeapFile::put(DbBlock* block) {
     BlockID block_id = block->get_block_id(); // Store the block ID in a local variable
-    Dbt key(&block_id, sizeof(block_id)); // Now you can take the address of block_id
-    this->db.put(nullptr, &key, block->get_block(), 0); // Write the block back to the file
+    StatTimer timer(BLOCK_PUT_NS);
+    u32 written;
+    {
+        RedoWrite redo(this->logged, this->name, dynamic_cast<SlottedPage*>(block), this->block_size);
+        written = this->db_put(block_id, block->get_block()); // Write the block back to the file
+    }
+    if (this->state->tracking.load()) {
+        std::lock_guard<std::mutex> lock(this->state->changes_mutex);
+        this->state->changes.insert(block_id);
+    }
+    StorageStats::add(BLOCK_PUTS);
+    StorageStats::add(BYTES_WRITTEN, written);
+}
+
+std::future<DbBlock*> HeapFile::get_async(BlockID block_id) {
+    if (!BlockIO::available())
+        return DbFile::get_async(block_id);
+    StorageStats::add(ASYNC_GETS);
+    bool uncommitted = uncommitted_reads;
+    return BlockIO::submit<DbBlock*>([this, block_id, uncommitted]() -> DbBlock* {
+        UncommittedReads reads(uncommitted);
+        return this->get(block_id);
+    });
+}
+
+std::future<SlottedPage*> HeapFile::get_page_async(BlockID block_id) {
+    if (!BlockIO::available()) {
+        std::promise<SlottedPage*> page;
+        try {
+            page.set_value(this->get(block_id));
+        } catch (...) {
+            page.set_exception(std::current_exception());
+        }
+        return page.get_future();
+    }
+    StorageStats::add(ASYNC_GETS);
+    bool uncommitted = uncommitted_reads;
+    return BlockIO::submit<SlottedPage*>([this, block_id, uncommitted]() {
+        UncommittedReads reads(uncommitted);
+        return this->get(block_id);
+    });
+}
+
+std::future<void> HeapFile::put_async(DbBlock* block) {
+    if (!BlockIO::available())
+        return DbFile::put_async(block);
+    StorageStats::add(ASYNC_PUTS);
+    std::lock_guard<std::mutex> lock(this->write_mutex);
+    this->queued->push_back(QueuedWrite(block));
+    std::future<void> written = this->queued->back().written.get_future();
+    if (this->queued->size() >= WRITE_BATCH)
+        this->submit_writes();
+    return written;
+}
+
+// caller holds write_mutex. Each batch waits for the one before it, which was queued
+// first and so is already running (or done) by the time this one is.
+void HeapFile::submit_writes() {
+    if (this->queued->empty())
+        return;
+    std::shared_ptr<QueuedWrites> batch = this->queued;
+    std::shared_future<void> previous = this->last_batch;
+    this->queued = std::make_shared<QueuedWrites>();
+    this->last_batch = BlockIO::submit<void>([this, batch, previous]() {
+        if (previous.valid())
+            previous.wait();
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(this->write_mutex);
+            error = this->write_error;
+        }
+        for (auto &write : *batch) {
+            // after a failed write the rest are not attempted, so no block lands after a missing one
+            if (!error) {
+                try {
+                    this->put(write.block);
+                } catch (...) {
+                    error = std::current_exception();
+                    std::lock_guard<std::mutex> lock(this->write_mutex);
+                    this->write_error = error;
+                }
+            }
+            if (error)
+                write.written.set_exception(error);
+            else
+                write.written.set_value();
+            delete write.block;
+            write.block = nullptr;
+        }
+    }).share();
+}
+
+void HeapFile::flush() {
+    std::shared_future<void> last;
+    {
+        std::lock_guard<std::mutex> lock(this->write_mutex);
+        this->submit_writes();
+        last = this->last_batch;
+    }
+    if (last.valid())
+        last.wait();
+    std::lock_guard<std::mutex> lock(this->write_mutex);
+    std::exception_ptr error = this->write_error;
+    this->write_error = nullptr;
+    this->last_batch = std::shared_future<void>();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+u32 HeapFile::db_get(BlockID block_id, char *buffer) {
+    Dbt key(&block_id, sizeof(block_id));
+    DbTxn *txn = TransactionManager::current();
+    u32 flags = 0;
+    if (uncommitted_reads && TransactionManager::enabled()) {
+        txn = nullptr; // not even this thread's transaction's read locks
+        flags = DB_READ_UNCOMMITTED;
+    } else if (txn != nullptr && write_intents > 0) {
+        flags = DB_RMW; // about to change it: lock it for writing now, not read then upgrade
+    }
+    if (!this->compressed) {
+        Dbt data(buffer, this->block_size);
+        data.set_ulen(this->block_size);
+        data.set_flags(DB_DBT_USERMEM);
+        if (this->db->get(txn, &key, &data, flags) != 0)
+            throw std::runtime_error("no block " + std::to_string(block_id) + " in " + this->dbfilename);
+        return data.get_size();
+    }
+
+    // the largest record is a block stored raw, plus its header
+    static thread_local std::vector<char> record;
+    record.resize(COMPRESSED_HEADER_SZ + this->block_size);
+    Dbt data(record.data(), (u32) record.size());
+    data.set_ulen((u32) record.size());
+    data.set_flags(DB_DBT_USERMEM);
+    if (this->db->get(txn, &key, &data, flags) != 0)
+        throw std::runtime_error("no block " + std::to_string(block_id) + " in " + this->dbfilename);
+    u32 size = data.get_size();
+    bool ok = false;
+    if (size >= COMPRESSED_HEADER_SZ) {
+        const char *body = record.data() + COMPRESSED_HEADER_SZ;
+        u32 n = size - COMPRESSED_HEADER_SZ;
+        if (record[0] == FORMAT_RAW && n == this->block_size) {
+            std::memcpy(buffer, body, n);
+            ok = true;
+        } else if (record[0] == FORMAT_LZ) {
+            ok = BlockCodec::decompress(body, n, buffer, this->block_size);
+        }
+    }
+    if (!ok)
+        throw std::runtime_error("corrupt compressed block " + std::to_string(block_id) + " in " + this->dbfilename);
+    return size;
+}
+
+u32 HeapFile::db_put(BlockID block_id, Dbt *block) {
+    Dbt key(&block_id, sizeof(block_id));
+    if (!this->compressed) {
+        this->db->put(TransactionManager::current(), &key, block, 0);
+        return block->get_size();
+    }
+
+    static thread_local std::vector<char> record;
+    record.resize(COMPRESSED_HEADER_SZ + this->block_size);
+    const char *bytes = static_cast<const char*>(block->get_data());
+    // only worth it if it saves something; otherwise store the block as is
+    u32 n = BlockCodec::compress(bytes, this->block_size, record.data() + COMPRESSED_HEADER_SZ, this->block_size - 1);
+    record[0] = n ? FORMAT_LZ : FORMAT_RAW;
+    if (n == 0) {
+        std::memcpy(record.data() + COMPRESSED_HEADER_SZ, bytes, this->block_size);
+        n = this->block_size;
+    }
+    std::memcpy(record.data() + 1, &this->block_size, sizeof(u32));
+    Dbt data(record.data(), COMPRESSED_HEADER_SZ + n);
+    this->db->put(TransactionManager::current(), &key, &data, 0);
+    return COMPRESSED_HEADER_SZ + n;
+}
+
+u32 HeapFile::read_compressed_block_size() {
+    BlockID block_id = 1;
+    Dbt key(&block_id, sizeof(block_id));
+    char header[COMPRESSED_HEADER_SZ];
+    Dbt data(header, COMPRESSED_HEADER_SZ);
+    data.set_ulen(COMPRESSED_HEADER_SZ);
+    data.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL); // just the header
+    data.set_doff(0);
+    data.set_dlen(COMPRESSED_HEADER_SZ);
+    if (this->db->get(TransactionManager::current(), &key, &data, 0) != 0 || data.get_size() < COMPRESSED_HEADER_SZ)
+        throw std::runtime_error("corrupt compressed block 1 in " + this->dbfilename);
+    u32 size;
+    std::memcpy(&size, header + 1, sizeof(u32));
+    return size;
+}
+
+void HeapFile::compact() {
+    this->open();
+    if (this->compressed)
+        return; // nothing to do
+    HeapFile target(this->name + ".compact", this->block_size, true);
+    target.set_logged(false); // written out in full by close(), before it replaces this file
+    target.create();
+    {
+        ReadAhead blocks(*this, this->block_ids());
+        SlottedPage *page;
+        while ((page = blocks.next()) != nullptr)
+            target.put_async(page); // same block id: RecNo appends each one in turn
+    }
+    this->replace_with(target); // closing target waits for the writes
+}
+
+// a put that finds tracking off had already written its block, so whatever reads the file
+// after tracking starts sees that change
+void HeapFile::track_changes(bool on) {
+    std::lock_guard<std::mutex> lock(this->state->changes_mutex);
+    this->state->tracking.store(on);
+    this->state->changes.clear();
+}
+
+std::set<BlockID> HeapFile::get_changes() {
+    std::lock_guard<std::mutex> lock(this->state->changes_mutex);
+    return this->state->changes;
+}
+
+// Outside a transaction each step is on its own, so the name always has the old file or the
+// new one, with the old one aside in between.
+void HeapFile::replace_with(HeapFile &other) {
+    other.close();
+    this->close();
+    // the log's images of the old file's blocks are not to be redone onto the new one
+    if (RedoLog::enabled() && this->logged)
+        RedoLog::log_drop(this->name);
+    std::string aside = this->name + ASIDE_SUFFIX;
+    _DB_ENV->dbrename(TransactionManager::current(), this->dbfilename.c_str(), nullptr, aside.c_str(),
+                      TransactionManager::auto_commit());
+    _DB_ENV->dbrename(TransactionManager::current(), other.dbfilename.c_str(), nullptr, this->dbfilename.c_str(),
+                      TransactionManager::auto_commit());
+    _DB_ENV->dbremove(TransactionManager::current(), aside.c_str(), nullptr, TransactionManager::auto_commit());
+    this->state->last_known = false; // it may have fewer blocks
+    this->open();
+}
+
+void HeapFile::recover_swaps(const std::string &home) {
+    DIR *dir = opendir(home.c_str());
+    if (dir == nullptr)
+        throw std::runtime_error("cannot read " + home);
+    std::set<std::string> names;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+        names.insert(entry->d_name);
+    closedir(dir);
+    std::string suffix = ASIDE_SUFFIX;
+    for (auto const &aside : names) {
+        if (aside.size() <= suffix.size() || aside.compare(aside.size() - suffix.size(), suffix.size(), suffix) != 0)
+            continue;
+        std::string dbfilename = aside.substr(0, aside.size() - suffix.size()) + ".db";
+        if (names.count(dbfilename))
+            _DB_ENV->dbremove(nullptr, aside.c_str(), nullptr, TransactionManager::auto_commit());
+        else
+            _DB_ENV->dbrename(nullptr, aside.c_str(), nullptr, dbfilename.c_str(), TransactionManager::auto_commit());
+    }
+}
+
+// only run by recovery, before anyone else has the file open
+bool HeapFile::redo(BlockID block_id, const char *image, u_int64_t lsn) {
+    while (this->state->last.load() + 1 < block_id)
+        delete this->get_new();
+    if (block_id <= this->state->last.load()) {
+        SlottedPage *page = nullptr;
+        try {
+            page = this->get(block_id);
+        } catch (std::exception &e) {
+            // unreadable, so older than the log
+        }
+        bool newer = page != nullptr && page->get_lsn() >= lsn;
+        delete page;
+        if (newer)
+            return false;
+    }
+    Dbt data(const_cast<char*>(image), this->block_size);
+    this->db_put(block_id, &data);
+    if (block_id > this->state->last.load())
+        this->state->last.store(block_id);
+    return true;
 }
 
 BlockIDs* HeapFile::block_ids() {
     BlockIDs* ids = new BlockIDs();
-    for (u_int32_t i = 1; i <= this->last; i++) {
+    u_int32_t last = this->state->last.load();
+    for (u_int32_t i = 1; i <= last; i++) {
         ids->push_back(i);
     }
     return ids;
@@ -197,32 +696,599 @@ void HeapFile::db_open(uint flags) {
     if (!this->closed) {
         return; // Database is already open
     }
-    this->db.set_flags(DB_RECNUM); // Use record numbers
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0);
-    this->closed = false;
+    this->db = new Db(_DB_ENV, 0);
+    this->db->set_flags(DB_RECNUM); // Use record numbers
+    if ((flags & DB_CREATE) && !this->compressed)
+        this->db->set_re_len(this->block_size); // Fixed-length records (compressed ones vary in length)
+    if ((flags & DB_CREATE) && this->block_size > DbBlock::BLOCK_SZ)
+        this->db->set_pagesize(BDB_MAX_PAGESIZE); // so big blocks span as few Berkeley DB pages as possible
+    else if ((flags & DB_CREATE) && BufferPool::page_size != 0)
+        this->db->set_pagesize(BufferPool::page_size);
+    // the handle outlives any one transaction, so it is always opened in its own
+    // (and may be read without locks, see UncommittedReads)
+    u_int32_t txn_flags = TransactionManager::enabled() ? DB_AUTO_COMMIT | DB_READ_UNCOMMITTED : 0;
+    // in a free-threaded environment other threads may use the handle too
+    u_int32_t env_flags = 0;
+    _DB_ENV->get_open_flags(&env_flags);
+    try {
+        this->db->open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags | txn_flags | (env_flags & DB_THREAD), 0);
+    } catch (...) {
+        delete this->db;
+        this->db = nullptr;
+        throw;
+    }
 
-    if (flags == DB_CREATE) {
-        this->last = 0;
+    if (flags & DB_CREATE) {
+        this->state->last = 0;
+        this->state->last_known = true;
     } else {
-        // Retrieve the last block id from the database's metadata
-        // This part may require custom logic to track the last block id effectively
+        // Retrieve the block size and last block id from the database's metadata: one RecNo record per block
+        DB_BTREE_STAT *stat;
+        this->db->stat(TransactionManager::current(), &stat, DB_FAST_STAT);
+        this->compressed = stat->bt_re_len == 0;
+        this->block_size = this->compressed ? this->read_compressed_block_size() : stat->bt_re_len;
+        if (!this->state->last_known) {
+            this->state->last = stat->bt_ndata;
+            this->state->last_known = true;
+        }
+        free(stat);
+    }
+    this->closed = false; // only now, as other threads sharing the handle may check is_open() unlatched
+}
+
+// With a handle of its own, as the ones open on the file may be closed by now. If even
+// that fails, the next handle to open the file reads last from it.
+void HeapFile::recount(const std::string &dbfilename, HeapFileState *state) {
+    ExclusiveLatch latch(state->latch);
+    u_int32_t env_flags = 0;
+    _DB_ENV->get_open_flags(&env_flags);
+    Db db(_DB_ENV, 0);
+    try {
+        db.open(nullptr, dbfilename.c_str(), nullptr, DB_RECNO,
+                DB_AUTO_COMMIT | DB_READ_UNCOMMITTED | (env_flags & DB_THREAD), 0);
+        DB_BTREE_STAT *stat;
+        db.stat(nullptr, &stat, DB_FAST_STAT);
+        state->last = stat->bt_ndata;
+        free(stat);
+    } catch (std::exception &e) {
+        state->last_known = false;
+    }
+    db.close(0);
+}
+
+// One HeapFileState per file name, never freed (there is one per table ever opened).
+HeapFileState *HeapFile::shared_state(const std::string &dbfilename) {
+    static std::mutex states_mutex;
+    static std::map<std::string, HeapFileState*> states;
+    std::lock_guard<std::mutex> lock(states_mutex);
+    HeapFileState *&state = states[dbfilename];
+    if (state == nullptr)
+        state = new HeapFileState();
+    return state;
+}
+
+/**
+ * ReadAhead implementation
+ */
+const uint ReadAhead::DEPTH;
+
+ReadAhead::ReadAhead(HeapFile &file, BlockIDs *block_ids, uint depth) : file(file), block_ids(block_ids),
+        depth(BlockIO::available() ? depth : 0), started(0), in_flight() {}
+
+ReadAhead::~ReadAhead() {
+    for (auto &block : this->in_flight) {
+        try {
+            delete block.get();
+        } catch (...) {
+            // the reader has stopped caring
+        }
+    }
+    delete this->block_ids;
+}
+
+SlottedPage *ReadAhead::next() {
+    if (this->depth == 0) {
+        if (this->started == this->block_ids->size())
+            return nullptr;
+        return this->file.get((*this->block_ids)[this->started++]);
+    }
+    while (this->in_flight.size() < this->depth && this->started < this->block_ids->size())
+        this->in_flight.push_back(this->file.get_page_async((*this->block_ids)[this->started++]));
+    if (this->in_flight.empty())
+        return nullptr;
+    std::future<SlottedPage*> block = std::move(this->in_flight.front());
+    this->in_flight.pop_front();
+    return block.get();
+}
+
+/**
+ * TextDictionary implementation
+ */
+TextDictionary *TextDictionary::for_table(const Identifier &table_name) {
+    static std::mutex dictionaries_mutex;
+    static std::map<Identifier, TextDictionary*> dictionaries;
+    std::lock_guard<std::mutex> lock(dictionaries_mutex);
+    TextDictionary *&dictionary = dictionaries[table_name];
+    if (dictionary == nullptr)
+        dictionary = new TextDictionary(table_name);
+    return dictionary;
+}
+
+u16 TextDictionary::encode(const std::string &value, bool add) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->load();
+    auto found = this->codes.find(value);
+    if (found != this->codes.end())
+        return found->second;
+    if (!add || value.size() > MAX_VALUE_SZ || this->values.size() >= NO_CODE)
+        return NO_CODE;
+    this->append(value);
+    u16 code = (u16) this->values.size();
+    this->values.push_back(value);
+    this->codes[value] = code;
+    return code;
+}
+
+std::string TextDictionary::decode(u16 code) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->load();
+    if (code >= this->values.size())
+        throw DbRelationError("unknown dictionary code " + std::to_string(code));
+    return this->values[code];
+}
+
+void TextDictionary::drop() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->load();
+    if (this->has_file) {
+        OutsideTransaction outside;
+        this->file.drop();
+    }
+    this->values.clear();
+    this->codes.clear();
+    this->loaded = this->has_file = false;
+}
+
+// caller holds mutex
+void TextDictionary::load() {
+    if (this->loaded)
+        return;
+    OutsideTransaction outside;
+    try {
+        this->file.open();
+    } catch (DbException &e) {
+        this->loaded = true; // no values yet; append() creates the file
+        return;
+    }
+    this->has_file = true;
+    BlockIDs *block_ids = this->file.block_ids();
+    for (auto const& block_id : *block_ids) {
+        SlottedPage *block = this->file.get(block_id);
+        RecordIDs *record_ids = block->ids();
+        for (auto const& record_id : *record_ids) {
+            Dbt *data = block->get(record_id);
+            std::string value(static_cast<char*>(data->get_data()), data->get_size());
+            delete data;
+            this->codes[value] = (u16) this->values.size();
+            this->values.push_back(value);
+        }
+        delete record_ids;
+        delete block;
+    }
+    delete block_ids;
+    this->loaded = true;
+}
+
+// caller holds mutex, so no other thread is in the file
+void TextDictionary::append(const std::string &value) {
+    OutsideTransaction outside;
+    if (!this->has_file) {
+        this->file.create();
+        this->has_file = true;
+    }
+    Dbt data(const_cast<char*>(value.data()), (u32) value.size());
+    SlottedPage *block = this->file.get(this->file.get_last_block_id());
+    try {
+        block->add(&data);
+    } catch (DbBlockNoRoomError &e) {
+        delete block;
+        block = this->file.get_new();
+        block->add(&data);
+    }
+    this->file.put(block);
+    delete block;
+}
+
+/**
+ * BlockSummaries implementation
+ */
+void BlockSummaries::create() {
+    OutsideTransaction outside;
+    try {
+        this->file.drop();
+    } catch (DbException &e) {
+        // nothing left over
+    }
+    this->file.create();
+}
+
+void BlockSummaries::drop() {
+    if (this->open())
+        this->file.drop();
+}
+
+bool BlockSummaries::open() {
+    if (this->file.is_open())
+        return true;
+    OutsideTransaction outside;
+    try {
+        this->file.open();
+    } catch (DbException &e) {
+        return false;
+    }
+    return true;
+}
+
+void BlockSummaries::append(const char *bytes, u32 size) {
+    if (!this->open()) {
+        OutsideTransaction outside;
+        this->file.create();
+    }
+    Dbt data(const_cast<char *>(bytes), size);
+    while (true) {
+        BlockID last = this->file.get_last_block_id();
+        BlockWriteLatch last_latch(this->file, last);
+        if (this->file.get_last_block_id() != last)
+            continue; // someone else added a block while we waited
+        SlottedPage *block = this->file.get(last);
+        try {
+            block->add(&data);
+        } catch (DbBlockNoRoomError &e) {
+            delete block;
+            BlockWriteLatch new_latch(this->file, last + 1);
+            block = this->file.get_new();
+            block->add(&data);
+        }
+        this->file.put(block);
+        delete block;
+        break;
+    }
+}
+
+void BlockSummaries::skip(BlockIDs &block_ids, const std::function<bool(const char *, u32)> &ruled_out) {
+    if (!this->open())
+        return;
+    std::unordered_set<BlockID> skip;
+    BlockIDs *summary_blocks = this->file.block_ids();
+    for (auto const &summary_block_id : *summary_blocks) {
+        SlottedPage *block = this->file.get(summary_block_id);
+        for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+            Dbt *data = block->get(record_id);
+            const char *bytes = static_cast<const char*>(data->get_data());
+            if (data->get_size() >= sizeof(u32) && ruled_out(bytes, data->get_size())) {
+                BlockID block_id;
+                std::memcpy(&block_id, bytes, sizeof(u32));
+                skip.insert(block_id);
+            }
+            delete data;
+        }
+        delete block;
+    }
+    delete summary_blocks;
+    if (skip.empty())
+        return;
+    size_t before = block_ids.size();
+    block_ids.erase(std::remove_if(block_ids.begin(), block_ids.end(),
+                                   [&skip](BlockID block_id) { return skip.count(block_id) > 0; }),
+                    block_ids.end());
+    StorageStats::add(BLOCKS_SKIPPED, before - block_ids.size());
+}
+
+/**
+ * ZoneMap implementation
+ */
+ZoneMap::ZoneMap(const Identifier &table_name, const ColumnAttributes &column_attributes)
+        : BlockSummaries(table_name + "_zones"), columns() {
+    u32 i = 0;
+    for (auto attribute : column_attributes) {
+        if (attribute.get_data_type() == ColumnAttribute::INT)
+            this->columns.push_back(i);
+        i++;
+    }
+}
+
+void ZoneMap::put(BlockID block_id, const std::vector<int32_t> &bounds) {
+    std::vector<char> bytes(sizeof(u32) + bounds.size() * sizeof(int32_t));
+    std::memcpy(bytes.data(), &block_id, sizeof(u32));
+    if (!bounds.empty())
+        std::memcpy(bytes.data() + sizeof(u32), bounds.data(), bounds.size() * sizeof(int32_t));
+    this->append(bytes.data(), (u32) bytes.size());
+}
+
+void ZoneMap::prune(BlockIDs &block_ids, const std::vector<std::pair<u32, int32_t>> &terms) {
+    std::vector<std::pair<u32, int32_t>> zoned; // (offset of the column's min in a record, value)
+    for (auto const &term : terms) {
+        auto found = std::find(this->columns.begin(), this->columns.end(), term.first);
+        if (found != this->columns.end())
+            zoned.push_back(std::make_pair(sizeof(u32) + (found - this->columns.begin()) * 2 * sizeof(int32_t),
+                                           term.second));
+    }
+    if (zoned.empty())
+        return;
+    u32 record_size = sizeof(u32) + this->columns.size() * 2 * sizeof(int32_t);
+    this->skip(block_ids, [&zoned, record_size](const char *bytes, u32 size) {
+        if (size != record_size)
+            return false;
+        for (auto const &term : zoned) {
+            int32_t min, max;
+            std::memcpy(&min, bytes + term.first, sizeof(int32_t));
+            std::memcpy(&max, bytes + term.first + sizeof(int32_t), sizeof(int32_t));
+            if (term.second < min || term.second > max)
+                return true;
+        }
+        return false;
+    });
+}
+
+/**
+ * BloomFilter implementation
+ */
+const u32 BloomFilter::BITS_PER_ROW;
+const u32 BloomFilter::HASHES;
+const u32 BloomFilter::MAX_BYTES;
+
+// INT values as 'I' and their 4 bytes, TEXT as 'T', a 4-byte length and the bytes, so no two
+// different rows' keys run together the same way
+std::string BloomFilter::key(const ValueDict &row) const {
+    std::string key;
+    for (auto const &column_name : this->columns) {
+        const Value &value = row.at(column_name);
+        if (value.data_type == ColumnAttribute::INT) {
+            key += 'I';
+            key.append(reinterpret_cast<const char *>(&value.n), sizeof(int32_t));
+        } else {
+            u32 size = (u32) value.s.size();
+            key += 'T';
+            key.append(reinterpret_cast<const char *>(&size), sizeof(u32));
+            key += value.s;
+        }
+    }
+    return key;
+}
+
+// FNV-1a over the key, then a second round over its result for the step
+void BloomFilter::hash(const std::string &key, u_int64_t &h1, u_int64_t &h2) {
+    const u_int64_t FNV_OFFSET = 14695981039346656037ULL;
+    const u_int64_t FNV_PRIME = 1099511628211ULL;
+    h1 = FNV_OFFSET;
+    for (unsigned char c : key)
+        h1 = (h1 ^ c) * FNV_PRIME;
+    h2 = FNV_OFFSET;
+    for (u32 i = 0; i < sizeof(h1); i++)
+        h2 = (h2 ^ ((h1 >> (8 * i)) & 0xff)) * FNV_PRIME;
+    h2 |= 1; // an odd step visits different bits
+}
+
+void BloomFilter::put(BlockID block_id, const std::vector<std::string> &keys) {
+    u32 n_bytes = std::min<u32>(MAX_BYTES, std::max<u32>(1, ((u32) keys.size() * BITS_PER_ROW + 7) / 8));
+    u_int64_t n_bits = n_bytes * 8;
+    std::vector<char> bytes(sizeof(u32) + n_bytes, 0);
+    std::memcpy(bytes.data(), &block_id, sizeof(u32));
+    char *bits = bytes.data() + sizeof(u32);
+    for (auto const &key : keys) {
+        u_int64_t h1, h2;
+        hash(key, h1, h2);
+        for (u32 i = 0; i < HASHES; i++) {
+            u_int64_t bit = (h1 + i * h2) % n_bits;
+            bits[bit / 8] |= (char) (1 << (bit % 8));
+        }
+    }
+    this->append(bytes.data(), (u32) bytes.size());
+}
+
+void BloomFilter::prune(BlockIDs &block_ids, const std::string &key) {
+    u_int64_t h1, h2;
+    hash(key, h1, h2);
+    this->skip(block_ids, [h1, h2](const char *bytes, u32 size) {
+        if (size <= sizeof(u32))
+            return false;
+        const char *bits = bytes + sizeof(u32);
+        u_int64_t n_bits = (u_int64_t) (size - sizeof(u32)) * 8;
+        for (u32 i = 0; i < HASHES; i++) {
+            u_int64_t bit = (h1 + i * h2) % n_bits;
+            if ((bits[bit / 8] & (1 << (bit % 8))) == 0)
+                return true;
+        }
+        return false;
+    });
+}
+
+// this thread's snapshot, or else latest filled in with what has finished by now
+static const Snapshot &reading_snapshot(Snapshot &latest) {
+    if (VersionManager::current() != nullptr)
+        return *VersionManager::current();
+    latest = VersionManager::latest();
+    return latest;
+}
+
+/**
+ * OverflowFile implementation
+ */
+// write the chain last piece first, so each block is written once, already pointing at its successor
+BlockID OverflowFile::put(const std::string &value) {
+    this->open(true);
+    u32 capacity = OverflowPage::capacity(this->file.get_block_size());
+    u32 n_pieces = (value.size() + capacity - 1) / capacity;
+    BlockID next = 0;
+    for (u32 i = n_pieces; i-- > 0;) {
+        u32 start = i * capacity;
+        u32 size = std::min<u32>(capacity, value.size() - start);
+        SlottedPage *block = this->allocate();
+        try {
+            OverflowPage page(*block->get_block(), block->get_block_id(), true);
+            page.set_piece(next, value.data() + start, size);
+            this->file.put(&page);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        next = block->get_block_id();
+        delete block;
+        StorageStats::add(OVERFLOW_WRITES);
+    }
+    return next;
+}
+
+std::string OverflowFile::get(BlockID first, u32 size) {
+    if (!this->open())
+        throw DbRelationError("broken overflow chain");
+    std::string value;
+    value.reserve(size);
+    BlockID next = first;
+    while (next != 0) {
+        SlottedPage *block = this->file.get(next);
+        OverflowPage page(*block->get_block(), next);
+        if (!page.is_overflow()) {
+            delete block;
+            throw DbRelationError("broken overflow chain");
+        }
+        next = page.get_piece(value);
+        delete block;
+        StorageStats::add(OVERFLOW_READS);
+    }
+    if (value.size() != size)
+        throw DbRelationError("broken overflow chain");
+    return value;
+}
+
+// the chain's last block is pointed at the free list, and the free list at its first
+void OverflowFile::free(BlockID first) {
+    if (!this->open())
+        return;
+    BlockWriteLatch latch(this->file, FREE_LIST);
+    BlockID last = first;
+    while (true) {
+        SlottedPage *block = this->file.get(last);
+        BlockID next = OverflowPage(*block->get_block(), last).get_next();
+        delete block;
+        if (next == 0)
+            break;
+        last = next;
+    }
+    SlottedPage *head = this->file.get(FREE_LIST);
+    SlottedPage *tail = nullptr;
+    try {
+        OverflowPage free_list(*head->get_block(), FREE_LIST);
+        tail = this->file.get(last);
+        OverflowPage(*tail->get_block(), last).set_piece(free_list.get_next(), nullptr, 0);
+        this->file.put(tail);
+        free_list.set_piece(first, nullptr, 0);
+        this->file.put(head);
+    } catch (...) {
+        delete tail;
+        delete head;
+        throw;
+    }
+    delete tail;
+    delete head;
+}
+
+void OverflowFile::drop() {
+    if (this->open())
+        this->file.drop();
+}
+
+void OverflowFile::close() {
+    std::lock_guard<std::mutex> lock(this->open_mutex);
+    this->file.close();
+}
+
+bool OverflowFile::open(bool create) {
+    if (this->file.is_open())
+        return true;
+    std::lock_guard<std::mutex> lock(this->open_mutex);
+    if (this->file.is_open())
+        return true;
+    OutsideTransaction outside;
+    try {
+        this->file.open();
+        return true;
+    } catch (DbException &e) {
+        if (!create)
+            return false;
+    }
+    this->file.create();
+    SlottedPage *block = this->file.get(FREE_LIST);
+    try {
+        OverflowPage free_list(*block->get_block(), FREE_LIST, true); // with no free blocks yet
+        this->file.put(&free_list);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+    return true;
+}
+
+SlottedPage *OverflowFile::allocate() {
+    {
+        BlockWriteLatch latch(this->file, FREE_LIST);
+        SlottedPage *head = this->file.get(FREE_LIST);
+        SlottedPage *block = nullptr;
+        try {
+            OverflowPage free_list(*head->get_block(), FREE_LIST);
+            BlockID block_id = free_list.get_next();
+            if (block_id != 0) {
+                block = this->file.get(block_id);
+                free_list.set_piece(OverflowPage(*block->get_block(), block_id).get_next(), nullptr, 0);
+                this->file.put(head);
+            }
+        } catch (...) {
+            delete block;
+            delete head;
+            throw;
+        }
+        delete head;
+        if (block != nullptr)
+            return block;
+    }
+    while (true) {
+        BlockID last = this->file.get_last_block_id();
+        BlockWriteLatch last_latch(this->file, last);
+        if (this->file.get_last_block_id() != last)
+            continue; // someone else added a block while we waited
+        BlockWriteLatch new_latch(this->file, last + 1);
+        return this->file.get_new();
     }
 }
 
 /**
  * HeapTable implementation
  */
-HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes)
-    : DbRelation(table_name, column_names, column_attributes), file(table_name) {}
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     u_int32_t block_size, bool compressed)
+    : DbRelation(table_name, column_names, column_attributes), file(table_name, block_size, compressed),
+      overflow(table_name, block_size), dictionary(nullptr), zones(table_name, column_attributes) {
+    for (auto &attribute : this->column_attributes)
+        if (attribute.get_data_type() == ColumnAttribute::TEXT && attribute.get_encoding() == ColumnAttribute::DICTIONARY)
+            this->dictionary = TextDictionary::for_table(table_name);
+}
 
+HeapTable::~HeapTable() {
+    for (auto const &bloom_filter : this->bloom_filters)
+        delete bloom_filter;
+}
 
 void HeapTable::create() {
+    ExclusiveLatch latch(this->file.latch());
     this->file.create();
+    if (this->zone_mapped())
+        this->zones.create();
 }
 
 void HeapTable::create_if_not_exists() {
     try {
-        this->file.open(); // Attempt to open, which succeeds if the file exists
+        this->open(); // Attempt to open, which succeeds if the file exists
     } catch (const std::exception& e) {
         // If opening fails, assume the file does not exist and create it
         this->create();
@@ -230,121 +1296,703 @@ void HeapTable::create_if_not_exists() {
 }
 
 void HeapTable::drop() {
+    ExclusiveLatch latch(this->file.latch());
     this->file.drop();
+    this->overflow.drop();
+    if (this->dictionary != nullptr)
+        this->dictionary->drop();
+    if (this->zone_mapped())
+        this->zones.drop();
+    for (auto const &bloom_filter : this->bloom_filters)
+        bloom_filter->drop();
 }
 
 void HeapTable::open() {
+    if (this->file.is_open())
+        return;
+    ExclusiveLatch latch(this->file.latch());
     this->file.open();
 }
 
 void HeapTable::close() {
     this->file.close();
+    this->overflow.close();
+    this->zones.close();
+    for (auto const &bloom_filter : this->bloom_filters)
+        bloom_filter->close();
+}
+
+void HeapTable::compact() {
+    ExclusiveLatch latch(this->file.latch());
+    this->file.compact();
 }
 
 Handle HeapTable::insert(const ValueDict *row) {
     this->open();
-    Dbt *data = this->marshal(row);
-    SlottedPage *page = this->file.get_new();
-    RecordID record_id = page->add(data);
-    BlockID block_id = page->get_block_id();
-    delete data;
-    delete page;
-    return std::make_pair(block_id, record_id);
+    ValueDict *full_row = this->validate(row);
+    Handle handle;
+    {
+        SharedLatch latch(this->file.latch()); // keeps the file from being dropped or reopened under us
+        handle = this->append(full_row);
+    }
+    delete full_row;
+    return handle;
 }
 
 Handles* HeapTable::select(const ValueDict *where) {
+    this->open();
     Handles* handles = new Handles();
-    BlockIDs* block_ids = this->file.block_ids();
-    for (auto const& block_id : *block_ids) {
-        SlottedPage* block = this->file.get(block_id);
-        RecordIDs* record_ids = block->ids();
-        for (auto const& record_id : *record_ids) {
-            handles->push_back(std::make_pair(block_id, record_id));
+    ValueDict *coded_where = where == nullptr ? nullptr : this->encode_where(where);
+    Snapshot latest;
+    const Snapshot &snapshot = reading_snapshot(latest);
+    UncommittedReads reads;
+    BlockIDs *block_ids = this->file.block_ids();
+    if (where != nullptr && this->zone_mapped()) {
+        std::vector<std::pair<u32, int32_t>> terms;
+        for (auto const &column : *where) {
+            u32 i = std::find(this->column_names.begin(), this->column_names.end(), column.first) - this->column_names.begin();
+            if (i < this->column_names.size() && column.second.data_type == ColumnAttribute::INT)
+                terms.push_back(std::make_pair(i, column.second.n));
+        }
+        try {
+            this->zones.prune(*block_ids, terms);
+        } catch (...) {
+            delete block_ids;
+            delete coded_where;
+            delete handles;
+            throw;
+        }
+    }
+    if (where != nullptr) {
+        try {
+            for (auto const &bloom_filter : this->bloom_filters)
+                if (this->keyed(bloom_filter, where))
+                    bloom_filter->prune(*block_ids, bloom_filter->key(*where));
+        } catch (...) {
+            delete block_ids;
+            delete coded_where;
+            delete handles;
+            throw;
+        }
+    }
+    ReadAhead blocks(this->file, block_ids);
+    SlottedPage* block;
+    while ((block = blocks.next()) != nullptr) {
+        for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+            Handle handle(block->get_block_id(), record_id);
+            if (this->visible(block, record_id, snapshot) &&
+                (coded_where == nullptr || this->selected(block, handle, coded_where)))
+                handles->push_back(handle);
         }
-        delete record_ids;
         delete block;
     }
+    delete coded_where;
+    return handles;
+}
+
+// does where ask for a value of the right type in each of the filter's key columns?
+bool HeapTable::keyed(const BloomFilter *bloom_filter, const ValueDict *where) {
+    for (auto const &column_name : bloom_filter->get_columns()) {
+        auto value = where->find(column_name);
+        if (value == where->end())
+            return false;
+        u32 i = std::find(this->column_names.begin(), this->column_names.end(), column_name) - this->column_names.begin();
+        if (i == this->column_names.size() || value->second.data_type != this->column_attributes[i].get_data_type())
+            return false;
+    }
+    return true;
+}
+
+void HeapTable::add_bloom_filter(const Identifier &index_name, const ColumnNames &key_columns, bool fresh) {
+    for (auto const &column_name : key_columns)
+        if (std::find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+    this->forget_bloom_filter(index_name, false);
+    BloomFilter *bloom_filter = new BloomFilter(this->table_name, index_name, key_columns);
+    if (fresh) {
+        try {
+            bloom_filter->create();
+        } catch (...) {
+            delete bloom_filter;
+            throw;
+        }
+    }
+    this->bloom_filters.push_back(bloom_filter);
+}
+
+// a block that fills up meanwhile may get two records, which is harmless: each is true of it
+void HeapTable::build_bloom_filter(const Identifier &index_name) {
+    for (auto const &bloom_filter : this->bloom_filters) {
+        if (bloom_filter->get_index_name() == index_name) {
+            std::vector<BloomFilter *> just_this(1, bloom_filter);
+            this->summarize(&just_this);
+            return;
+        }
+    }
+    throw DbRelationError("unknown bloom filter " + index_name);
+}
+
+// every block but the last is full (no row is added to it again)
+void HeapTable::summarize(const std::vector<BloomFilter *> *filters) {
+    this->open();
+    SharedLatch latch(this->file.latch()); // keeps the file from being dropped or replaced under us
+    BlockIDs *block_ids = this->file.block_ids();
+    if (!block_ids->empty())
+        block_ids->pop_back();
+    try {
+        this->scan_in_parallel(*block_ids, scan_threads(block_ids->size()), [this, filters](size_t, SlottedPage *block) {
+            this->seal(block, filters);
+        });
+    } catch (...) {
+        delete block_ids;
+        throw;
+    }
     delete block_ids;
+}
+
+size_t HeapTable::scan_threads(size_t n_blocks) {
+    u_int32_t env_flags = 0;
+    _DB_ENV->get_open_flags(&env_flags);
+    if (!(env_flags & DB_THREAD) || TransactionManager::in_transaction())
+        return 1;
+    return std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), n_blocks / PARALLEL_MIN_BLOCKS));
+}
+
+void HeapTable::scan_in_parallel(const BlockIDs &block_ids, size_t n_threads,
+                                 const std::function<void(size_t, SlottedPage *)> &work) {
+    std::vector<std::exception_ptr> errors(n_threads);
+    const Snapshot *snapshot = VersionManager::current();
+    auto scan = [&](size_t t) {
+        SharedSnapshot shared(snapshot);
+        try {
+            ReadAhead blocks(this->file, new BlockIDs(block_ids.begin() + block_ids.size() * t / n_threads,
+                                                      block_ids.begin() + block_ids.size() * (t + 1) / n_threads));
+            SlottedPage *block;
+            while ((block = blocks.next()) != nullptr) {
+                try {
+                    work(t, block);
+                } catch (...) {
+                    delete block;
+                    throw;
+                }
+                delete block;
+            }
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    if (n_threads == 1) {
+        scan(0);
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < n_threads; t++)
+            threads.push_back(std::thread(scan, t));
+        for (auto &thread : threads)
+            thread.join();
+    }
+    for (auto const &error : errors)
+        if (error != nullptr)
+            std::rethrow_exception(error);
+}
+
+void HeapTable::drop_bloom_filter(const Identifier &index_name) {
+    this->forget_bloom_filter(index_name, true);
+}
+
+// stop keeping the filter, removing its file too if remove_file
+void HeapTable::forget_bloom_filter(const Identifier &index_name, bool remove_file) {
+    for (auto bloom_filter = this->bloom_filters.begin(); bloom_filter != this->bloom_filters.end(); bloom_filter++) {
+        if ((*bloom_filter)->get_index_name() == index_name) {
+            if (remove_file)
+                (*bloom_filter)->drop();
+            delete *bloom_filter;
+            this->bloom_filters.erase(bloom_filter);
+            return;
+        }
+    }
+    if (remove_file) {
+        BloomFilter unknown(this->table_name, index_name, ColumnNames());
+        unknown.drop(); // one left by a table loaded before its filter was
+    }
+}
+
+// a partial Fisher-Yates shuffle of the block ids; seeded the same way every time so
+// ANALYZE of an unchanged table gives the same statistics
+Handles *HeapTable::sample(u_int32_t max_blocks, u_int32_t &block_count) {
+    this->open();
+    Handles *handles = new Handles();
+    BlockIDs *block_ids = this->file.block_ids();
+    block_count = block_ids->size();
+    u_int32_t n = std::min<u_int32_t>(max_blocks, block_count);
+    std::minstd_rand random(block_count);
+    for (u_int32_t i = 0; i < n; i++)
+        std::swap((*block_ids)[i], (*block_ids)[i + random() % (block_count - i)]);
+    block_ids->resize(n);
+    Snapshot latest;
+    const Snapshot &snapshot = reading_snapshot(latest);
+    UncommittedReads reads;
+    ReadAhead blocks(this->file, block_ids);
+    SlottedPage *block;
+    while ((block = blocks.next()) != nullptr) {
+        for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id))
+            if (this->visible(block, record_id, snapshot))
+                handles->push_back(Handle(block->get_block_id(), record_id));
+        delete block;
+    }
     return handles;
 }
 
-void HeapTable::update(const Handle handle, const ValueDict *new_values) {
-    // Example implementation logic:
-    // 1. Fetch the record using the handle.
-    // 2. Apply the changes from new_values to the record.
-    // 3. Marshal the updated record and write it back to the storage.
+u_int32_t HeapTable::get_block_count() {
+    this->open();
+    return this->file.get_last_block_id();
+}
 
-    // This is a placeholder.
+// The new version is appended first, so no block latch is held while we wait for the
+// last block's; if the old version has meanwhile been changed by someone else, it goes again.
+void HeapTable::update(const Handle handle, const ValueDict *new_values) {
+    this->open();
+    Handle current = handle;
+    ValueDict *row = this->project_visible(current, nullptr);
+    for (auto const& value : *new_values) {
+        if (std::find(this->column_names.begin(), this->column_names.end(), value.first) == this->column_names.end()) {
+            delete row;
+            throw DbRelationError("unknown column " + value.first);
+        }
+        (*row)[value.first] = value.second;
+    }
+    SharedLatch latch(this->file.latch());
+    Handle replacement;
+    try {
+        replacement = this->append(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+    try {
+        this->expire(current, replacement);
+    } catch (...) {
+        this->remove(replacement);
+        throw;
+    }
 }
 
+// the record's space (and its overflow chains) are reclaimed only when it is removed (see vacuum)
 void HeapTable::del(const Handle handle) {
-    // Example implementation logic:
-    // 1. Locate the record using the handle.
-    // 2. Mark the record as deleted in the storage system.
-
-    // This is a placeholder. 
+    this->open();
+    Handle current = handle;
+    if (VersionManager::current() != nullptr) {
+        SlottedPage *block = this->file.get(current.first);
+        try {
+            this->locate(current, *VersionManager::current(), block);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        delete block;
+    }
+    SharedLatch file_latch(this->file.latch());
+    this->expire(current);
 }
 
+// only the named columns are decoded, so overflow blocks of other columns are never read
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
-    ValueDict *projected_values = new ValueDict();
-    // Example implementation logic:
-    // 1. Fetch the record using the handle.
-    // 2. Extract and return the values for the specified columns.
-
-    // This is a placeholder.
-    return projected_values;
+    if (column_names == nullptr || column_names->empty())
+        return this->project(handle);
+    for (auto const& column_name : *column_names)
+        if (std::find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+    this->open();
+    return this->project_visible(handle, column_names);
 }
 
 ValueDict* HeapTable::project(Handle handle) {
+    this->open();
+    return this->project_visible(handle, nullptr);
+}
+
+// handle is moved to the version it found
+ValueDict *HeapTable::project_visible(Handle &handle, const ColumnNames *column_names) {
+    Snapshot latest;
+    const Snapshot &snapshot = reading_snapshot(latest);
+    UncommittedReads reads;
     SlottedPage* block = this->file.get(handle.first);
-    Dbt* data = block->get(handle.second);
-    ValueDict* row = this->unmarshal(data);
+    ValueDict* row;
+    try {
+        this->locate(handle, snapshot, block);
+        row = this->project(block, handle, column_names);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+    return row;
+}
+
+// a replaced version points at its replacement, so an old handle still finds the row
+void HeapTable::locate(Handle &handle, const Snapshot &snapshot, SlottedPage *&block) {
+    while (true) {
+        Dbt *data = block->get(handle.second);
+        if (data == nullptr)
+            throw DbRelationError("record has been deleted");
+        RowVersion version;
+        bool has_version = this->get_version(data, version);
+        delete data;
+        if (!has_version || snapshot.visible(version))
+            return;
+        if (!snapshot.sees(version.xmin))
+            throw DbRelationError("record is not visible to this statement");
+        if (version.next.first == 0)
+            throw DbRelationError("record has been deleted");
+        handle = version.next;
+        if (block->get_block_id() != handle.first) {
+            delete block;
+            block = nullptr;
+            block = this->file.get(handle.first);
+        }
+    }
+}
+
+// First updater wins: a version someone else has already stamped can't be changed, even
+// if they have not finished yet.
+void HeapTable::expire(Handle handle, Handle next) {
+    VersionID xid = VersionManager::current() == nullptr ? 0 : VersionManager::current()->get_xid();
+    BlockWriteLatch latch(this->file, handle.first);
+    SlottedPage *block = this->file.get(handle.first);
+    Dbt *data = block->get(handle.second);
+    RowVersion version;
+    std::vector<BlockID> chains;
+    const char *error = nullptr;
+    if (data == nullptr) {
+        error = "record has been deleted";
+    } else if (xid == 0 || !this->versioned()) {
+        chains = this->overflow_chains(data);
+        block->del(handle.second); // nobody to keep it for
+    } else if (!this->get_version(data, version)) {
+        // a row from before it had stamps gets them now, so until this writer is done (and
+        // vacuum removes it) everyone else, reading uncommitted blocks or not, still has it
+        std::vector<char> stamped(data->get_size() + RowVersion::SIZE);
+        std::memcpy(stamped.data(), data->get_data(), data->get_size());
+        version = RowVersion();
+        version.xmax = xid;
+        version.next = next;
+        version.pack(stamped.data() + data->get_size());
+        Dbt stamped_data(stamped.data(), (u32) stamped.size());
+        try {
+            block->put(handle.second, stamped_data);
+        } catch (DbBlockNoRoomError &e) {
+            if (TransactionManager::in_transaction())
+                error = "no room in its block to keep the row until the transaction ends";
+            else {
+                chains = this->overflow_chains(data);
+                block->del(handle.second); // no room for stamps, and no transaction to roll it back
+            }
+        }
+    } else if (version.xmax != 0) {
+        error = version.xmax == xid ? "record has been deleted" : "record was changed by a concurrent statement";
+    } else {
+        version.xmax = xid;
+        version.next = next;
+        version.pack(static_cast<char*>(data->get_data()) + data->get_size() - RowVersion::SIZE);
+    }
     delete data;
+    try {
+        if (error == nullptr)
+            this->file.put(block);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+    if (error != nullptr)
+        throw DbRelationError(error);
+    this->free_overflow(chains);
+}
+
+void HeapTable::remove(Handle handle) {
+    BlockWriteLatch latch(this->file, handle.first);
+    SlottedPage *block = this->file.get(handle.first);
+    std::vector<BlockID> chains;
+    Dbt *data = block->get(handle.second);
+    if (data != nullptr) {
+        chains = this->overflow_chains(data);
+        delete data;
+    }
+    block->del(handle.second);
+    try {
+        this->file.put(block);
+    } catch (...) {
+        delete block;
+        throw;
+    }
     delete block;
+    this->free_overflow(chains);
+}
+
+// Once every writer that could see a version is gone, so is any use for it. Blocks are
+// latched one at a time, so readers and writers carry on meanwhile.
+u_int32_t HeapTable::vacuum() {
+    this->open();
+    VersionID horizon = VersionManager::horizon();
+    u32 removed = 0;
+    SharedLatch file_latch(this->file.latch());
+    BlockIDs *block_ids = this->file.block_ids();
+    try {
+        for (BlockID block_id : *block_ids) {
+            BlockWriteLatch latch(this->file, block_id);
+            SlottedPage *block = this->file.get(block_id);
+            bool changed = false;
+            std::vector<BlockID> chains;
+            for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+                Dbt *data = block->get(record_id);
+                RowVersion version;
+                if (this->get_version(data, version) && version.xmax != 0 && version.xmax < horizon) {
+                    std::vector<BlockID> record_chains = this->overflow_chains(data);
+                    chains.insert(chains.end(), record_chains.begin(), record_chains.end());
+                    block->del(record_id);
+                    changed = true;
+                    removed++;
+                }
+                delete data;
+            }
+            try {
+                if (changed)
+                    this->file.put(block);
+            } catch (...) {
+                delete block;
+                throw;
+            }
+            delete block;
+            this->free_overflow(chains);
+        }
+    } catch (...) {
+        delete block_ids;
+        throw;
+    }
+    delete block_ids;
+    return removed;
+}
+
+bool HeapTable::visible(SlottedPage *block, RecordID record_id, const Snapshot &snapshot) {
+    Dbt *data = block->get(record_id);
+    if (data == nullptr)
+        return false;
+    RowVersion version;
+    bool seen = !this->get_version(data, version) || snapshot.visible(version);
+    delete data;
+    return seen;
+}
+
+bool HeapTable::get_version(const Dbt *data, RowVersion &version) {
+    const char *bytes = static_cast<const char*>(data->get_data());
+    if (data->get_size() < RowVersion::SIZE || this->values_size(bytes) + RowVersion::SIZE != data->get_size())
+        return false;
+    version.unpack(bytes + data->get_size() - RowVersion::SIZE);
+    return true;
+}
+
+// walks the values just as values_size does
+void HeapTable::overflow_references(const char *bytes, std::vector<u32> &offsets) {
+    u32 offset = 0;
+    for (auto &ca : this->column_attributes) {
+        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+            offset += sizeof(int32_t);
+            continue;
+        }
+        if (ca.get_encoding() == ColumnAttribute::DICTIONARY) {
+            u16 code = *(reinterpret_cast<const u16*>(bytes + offset));
+            offset += sizeof(u16);
+            if (code != TextDictionary::NO_CODE)
+                continue;
+        }
+        u16 size = *(reinterpret_cast<const u16*>(bytes + offset));
+        offset += sizeof(u16);
+        if (size == OVERFLOW_MARK)
+            offsets.push_back(offset);
+        offset += size == OVERFLOW_MARK ? 2 * sizeof(u32) : size;
+    }
+}
+
+std::vector<BlockID> HeapTable::overflow_chains(const Dbt *data) {
+    const char *bytes = static_cast<const char *>(data->get_data());
+    std::vector<u32> offsets;
+    this->overflow_references(bytes, offsets);
+    std::vector<BlockID> chains;
+    for (u32 offset : offsets) {
+        BlockID first;
+        std::memcpy(&first, bytes + offset + sizeof(u32), sizeof(u32));
+        chains.push_back(first);
+    }
+    return chains;
+}
+
+// called once the record is gone from its block, so nobody reads the chains again
+void HeapTable::free_overflow(const std::vector<BlockID> &chains) {
+    for (BlockID first : chains)
+        this->overflow.free(first);
+}
+
+// for chains no row refers to after an error: freeing them can only fail the way the
+// statement already has, so that is not made worse by throwing again
+void HeapTable::drop_overflow(const std::vector<BlockID> &chains) {
+    try {
+        this->free_overflow(chains);
+    } catch (...) {
+        // they stay in the overflow file, unused
+    }
+}
+
+// walks the values just as unmarshal does, without decoding any
+u32 HeapTable::values_size(const char *bytes) {
+    u32 offset = 0;
+    for (auto &ca : this->column_attributes) {
+        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+            offset += sizeof(int32_t);
+            continue;
+        }
+        if (ca.get_encoding() == ColumnAttribute::DICTIONARY) {
+            u16 code = *(reinterpret_cast<const u16*>(bytes + offset));
+            offset += sizeof(u16);
+            if (code != TextDictionary::NO_CODE)
+                continue;
+        }
+        u16 size = *(reinterpret_cast<const u16*>(bytes + offset));
+        offset += sizeof(u16);
+        offset += size == OVERFLOW_MARK ? 2 * sizeof(u32) : size;
+    }
+    return offset;
+}
+
+// unmarshal a record (all columns, or just column_names) from an already fetched block
+ValueDict* HeapTable::project(SlottedPage *block, Handle handle, const ColumnNames *column_names, bool decode) {
+    Dbt* data = block->get(handle.second);
+    if (data == nullptr)
+        throw DbRelationError("record has been deleted");
+    ValueDict* row;
+    try {
+        row = this->unmarshal(data, column_names, decode);
+    } catch (...) {
+        delete data;
+        throw;
+    }
+    delete data;
     return row;
 }
 
-ValueDict *HeapTable::validate(const ValueDict *row) {
-    // Example implementation logic:
-    // 1. Check if the values in 'row' adhere to the schema and constraints of the table.
-    // 2. Return a possibly modified version of 'row' that conforms to the table's requirements, or throw an exception if invalid.
+// does the record at handle (in block) match every column value in where?
+// where is from encode_where(), so DICTIONARY columns are compared code to code
+bool HeapTable::selected(SlottedPage *block, Handle handle, const ValueDict *where) {
+    ColumnNames where_columns;
+    for (auto const& column : *where)
+        where_columns.push_back(column.first);
+    ValueDict *row = this->project(block, handle, &where_columns, false);
+    bool match = true;
+    for (auto const& column : *where) {
+        ValueDict::const_iterator value = row->find(column.first);
+        if (value == row->end() || value->second.data_type != column.second.data_type ||
+            value->second.n != column.second.n || value->second.s != column.second.s) {
+            match = false;
+            break;
+        }
+    }
+    delete row;
+    StorageStats::add(ROWS_EXAMINED);
+    if (!match)
+        StorageStats::add(ROWS_FILTERED);
+    return match;
+}
 
-    // This is a placeholder. 
-    return new ValueDict(*row); // Simply returns a copy for the sake of the example.
+ValueDict *HeapTable::validate(const ValueDict *row) {
+    ValueDict *full_row = new ValueDict();
+    for (auto const& column_name : this->column_names) {
+        ValueDict::const_iterator column = row->find(column_name);
+        if (column == row->end()) {
+            delete full_row;
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+        }
+        (*full_row)[column_name] = column->second;
+    }
+    return full_row;
 }
 
 
 // return the bits to go into the file
-// caller responsible for freeing the returned Dbt and its enclosed ret->get_data().
+// caller responsible for freeing the returned Dbt, and its enclosed ret->get_data() with StatementArena::free.
+// the chains of out-of-line values are written as they come, so if the row turns out not
+// to fit after all, they are freed again with it
 Dbt* HeapTable::marshal(const ValueDict* row) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
+    uint block_size = this->file.get_block_size();
+    char *bytes = static_cast<char*>(StatementArena::allocate(block_size)); // more than we need (we insist that one row fits into a block)
+    uint room = SlottedPage::empty_room(block_size); // what a new block can take, after its header and the row's slot
     uint offset = 0;
     uint col_num = 0;
-    for (auto const& column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            *(int32_t*) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            uint size = value.s.length();
-            *(u16*) (bytes + offset) = size;
-            offset += sizeof(u16);
-            memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else {
-            throw DbRelationError("Only know how to marshal INT and TEXT");
+    std::vector<BlockID> chains;
+    try {
+        for (auto const& column_name: this->column_names) {
+            ColumnAttribute ca = this->column_attributes[col_num++];
+            ValueDict::const_iterator column = row->find(column_name);
+            Value value = column->second;
+            if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+                if (offset + sizeof(int32_t) > room)
+                    throw DbRelationError("row too big to marshal");
+                *(int32_t*) (bytes + offset) = value.n;
+                offset += sizeof(int32_t);
+            } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+                if (ca.get_encoding() == ColumnAttribute::DICTIONARY) {
+                    if (offset + sizeof(u16) > room)
+                        throw DbRelationError("row too big to marshal");
+                    u16 code = this->dictionary->encode(value.s, true);
+                    *(u16*) (bytes + offset) = code;
+                    offset += sizeof(u16);
+                    if (code != TextDictionary::NO_CODE)
+                        continue;
+                    // no code: the value itself follows
+                }
+                uint size = value.s.length();
+                if (size > this->overflow_threshold() || size >= OVERFLOW_MARK) {
+                    // out of line: marker, total size, first overflow block
+                    if (offset + sizeof(u16) + 2 * sizeof(u32) > room)
+                        throw DbRelationError("row too big to marshal");
+                    BlockID first = this->overflow.put(value.s);
+                    chains.push_back(first);
+                    *(u16*) (bytes + offset) = OVERFLOW_MARK;
+                    offset += sizeof(u16);
+                    u32 total = size;
+                    memcpy(bytes + offset, &total, sizeof(u32));
+                    memcpy(bytes + offset + sizeof(u32), &first, sizeof(u32));
+                    offset += 2 * sizeof(u32);
+                    continue;
+                }
+                if (offset + sizeof(u16) + size > room)
+                    throw DbRelationError("row too big to marshal");
+                *(u16*) (bytes + offset) = size;
+                offset += sizeof(u16);
+                memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
+                offset += size;
+            } else {
+                throw DbRelationError("Only know how to marshal INT and TEXT");
+            }
         }
+        if (this->versioned()) {
+            if (offset + RowVersion::SIZE > room)
+                throw DbRelationError("row too big to marshal");
+            const Snapshot *snapshot = VersionManager::current();
+            RowVersion(snapshot == nullptr ? 0 : snapshot->get_xid()).pack(bytes + offset);
+            offset += RowVersion::SIZE;
+        }
+    } catch (...) {
+        StatementArena::free(bytes);
+        this->drop_overflow(chains);
+        throw;
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
+    Dbt *data = new Dbt(bytes, offset); // the rest of bytes goes unused until it is freed
+    StorageStats::add(ROWS_MARSHALED);
     return data;
 }
 
-ValueDict* HeapTable::unmarshal(Dbt* data) {
+// decode a record; with column_names, only those columns are returned (and only their
+// overflow blocks are read)
+ValueDict* HeapTable::unmarshal(Dbt* data, const ColumnNames *column_names, bool decode) {
     char* bytes = static_cast<char*>(data->get_data());
     ValueDict* row = new ValueDict();
     uint offset = 0;
@@ -352,50 +2000,517 @@ ValueDict* HeapTable::unmarshal(Dbt* data) {
 
     for (const auto& column_name : this->column_names) {
         ColumnAttribute ca = this->column_attributes[col_num++];
+        bool wanted = column_names == nullptr ||
+                      std::find(column_names->begin(), column_names->end(), column_name) != column_names->end();
         if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
             int32_t val = *(reinterpret_cast<int32_t*>(bytes + offset));
             offset += sizeof(int32_t);
-            (*row)[column_name] = Value(val);
+            if (wanted)
+                (*row)[column_name] = Value(val);
         } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+            if (ca.get_encoding() == ColumnAttribute::DICTIONARY) {
+                u16 code = *(reinterpret_cast<u16*>(bytes + offset));
+                offset += sizeof(u16);
+                if (code != TextDictionary::NO_CODE) {
+                    if (wanted) {
+                        try {
+                            (*row)[column_name] = decode ? Value(this->dictionary->decode(code)) : Value((int32_t) code);
+                        } catch (...) {
+                            delete row;
+                            throw;
+                        }
+                    }
+                    continue;
+                }
+            }
             uint size = *(reinterpret_cast<u16*>(bytes + offset));
             offset += sizeof(u16);
-            std::string val(bytes + offset, size);
+            if (size == OVERFLOW_MARK) {
+                u32 total;
+                BlockID first;
+                memcpy(&total, bytes + offset, sizeof(u32));
+                memcpy(&first, bytes + offset + sizeof(u32), sizeof(u32));
+                offset += 2 * sizeof(u32);
+                if (wanted) {
+                    try {
+                        (*row)[column_name] = Value(this->overflow.get(first, total));
+                    } catch (...) {
+                        delete row;
+                        throw;
+                    }
+                }
+                continue;
+            }
+            if (wanted)
+                (*row)[column_name] = Value(std::string(bytes + offset, size));
             offset += size;
-            (*row)[column_name] = Value(val);
         } else {
+            delete row;
             throw DbRelationError("Unknown data type while unmarshaling");
         }
     }
+    StorageStats::add(ROWS_UNMARSHALED);
     return row;
 }
 
 Handles *HeapTable::select() {
-    Handles *handles = new Handles();
-    // Logic to iterate over all records and add their handles to the list
-    // This is just a placeholder.
-    return handles;
+    return this->select(nullptr);
+}
+
+// A value with no code is left as it is: a row can only have stored it as is, since once a
+// value has a code every row with that value gets the code.
+ValueDict *HeapTable::encode_where(const ValueDict *where) {
+    ValueDict *coded = new ValueDict(*where);
+    if (this->dictionary == nullptr)
+        return coded;
+    uint col_num = 0;
+    for (auto const& column_name : this->column_names) {
+        ColumnAttribute ca = this->column_attributes[col_num++];
+        if (ca.get_data_type() != ColumnAttribute::TEXT || ca.get_encoding() != ColumnAttribute::DICTIONARY)
+            continue;
+        ValueDict::iterator value = coded->find(column_name);
+        if (value == coded->end() || value->second.data_type != ColumnAttribute::TEXT)
+            continue;
+        u16 code = this->dictionary->encode(value->second.s);
+        if (code != TextDictionary::NO_CODE)
+            value->second = Value((int32_t) code);
+    }
+    return coded;
+}
+
+// every version in the block counts, whether or not anyone can still see it
+void HeapTable::seal(SlottedPage *block, const std::vector<BloomFilter *> *filters) {
+    bool zoned = filters == nullptr && this->zone_mapped();
+    if (filters == nullptr)
+        filters = &this->bloom_filters;
+    if (!zoned && filters->empty())
+        return;
+    const std::vector<u32> &columns = this->zones.get_columns();
+    ColumnNames int_columns;
+    std::vector<int32_t> bounds;
+    if (zoned) {
+        for (auto const &i : columns) {
+            int_columns.push_back(this->column_names[i]);
+            bounds.push_back(INT32_MAX);
+            bounds.push_back(INT32_MIN);
+        }
+    }
+    ColumnNames key_columns;
+    for (auto const &bloom_filter : *filters)
+        for (auto const &column_name : bloom_filter->get_columns())
+            if (std::find(key_columns.begin(), key_columns.end(), column_name) == key_columns.end())
+                key_columns.push_back(column_name);
+    std::vector<std::vector<std::string>> keys(filters->size());
+    for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+        Handle handle(block->get_block_id(), record_id);
+        if (zoned) {
+            // the zones are of the stored values, DICTIONARY codes and all
+            ValueDict *row = this->project(block, handle, &int_columns, false);
+            for (u32 c = 0; c < int_columns.size(); c++) {
+                int32_t n = row->at(int_columns[c]).n;
+                bounds[2 * c] = std::min(bounds[2 * c], n);
+                bounds[2 * c + 1] = std::max(bounds[2 * c + 1], n);
+            }
+            delete row;
+        }
+        if (!key_columns.empty()) {
+            // the keys are of the values as a where clause gives them
+            ValueDict *row = this->project(block, handle, &key_columns);
+            for (u32 f = 0; f < filters->size(); f++)
+                keys[f].push_back((*filters)[f]->key(*row));
+            delete row;
+        }
+    }
+    if (zoned)
+        this->zones.put(block->get_block_id(), bounds);
+    for (u32 f = 0; f < filters->size(); f++)
+        (*filters)[f]->put(block->get_block_id(), keys[f]);
 }
 
+// add the row to the last block, or to a new block if it doesn't fit.
+// Only the holder of the last block's latch may add a block, so concurrent
+// appenders queue on that latch and recheck which block is last once they get it.
+// marshal() made sure the row fits in an empty block, so a new block always takes it.
 Handle HeapTable::append(const ValueDict *row) {
-    // Convert row to Dbt data structure
-    Dbt *data = marshal(row);
-    
-    // Get a new block if necessary and add the record
-    BlockID block_id = 0; // Determine the appropriate block ID
-    SlottedPage *block = dynamic_cast<SlottedPage*>(this->file.get_new()); // Or use existing block
+    Dbt *data = this->marshal(row);
+    Handle handle;
+    SlottedPage *block = nullptr;
+    try {
+        while (true) {
+            BlockID last = this->file.get_last_block_id();
+            BlockWriteLatch last_latch(this->file, last);
+            if (this->file.get_last_block_id() != last)
+                continue; // someone else added a block while we waited
+            block = this->file.get(last);
+            try {
+                handle = Handle(last, block->add(data));
+            } catch (DbBlockNoRoomError &e) {
+                this->seal(block);
+                delete block;
+                block = nullptr;
+                BlockWriteLatch new_latch(this->file, last + 1);
+                block = this->file.get_new();
+                handle = Handle(block->get_block_id(), block->add(data));
+            }
+            this->file.put(block); // Write the block back to the file
+            delete block;
+            block = nullptr;
+            break;
+        }
+    } catch (...) {
+        delete block;
+        this->drop_overflow(this->overflow_chains(data)); // the row never made it into a block
+        StatementArena::free(data->get_data());
+        delete data;
+        throw;
+    }
+    StatementArena::free(data->get_data());
+    delete data;
+    return handle;
+}
 
-    RecordID record_id = block->add(data);
-    this->file.put(block); // Write the block back to the file
+HeapRewrite::HeapRewrite(HeapTable &table) : table(table), target(table.table_name + ".rewrite",
+        table.file.get_block_size(), table.file.is_compressed()), horizon(0), copied_to(0), moved(), replaced(),
+        left(), started(false), finished(false), abandoned(false) {
+    this->target.set_logged(false); // written out in full by close(), before it replaces the table's file
+}
 
-    delete data; // Clean up the marshaled data
+HeapRewrite::~HeapRewrite() {
+    if (!this->started || this->finished)
+        return;
+    try {
+        if (!this->abandoned)
+            this->table.file.track_changes(false); // (its state, by name, may be a new table's by now)
+        this->target.drop();
+    } catch (...) {
+        // leave it for the next rewrite's create() to clear away
+    }
+}
 
-    return std::make_pair(block_id, record_id);
+void HeapRewrite::copy() {
+    this->table.open();
+    this->horizon = VersionManager::horizon();
+    {
+        OutsideTransaction outside;
+        try {
+            this->target.drop(); // left over from one that never finished
+        } catch (DbException &e) {
+            // nothing left over
+        }
+        this->target.create();
+    }
+    this->started = true;
+    SharedLatch latch(this->table.file.latch()); // keeps the file from being dropped or replaced under us
+    this->table.file.track_changes(true); // before reading anything, so no change is missed
+    BlockIDs *block_ids = this->table.file.block_ids();
+    this->copied_to = block_ids->empty() ? 0 : block_ids->back();
+    size_t n_threads = HeapTable::scan_threads(block_ids->size());
+    std::vector<SlottedPage *> pages(n_threads, nullptr);
+    std::vector<std::vector<std::pair<Handle, Handle>>> moves(n_threads);
+    std::vector<std::vector<Handle>> replacements(n_threads);
+    std::vector<std::vector<std::pair<Handle, std::vector<BlockID>>>> lefts(n_threads);
+    try {
+        pages[0] = this->target.get(1); // create() left it empty
+        this->table.scan_in_parallel(*block_ids, n_threads, [&](size_t t, SlottedPage *block) {
+            for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+                Dbt *data = block->get(record_id);
+                try {
+                    Handle handle(block->get_block_id(), record_id);
+                    if (this->keep(data)) {
+                        Handle copy = this->add(pages[t], data);
+                        moves[t].push_back(std::make_pair(handle, copy));
+                        if (this->has_replacement(data))
+                            replacements[t].push_back(copy);
+                    } else {
+                        lefts[t].push_back(std::make_pair(handle, this->table.overflow_chains(data)));
+                    }
+                } catch (...) {
+                    delete data;
+                    throw;
+                }
+                delete data;
+            }
+        });
+        for (auto &page : pages)
+            this->put(page);
+    } catch (...) {
+        for (auto &page : pages)
+            delete page;
+        delete block_ids;
+        throw;
+    }
+    delete block_ids;
+    for (size_t t = 0; t < n_threads; t++) {
+        this->moved.insert(moves[t].begin(), moves[t].end());
+        this->replaced.insert(replacements[t].begin(), replacements[t].end());
+        this->left.insert(lefts[t].begin(), lefts[t].end());
+    }
+}
+
+// Anything changed since copy() read it was put while tracking was on, and anything added is
+// past copied_to, so going over those blocks once more (with everyone else shut out) is enough.
+void HeapRewrite::finish() {
+    ExclusiveLatch latch(this->table.file.latch());
+    std::set<BlockID> changes = this->table.file.get_changes();
+    for (BlockID block_id = this->copied_to + 1; block_id <= this->table.file.get_last_block_id(); block_id++)
+        changes.insert(block_id);
+    SlottedPage *page = nullptr;
+    try {
+        for (BlockID block_id : changes) {
+            SlottedPage *block = this->table.file.get(block_id);
+            try {
+                this->recopy(block, page);
+            } catch (...) {
+                delete block;
+                throw;
+            }
+            delete block;
+        }
+        this->put(page);
+    } catch (...) {
+        delete page;
+        throw;
+    }
+
+    // a replaced version's next is where its replacement was in the old file
+    for (auto const &handle : this->replaced) {
+        BlockWriteLatch block_latch(this->target, handle.first);
+        SlottedPage *block = this->target.get(handle.first);
+        Dbt *data = block->get(handle.second);
+        RowVersion version;
+        if (data != nullptr && this->table.get_version(data, version)) {
+            auto moved_to = this->moved.find(version.next);
+            version.next = moved_to == this->moved.end() ? Handle(0, 0) : moved_to->second;
+            version.pack(static_cast<char *>(data->get_data()) + data->get_size() - RowVersion::SIZE);
+        }
+        delete data;
+        try {
+            this->target.put(block);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        delete block;
+    }
+
+    this->table.file.track_changes(false);
+    this->table.file.replace_with(this->target);
+    this->finished = true;
+    for (auto const &versions : this->left)
+        this->table.free_overflow(versions.second);
+    // the summaries were of the old blocks; summarize() fills them in again
+    if (this->table.zone_mapped())
+        this->table.zones.create();
+    for (auto const &bloom_filter : this->table.bloom_filters)
+        bloom_filter->create();
+}
+
+bool HeapRewrite::keep(const Dbt *data) {
+    RowVersion version;
+    return !this->table.get_version(data, version) || version.xmax == 0 || version.xmax >= this->horizon;
+}
+
+bool HeapRewrite::has_replacement(const Dbt *data) {
+    RowVersion version;
+    return this->table.get_version(data, version) && version.next.first != 0;
+}
+
+Handle HeapRewrite::add(SlottedPage *&page, const Dbt *data) {
+    if (page != nullptr) {
+        try {
+            return Handle(page->get_block_id(), page->add(data));
+        } catch (DbBlockNoRoomError &e) {
+            this->put(page);
+        }
+    }
+    // each thread fills a block of its own, so it only needs the latches to add one
+    while (true) {
+        BlockID last = this->target.get_last_block_id();
+        BlockWriteLatch last_latch(this->target, last);
+        if (this->target.get_last_block_id() != last)
+            continue; // someone else added a block while we waited
+        BlockWriteLatch new_latch(this->target, last + 1);
+        page = this->target.get_new();
+        break;
+    }
+    return Handle(page->get_block_id(), page->add(data));
+}
+
+void HeapRewrite::put(SlottedPage *&page) {
+    if (page == nullptr)
+        return;
+    try {
+        this->target.put(page);
+    } catch (...) {
+        delete page;
+        page = nullptr;
+        throw;
+    }
+    delete page;
+    page = nullptr;
+}
+
+// Records only ever change by getting stamped (expire) or going away (remove, vacuum); new
+// ones get new record ids. Whoever removed a record freed its overflow chains.
+void HeapRewrite::recopy(SlottedPage *block, SlottedPage *&page) {
+    BlockID block_id = block->get_block_id();
+    for (auto gone = this->left.lower_bound(Handle(block_id, 0));
+         gone != this->left.end() && gone->first.first == block_id;) {
+        Dbt *data = block->get(gone->first.second);
+        if (data == nullptr) {
+            gone = this->left.erase(gone);
+        } else {
+            delete data;
+            gone++;
+        }
+    }
+    auto copied = this->moved.lower_bound(Handle(block_id, 0));
+    for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+        for (; copied != this->moved.end() && copied->first.first == block_id && copied->first.second < record_id;)
+            copied = this->drop_copy(copied);
+        Dbt *data = block->get(record_id);
+        try {
+            bool was_copied = copied != this->moved.end() && copied->first == Handle(block_id, record_id);
+            if (!this->keep(data)) {
+                if (was_copied)
+                    copied = this->drop_copy(copied);
+                this->left[Handle(block_id, record_id)] = this->table.overflow_chains(data);
+            } else if (was_copied) {
+                this->restamp(copied->second, data);
+                if (this->has_replacement(data))
+                    this->replaced.insert(copied->second);
+                copied++;
+            } else {
+                Handle copy = this->add(page, data);
+                this->moved[Handle(block_id, record_id)] = copy;
+                if (this->has_replacement(data))
+                    this->replaced.insert(copy);
+            }
+        } catch (...) {
+            delete data;
+            throw;
+        }
+        delete data;
+    }
+    while (copied != this->moved.end() && copied->first.first == block_id)
+        copied = this->drop_copy(copied);
+}
+
+std::map<Handle, Handle>::iterator HeapRewrite::drop_copy(std::map<Handle, Handle>::iterator copied) {
+    Handle copy = copied->second;
+    BlockWriteLatch latch(this->target, copy.first);
+    SlottedPage *block = this->target.get(copy.first);
+    block->del(copy.second);
+    try {
+        this->target.put(block);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
+    this->replaced.erase(copy);
+    return this->moved.erase(copied);
+}
+
+void HeapRewrite::restamp(Handle copy, const Dbt *data) {
+    RowVersion version;
+    if (!this->table.get_version(data, version))
+        return;
+    BlockWriteLatch latch(this->target, copy.first);
+    SlottedPage *block = this->target.get(copy.first);
+    Dbt *copied = block->get(copy.second);
+    version.pack(static_cast<char *>(copied->get_data()) + copied->get_size() - RowVersion::SIZE);
+    delete copied;
+    try {
+        this->target.put(block);
+    } catch (...) {
+        delete block;
+        throw;
+    }
+    delete block;
 }
 
 
 
 // test function -- returns true if all tests pass
 bool test_heap_storage() {
+    // a block over 64KB uses 4-byte header fields
+    std::vector<char> big(128 * 1024, 0);
+    Dbt big_block(big.data(), big.size());
+    SlottedPage big_page(big_block, 1, true);
+    std::string big_record(70000, 'x');
+    Dbt big_data(&big_record[0], big_record.size());
+    RecordID big_id = big_page.add(&big_data);
+    Dbt *big_got = big_page.get(big_id);
+    bool big_ok = big_got->get_size() == big_record.size();
+    delete big_got;
+    if (!big_ok)
+        return false;
+    std::cout << "128KB slotted page ok" << std::endl;
+
+    // both page formats find the same live records; CLASSIC blocks are still read as they are
+    for (auto format : {SlottedPage::CLASSIC, SlottedPage::BITMAP}) {
+        std::vector<char> bytes(DbBlock::BLOCK_SZ, 0);
+        Dbt block(bytes.data(), bytes.size());
+        SlottedPage page(block, 1, true, false, format);
+        char record[] = "record";
+        Dbt data(record, sizeof(record));
+        for (int i = 0; i < 100; i++)
+            page.add(&data);
+        page.del(2);
+        page.del(70);
+        page.set_lsn(12345);
+        SlottedPage reread(block, 1);
+        RecordIDs *ids = reread.ids();
+        bool format_ok = reread.get_format() == format && ids->size() == 98 && (*ids)[1] == 3 &&
+                         reread.next_id(69) == 71 && reread.live_count() == 98 && reread.next_id(100) == 0 &&
+                         reread.get_lsn() == (format == SlottedPage::BITMAP ? 12345u : 0u);
+        delete ids;
+        if (!format_ok)
+            return false;
+    }
+    std::cout << "page formats ok" << std::endl;
+
+    // empty_room is exactly what a new block takes, in either format
+    for (auto format : {SlottedPage::CLASSIC, SlottedPage::BITMAP}) {
+        std::vector<char> bytes(DbBlock::BLOCK_SZ, 0);
+        Dbt block(bytes.data(), bytes.size());
+        u_int32_t room = SlottedPage::empty_room(DbBlock::BLOCK_SZ, format);
+        std::string record(room + 1, 'r');
+        Dbt too_big(&record[0], room + 1), just_fits(&record[0], room);
+        SlottedPage page(block, 1, true, false, format);
+        bool room_ok = false;
+        try {
+            page.add(&too_big);
+        } catch (DbBlockNoRoomError &e) {
+            room_ok = page.add(&just_fits) == 1;
+        }
+        if (!room_ok)
+            return false;
+    }
+    std::cout << "empty room ok" << std::endl;
+
+    // the arena takes back only its own memory: heap memory, and its memory freed on
+    // another thread, never end up on its free lists
+    {
+        ArenaScope scope;
+        void *mine = StatementArena::allocate(64);
+        StatementArena::free(mine);
+        bool arena_ok = StatementArena::allocate(64) == mine;
+        void *heap = nullptr, *elsewhere = StatementArena::allocate(64);
+        std::thread other([&]() {
+            heap = StatementArena::allocate(64);
+            StatementArena::free(elsewhere);
+        });
+        other.join();
+        StatementArena::free(heap);
+        void *next = StatementArena::allocate(64);
+        arena_ok = arena_ok && next != heap && next != elsewhere;
+        if (!arena_ok)
+            return false;
+    }
+    std::cout << "arena ok" << std::endl;
+
 	ColumnNames column_names;
 	column_names.push_back("a");
 	column_names.push_back("b");
@@ -407,7 +2522,7 @@ bool test_heap_storage() {
     HeapTable table1("_test_create_drop_cpp", column_names, column_attributes);
     table1.create();
     std::cout << "create ok" << std::endl;
-    table1.drop();  // drop makes the object unusable because of BerkeleyDB restriction -- maybe want to fix this some day
+    table1.drop();
     std::cout << "drop ok" << std::endl;
 
     HeapTable table("_test_data_cpp", column_names, column_attributes);
@@ -430,7 +2545,287 @@ bool test_heap_storage() {
     value = (*result)["b"];
     if (value.s != "Hello!")
 		return false;
+
+    // long TEXT goes to overflow blocks; projecting just "a" must not need them
+    row["a"] = Value(13);
+    row["b"] = Value(std::string(10000, 'z'));
+    Handle big_handle = table.insert(&row);
+    ValueDict *big_result = table.project(big_handle);
+    bool overflow_ok = (*big_result)["b"].s == row["b"].s;
+    delete big_result;
+    ColumnNames just_a = {"a"};
+    u_int64_t overflow_reads = StorageStats::thread_totals()[OVERFLOW_READS];
+    big_result = table.project(big_handle, &just_a);
+    overflow_ok = overflow_ok && (*big_result)["a"].n == 13 && big_result->count("b") == 0 &&
+                  StorageStats::thread_totals()[OVERFLOW_READS] == overflow_reads;
+    delete big_result;
+    if (!overflow_ok)
+        return false;
+    std::cout << "overflow ok" << std::endl;
+
+    // long values don't take up the table's blocks, and a removed row's overflow blocks are used again
+    {
+        u_int32_t table_blocks = table.get_block_count();
+        table.del(table.insert(&row)); // removed at once, with no version writer running
+        HeapFile overflow_file("_test_data_cpp_overflow");
+        overflow_file.open();
+        u_int32_t overflow_blocks = overflow_file.get_last_block_id();
+        table.del(table.insert(&row));
+        bool reuse_ok = table.get_block_count() == table_blocks && overflow_file.get_last_block_id() == overflow_blocks;
+        overflow_file.close();
+        if (!reuse_ok)
+            return false;
+    }
+    std::cout << "overflow reuse ok" << std::endl;
+
+    // compacting into compressed blocks keeps every handle and value
+    table.compact();
+    HeapTable reopened("_test_data_cpp", column_names, column_attributes);
+    reopened.open();
+    big_result = reopened.project(big_handle);
+    delete result;
+    result = reopened.project((*handles)[0]);
+    bool compact_ok = (*big_result)["b"].s == row["b"].s && (*result)["b"].s == "Hello!";
+    delete big_result;
+    delete result;
+    delete handles;
+    reopened.close();
+    if (!compact_ok)
+        return false;
+    std::cout << "compact ok" << std::endl;
     table.drop();
 
+    // DICTIONARY columns store codes, and select(where) compares them
+    ColumnAttributes coded_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                         ColumnAttribute(ColumnAttribute::TEXT, ColumnAttribute::DICTIONARY)};
+    HeapTable coded("_test_dict_cpp", column_names, coded_attributes);
+    coded.create();
+    const char *statuses[] = {"open", "closed", "open"};
+    for (int i = 0; i < 3; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value(statuses[i]);
+        coded.insert(&row);
+    }
+    row["a"] = Value(3);
+    row["b"] = Value(std::string(TextDictionary::MAX_VALUE_SZ + 1, 'x')); // too long for a code
+    coded.insert(&row);
+    ValueDict where;
+    where["b"] = Value("open");
+    Handles *matches = coded.select(&where);
+    result = coded.project(matches->back());
+    bool dictionary_ok = matches->size() == 2 && (*result)["a"].n == 2 && (*result)["b"].s == "open";
+    delete result;
+    delete matches;
+    where["b"] = row["b"];
+    matches = coded.select(&where);
+    dictionary_ok = dictionary_ok && matches->size() == 1;
+    delete matches;
+    coded.drop();
+    if (!dictionary_ok)
+        return false;
+    std::cout << "dictionary ok" << std::endl;
+
+    // a snapshot keeps seeing a row as it was while another writer replaces it, and
+    // vacuum removes the old version once nobody can see it
+    HeapTable versions("_test_versions_cpp", column_names, column_attributes);
+    versions.create();
+    row["a"] = Value(1);
+    row["b"] = Value("old");
+    Handle first = versions.insert(&row); // with no version writer running, everyone sees it at once
+    std::promise<void> taken, changed;
+    bool reader_ok = false;
+    std::thread reader([&]() {
+        SnapshotScope snapshot;
+        taken.set_value();
+        changed.get_future().wait();
+        Handles *seen = versions.select();
+        ValueDict *old_row = versions.project(first);
+        reader_ok = seen->size() == 1 && (*old_row)["b"].s == "old";
+        delete old_row;
+        delete seen;
+    });
+    taken.get_future().wait();
+    ValueDict new_values;
+    new_values["b"] = Value("new");
+    {
+        SnapshotScope snapshot;
+        versions.update(first, &new_values);
+    }
+    changed.set_value();
+    reader.join();
+    result = versions.project(first); // along the chain to the new version
+    Handles *current = versions.select();
+    bool versions_ok = reader_ok && (*result)["b"].s == "new" && (*result)["a"].n == 1 && current->size() == 1 &&
+                       versions.vacuum() == 1;
+    delete result;
+    {
+        SnapshotScope snapshot;
+        versions.del(current->front());
+        delete current;
+        current = versions.select();
+        versions_ok = versions_ok && current->empty();
+    }
+    delete current;
+    versions_ok = versions_ok && versions.vacuum() == 1;
+
+    // a row written without stamps gets them when it is deleted, so others still see it until then
+    class Unstamped : public HeapTable {
+    public:
+        using HeapTable::HeapTable;
+    protected:
+        virtual bool versioned() { return false; }
+    };
+    Unstamped unstamped("_test_versions_cpp", column_names, column_attributes);
+    unstamped.open();
+    Handle legacy = unstamped.insert(&row);
+    {
+        SnapshotScope snapshot;
+        versions.del(legacy);
+        std::thread other([&]() {
+            SnapshotScope other_snapshot;
+            current = versions.select();
+            versions_ok = versions_ok && current->size() == 1;
+            delete current;
+        });
+        other.join();
+    }
+    current = versions.select();
+    versions_ok = versions_ok && current->empty() && versions.vacuum() == 1;
+    delete current;
+    versions.drop();
+    if (!versions_ok)
+        return false;
+    std::cout << "row versions ok" << std::endl;
+
+    // small blocks fill quickly: a where on an INT column reads just the ones its zone map allows
+    HeapTable zoned("_test_zones_cpp", column_names, column_attributes, HeapFile::MIN_BLOCK_SZ);
+    zoned.create();
+    for (int32_t i = 0; i < 300; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("z" + std::to_string(i % 7));
+        zoned.insert(&row);
+    }
+    where.clear();
+    where["a"] = Value(42);
+    u_int64_t block_gets = StorageStats::thread_totals()[BLOCK_GETS];
+    handles = zoned.select(&where);
+    bool zones_ok = handles->size() == 1 &&
+                    StorageStats::thread_totals()[BLOCK_GETS] - block_gets < zoned.get_block_count() / 2;
+    delete handles;
+    where["b"] = Value("z0");
+    handles = zoned.select(&where);
+    zones_ok = zones_ok && handles->size() == 1;
+    delete handles;
+    zoned.drop();
+    if (!zones_ok)
+        return false;
+    std::cout << "zone maps ok" << std::endl;
+
+    // a bloom filter on a TEXT column, built for the blocks already full and kept as more fill up
+    HeapTable bloomed("_test_bloom_cpp", column_names, column_attributes, HeapFile::MIN_BLOCK_SZ);
+    bloomed.create();
+    for (int32_t i = 0; i < 300; i++) {
+        if (i == 150) {
+            bloomed.add_bloom_filter("b_bloom", ColumnNames({"b"}));
+            bloomed.build_bloom_filter("b_bloom");
+        }
+        row["a"] = Value(i);
+        row["b"] = Value("k" + std::to_string(i));
+        bloomed.insert(&row);
+    }
+    where.clear();
+    bool bloom_ok = true;
+    for (auto const &key : {"k42", "k250", "none"}) {
+        where["b"] = Value(key);
+        block_gets = StorageStats::thread_totals()[BLOCK_GETS];
+        handles = bloomed.select(&where);
+        bloom_ok = bloom_ok && handles->size() == (std::string(key) == "none" ? 0u : 1u) &&
+                   StorageStats::thread_totals()[BLOCK_GETS] - block_gets < bloomed.get_block_count() / 2;
+        delete handles;
+    }
+    bloomed.drop_bloom_filter("b_bloom");
+    handles = bloomed.select(&where);
+    bloom_ok = bloom_ok && handles->empty();
+    delete handles;
+    bloomed.drop();
+    if (!bloom_ok)
+        return false;
+    std::cout << "bloom filters ok" << std::endl;
+
+    // a rewrite packs the rows left after deleting most of them into fewer blocks
+    HeapTable rewritten("_test_rewrite_cpp", column_names, column_attributes, HeapFile::MIN_BLOCK_SZ);
+    rewritten.create();
+    for (int32_t i = 0; i < 300; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("r" + std::to_string(i));
+        Handle handle = rewritten.insert(&row);
+        if (i % 10 != 0)
+            rewritten.del(handle);
+    }
+    u_int32_t blocks_before = rewritten.get_block_count();
+    {
+        HeapRewrite rewrite(rewritten);
+        rewrite.copy();
+        row["a"] = Value(300);
+        row["b"] = Value("r300");
+        rewritten.insert(&row); // caught up with by finish()
+        rewrite.finish();
+    }
+    handles = rewritten.select();
+    bool rewrite_ok = handles->size() == 31 && rewritten.get_block_count() < blocks_before;
+    int32_t a_sum = 0;
+    for (auto const &handle : *handles) {
+        ValueDict *got = rewritten.project(handle);
+        a_sum += (*got)["a"].n;
+        rewrite_ok = rewrite_ok && (*got)["b"].s == "r" + std::to_string((*got)["a"].n);
+        delete got;
+    }
+    delete handles;
+    rewritten.drop();
+    if (!rewrite_ok || a_sum != 4350 + 300)
+        return false;
+    std::cout << "rewrite ok" << std::endl;
+
+    // a column table in small blocks: a where on an INT column passes over blocks by their zone maps
+    ColumnTable columns("_test_columns_cpp", column_names, column_attributes, HeapFile::MIN_BLOCK_SZ);
+    columns.create();
+    for (int32_t i = 0; i < 300; i++) {
+        row["a"] = Value(i);
+        row["b"] = Value("v" + std::to_string(i % 7));
+        columns.insert(&row);
+    }
+    where.erase("b");
+    where["a"] = Value(250);
+    u_int64_t skipped = StorageStats::thread_totals()[BLOCKS_SKIPPED];
+    handles = columns.select(&where);
+    bool columns_ok = handles->size() == 1 && StorageStats::thread_totals()[BLOCKS_SKIPPED] > skipped;
+    if (columns_ok) {
+        result = columns.project((*handles)[0], &just_a);
+        columns_ok = (*result)["a"].n == 250 && result->count("b") == 0;
+        delete result;
+        result = columns.project((*handles)[0]);
+        columns_ok = columns_ok && (*result)["b"].s == "v5";
+        delete result;
+        columns.del((*handles)[0]);
+    }
+    delete handles;
+    handles = columns.select();
+    columns_ok = columns_ok && handles->size() == 299;
+
+    // projecting them all reads each block of the rows file and of a once, not once per row
+    ValueDicts projected;
+    u_int64_t gets = StorageStats::thread_totals()[BLOCK_GETS];
+    columns.project_rows(handles->begin(), handles->end(), &just_a, projected);
+    gets = StorageStats::thread_totals()[BLOCK_GETS] - gets;
+    columns_ok = columns_ok && projected.size() == 299 && (*projected[250])["a"].n == 251 &&
+                 projected[250]->count("b") == 0 && gets == 2 * (u_int64_t) handles->back().first;
+    for (auto projected_row : projected)
+        delete projected_row;
+    delete handles;
+    columns.drop();
+    if (!columns_ok)
+        return false;
+    std::cout << "column table ok" << std::endl;
+
     return true;
 }
\ No newline at end of file
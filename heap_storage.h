@@ -10,7 +10,22 @@
 #pragma once
 
 #include "db_cxx.h"
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "latch.h"
+#include "mvcc.h"
 #include "storage_engine.h"
+#include "transaction.h"
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -19,21 +34,58 @@
         Modeled after slotted-page from Database Systems Concepts, 6ed, Figure 10-9.
 
         Record id are handed out sequentially starting with 1 as records are added with add().
-        Each record has a header which is a fixed offset from the beginning of the block:
+        Each record has a header which is a fixed offset from the beginning of the block.
+        A CLASSIC block starts right in with them:
             Bytes 0x00 - Ox01: number of records
             Bytes 0x02 - 0x03: offset to end of free space
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+        A BITMAP block (what new blocks get) has a longer block header, then a bitmap of
+        which records are live (bit i-1 for record i, in 8-byte words), then the record headers:
+            Bytes 0x00 - 0x01: BITMAP_MARK (a CLASSIC block can never have that many records)
+            Bytes 0x02 - 0x03: number of records
+            Bytes 0x04 - 0x05: offset to end of free space
+            Bytes 0x06 - 0x07: number of live records
+            Bytes 0x08 - 0x09: bytes of deleted records (reclaimable by compacting the block)
+            Bytes 0x0A - 0x0B: most records the bitmap has room for
+            Bytes 0x10 - 0x17: LSN of the last change (see RedoLog), from 0x18 with 4-byte fields
+            Bytes 0x18 - ...:  the bitmap (from 0x20 with 4-byte fields), then the record headers
+        so finding the live records is a scan of the bitmap rather than of every header.
+        The block size is the size of the Dbt it is given. Blocks of up to 64KB use the
+        2-byte fields above; bigger blocks widen every header field to 4 bytes.
+        A page made with owns_data frees the Dbt's memory, which came from StatementArena,
+        when it is deleted. Pages themselves are allocated from StatementArena too.
  *
  */
 class SlottedPage : public DbBlock {
 public:
-    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
+    enum Format {
+        CLASSIC, BITMAP
+    };
+
+    /**
+     * largest block size that uses 2-byte header fields
+     */
+    static const u_int32_t NARROW_MAX = 65536;
+
+    /**
+     * most records a block can hold (RecordID is 16 bits)
+     */
+    static const u_int32_t MAX_RECORDS = 65535;
+
+    /**
+     * @param format  the layout of a new block (an existing one keeps its own)
+     */
+    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false, bool owns_data = false, Format format = BITMAP);
 
     // Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
     // but we delete them explicitly just to make sure we don't use them accidentally
-    virtual ~SlottedPage() {}
+    virtual ~SlottedPage();
+
+    static void *operator new(size_t size) { return StatementArena::allocate(size); }
+
+    static void operator delete(void *p) { StatementArena::free(p); }
 
     SlottedPage(const SlottedPage &other) = delete;
 
@@ -53,23 +105,227 @@ public:
 
     virtual RecordIDs *ids(void);
 
+    Format get_format() const { return format; }
+
+    /**
+     * LSN of the redo log record of the last change written (0 if none, and always for CLASSIC).
+     */
+    u_int64_t get_lsn() const {
+        u_int64_t lsn = 0;
+        if (format == BITMAP)
+            std::memcpy(&lsn, bytes() + lsn_offset(), sizeof(lsn));
+        return lsn;
+    }
+
+    void set_lsn(u_int64_t lsn) {
+        if (format == BITMAP)
+            std::memcpy(bytes() + lsn_offset(), &lsn, sizeof(lsn));
+    }
+
+    /**
+     * The free space between the record headers and the records, as [start, end) offsets.
+     */
+    void get_free_region(u_int32_t &start, u_int32_t &end) const {
+        start = directory_offset + num_records * header_entry_size();
+        end = end_free + 1;
+        if (start > end)
+            start = end;
+    }
+
+    /**
+     * The first live record after record_id (0 for the first one), or 0 if there are no more:
+     * for (RecordID id = page->next_id(0); id != 0; id = page->next_id(id)) ...
+     */
+    RecordID next_id(RecordID record_id) const {
+        if (format == BITMAP)
+            return next_live(record_id);
+        for (u_int32_t id = record_id + 1u; id <= num_records; id++)
+            if (get_n(slot_offset(id) + field_size()) != 0)
+                return static_cast<RecordID>(id);
+        return 0;
+    }
+
+    /**
+     * The largest record a new, empty block of block_size can take.
+     */
+    static u_int32_t empty_room(u_int32_t block_size, Format format = BITMAP);
+
+    /**
+     * How many records are live.
+     */
+    u_int32_t live_count() const;
+
+    /**
+     * Bytes between the record headers and the records: the most a new record (with its header) can have.
+     */
+    u_int32_t free_space() const {
+        u_int32_t header_end = directory_offset + num_records * header_entry_size();
+        return header_end > end_free ? 0 : end_free - header_end;
+    }
+
 protected:
-    u_int16_t num_records;
-    u_int16_t end_free;
+    Format format;
+    u_int32_t num_records;
+    u_int32_t end_free;
+    u_int32_t block_size;
+    bool wide;
+    bool owns_data;
+    u_int32_t live_records;     // BITMAP only, like the four below
+    u_int32_t dead_bytes;
+    u_int32_t capacity;         // records the bitmap has room for
+    u_int32_t bitmap_offset;
+    u_int32_t directory_offset; // where record 1's header is
+
+    u_int32_t field_size() const { return wide ? 4 : 2; }
+
+    u_int32_t lsn_offset() const { return (6 * field_size() + 7) / 8 * 8; }
+
+    u_int32_t header_entry_size() const { return 2 * field_size(); }
+
+    u_int32_t slot_offset(u_int32_t id) const { return directory_offset + (id - 1) * header_entry_size(); }
 
-    virtual void get_header(u_int16_t &size, u_int16_t &loc, RecordID id = 0);
+    const char *bytes() const { return static_cast<const char*>(block.get_data()); }
 
-    virtual void put_header(RecordID id = 0, u_int16_t size = 0, u_int16_t loc = 0);
+    char *bytes() { return static_cast<char*>(block.get_data()); }
 
-    virtual bool has_room(u_int16_t size);
+    // header fields are 2 bytes in blocks up to 64KB, 4 bytes in bigger blocks
+    u_int32_t get_n(u_int32_t offset) const {
+        if (wide) {
+            u_int32_t n;
+            std::memcpy(&n, bytes() + offset, sizeof(n));
+            return n;
+        }
+        u_int16_t n;
+        std::memcpy(&n, bytes() + offset, sizeof(n));
+        return n;
+    }
 
-    virtual void slide(u_int16_t start, u_int16_t end);
+    void put_n(u_int32_t offset, u_int32_t n) {
+        if (wide) {
+            std::memcpy(bytes() + offset, &n, sizeof(n));
+        } else {
+            u_int16_t narrow = static_cast<u_int16_t>(n);
+            std::memcpy(bytes() + offset, &narrow, sizeof(narrow));
+        }
+    }
 
-    virtual u_int16_t get_n(u_int16_t offset);
+    void *address(u_int32_t offset) { return bytes() + offset; }
 
-    virtual void put_n(u_int16_t offset, u_int16_t n);
+    // BITMAP: the first set bit after record_id's
+    RecordID next_live(u_int32_t record_id) const {
+        u_int32_t bit = record_id; // record_id + 1's bit
+        while (bit < num_records) {
+            u_int64_t word;
+            std::memcpy(&word, bytes() + bitmap_offset + bit / 64 * 8, sizeof(word));
+            word &= ~0ULL << (bit % 64);
+            if (word != 0) {
+                u_int32_t found = bit / 64 * 64 + __builtin_ctzll(word);
+                return found < num_records ? static_cast<RecordID>(found + 1) : 0;
+            }
+            bit = (bit / 64 + 1) * 64;
+        }
+        return 0;
+    }
 
-    virtual void *address(u_int16_t offset);
+    void set_live(u_int32_t record_id, bool live);
+
+    void get_header(u_int32_t &size, u_int32_t &loc, RecordID id);
+
+    void put_header(RecordID id = 0, u_int32_t size = 0, u_int32_t loc = 0);
+
+    bool has_room(u_int32_t size) const;
+
+    virtual void slide(u_int32_t start, u_int32_t end);
+
+    // lay out a new block in format
+    void initialize(Format format);
+
+    // BITMAP_MARK of a field's width
+    u_int32_t bitmap_mark() const { return wide ? 0xFFFFFFFF : 0xFFFF; }
+};
+
+/**
+ * @class OverflowPage - a block holding one piece of a TEXT value too long to keep in its row.
+ *
+ *      Overflow blocks are in a table's OverflowFile. They start with a SlottedPage
+        header of no records and no free space, followed by:
+            4 bytes: block id of the next piece (0 for the last piece)
+            4 bytes: size of this piece
+            the bytes of this piece
+ */
+class OverflowPage : public SlottedPage {
+public:
+    OverflowPage(Dbt &block, BlockID block_id, bool is_new = false, bool owns_data = false);
+
+    virtual ~OverflowPage() {}
+
+    OverflowPage(const OverflowPage &other) = delete;
+
+    OverflowPage(OverflowPage &&temp) = delete;
+
+    OverflowPage &operator=(const OverflowPage &other) = delete;
+
+    OverflowPage &operator=(OverflowPage &temp) = delete;
+
+    /**
+     * Is this block an overflow block (rather than a block of rows)?
+     */
+    virtual bool is_overflow() { return this->num_records == 0 && this->end_free == 0; }
+
+    /**
+     * Most bytes of a value one overflow block of this size can hold.
+     */
+    static u_int32_t capacity(u_int32_t block_size);
+
+    /**
+     * Store a piece of a value in this block.
+     * @param next   block holding the following piece (0 if this is the last)
+     * @param piece  bytes of this piece
+     * @param size   number of bytes (at most capacity())
+     */
+    virtual void set_piece(BlockID next, const char *piece, u_int32_t size);
+
+    /**
+     * Append this block's piece to value.
+     * @returns  block holding the following piece (0 if this is the last)
+     */
+    virtual BlockID get_piece(std::string &value);
+
+    /**
+     * The block holding the following piece (0 if this is the last), without reading this one.
+     */
+    virtual BlockID get_next();
+
+protected:
+    u_int32_t piece_offset() const { return header_entry_size(); }
+};
+
+/**
+ * @class HeapFileState - what every HeapFile handle open on the same file shares
+ *
+ * Each session opens its own HeapFile (and Db handle), so the latches and the last
+ * block id live here, one per file name, for the life of the process.
+ *
+ * Blocks are latched through a fixed array of stripes (block id modulo N_STRIPES).
+ */
+class HeapFileState {
+public:
+    static const uint N_STRIPES = 64;
+
+    HeapFileState() : last(0), last_known(false), tracking(false), changes() {}
+
+    RWLatch latch;                      // shared by writers, exclusive for create/drop/open
+    std::atomic<u_int32_t> last;        // last block id in the file; only grown by the holder of its block latch
+    bool last_known;                    // false until some handle has read last from the file (guarded by latch)
+
+    std::atomic<bool> tracking;         // whether puts are noted in changes (see HeapFile::track_changes)
+    std::mutex changes_mutex;           // guards changes
+    std::set<BlockID> changes;
+
+    RWLatch &block_latch(BlockID block_id) { return block_latches[block_id % N_STRIPES]; }
+
+protected:
+    RWLatch block_latches[N_STRIPES];
 };
 
 /**
@@ -79,12 +335,30 @@ protected:
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
         Uses SlottedPage for storing records within blocks.
+        All gets and puts run in the calling thread's transaction (see TransactionManager).
+        Writers hold a BlockWriteLatch on each block they change; readers need none, since
+        BerkeleyDB copies each block out whole.
+        The block size is chosen when the file is created (it is the RecNo record length)
+        and read back from the file when it is opened.
+        A compressed file instead has variable-length records, each a small header (format
+        and block size) followed by the block, compressed with BlockCodec where that saves space.
+        Blocks are decompressed into the page's buffer on get, so SlottedPage never knows.
+        Where BlockIO is available, get_async and put_async run on its I/O threads; writes
+        are queued per handle and handed over in batches of WRITE_BATCH, in order.
+        Every get_async must be waited for before the handle is closed or deleted.
+        Under UncommittedReads, gets in a -t environment take no BerkeleyDB locks (see HeapTable).
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {}
+    /**
+     * @param block_size  block size for create()
+     * @param compressed  whether create() makes a compressed file
+     */
+    HeapFile(std::string name, u_int32_t block_size = DbBlock::BLOCK_SZ, bool compressed = false) : DbFile(name),
+            dbfilename(name + ".db"), block_size(block_size), compressed(compressed), closed(true), logged(true),
+            db(nullptr), state(shared_state(dbfilename)), queued(std::make_shared<QueuedWrites>()) {}
 
-    virtual ~HeapFile() {}
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -108,28 +382,524 @@ public:
 
     virtual void put(DbBlock *block);
 
+    virtual std::future<DbBlock *> get_async(BlockID block_id);
+
+    /**
+     * get_async() for a SlottedPage; wait for (or poll) the future for it.
+     * @param block_id  which block to get
+     * @returns         future of the SlottedPage (freed by caller)
+     */
+    virtual std::future<SlottedPage *> get_page_async(BlockID block_id);
+
+    /**
+     * Queue a write (see DbFile::put_async). Only for blocks no other handle is reading,
+     * e.g. of a file being built, since the block latch is not held while it is written.
+     */
+    virtual std::future<void> put_async(DbBlock *block);
+
+    virtual void flush();
+
     virtual BlockIDs *block_ids();
 
-    virtual u_int32_t get_last_block_id() { return last; }
+    virtual u_int32_t get_last_block_id() { return state->last; }
+
+    virtual u_int32_t get_block_size() { return block_size; }
+
+    virtual bool is_compressed() { return compressed; }
+
+    virtual bool is_open() { return !closed; }
+
+    /**
+     * Rewrite the whole file into compressed blocks, keeping every block id.
+     * Caller holds latch() exclusively and no other handle may have the file open.
+     */
+    virtual void compact(void);
+
+    /**
+     * Start noting the id of every block put through any handle on the file (or, with false,
+     * stop and forget them), so a copy of the file can catch up with what changed meanwhile.
+     */
+    virtual void track_changes(bool on);
+
+    /**
+     * The blocks put since track_changes(true), in order.
+     */
+    virtual std::set<BlockID> get_changes();
+
+    /**
+     * Swap other (a new file) in under this file's name, removing this one; both are closed
+     * meanwhile. Caller holds latch() exclusively and no other handle may have the file open.
+     * This file is renamed aside first and removed last, so a crash leaves one or the other
+     * for recover_swaps() to put back under the name.
+     */
+    virtual void replace_with(HeapFile &other);
+
+    /**
+     * Finish or undo the swaps a crash interrupted in the environment's home directory: a file
+     * still aside is removed if the new one has its name, and otherwise renamed back. Run once
+     * when the environment is opened, before any file is.
+     */
+    static void recover_swaps(const std::string &home);
+
+    /**
+     * The file latch shared by all handles on this file.
+     */
+    virtual RWLatch &latch() { return state->latch; }
+
+    /**
+     * Exclusively latch a block for a change (see BlockWriteLatch). Inside a -t transaction
+     * nothing is latched: BerkeleyDB's locks, held until commit, keep the writers apart, and
+     * a latch held while waiting on one of them could close a cycle its lock detector can't
+     * see. Instead, this thread's gets take write locks (DB_RMW) until unlatch_block().
+     * @returns  whether the block was latched (pass it to unlatch_block)
+     */
+    virtual bool latch_block(BlockID block_id);
+
+    virtual void unlatch_block(BlockID block_id, bool latched);
+
+    /**
+     * Whether this handle's writes go in the RedoLog (when it is on). Files nobody needs
+     * after a crash, like a sort's spill files, need not be logged.
+     */
+    virtual void set_logged(bool logged) { this->logged = logged; }
+
+    /**
+     * Recovery: write a logged block image unless the block in the file is already at least
+     * as new (by LSN). Blocks missing before it are added empty.
+     * @returns  whether the block was written
+     */
+    virtual bool redo(BlockID block_id, const char *image, u_int64_t lsn);
+
+    /**
+     * smallest and largest block sizes for create()
+     */
+    static const u_int32_t MIN_BLOCK_SZ = 512;
+    static const u_int32_t MAX_BLOCK_SZ = 16 * 1024 * 1024;
 
 protected:
     std::string dbfilename;
-    u_int32_t last;
-    bool closed;
-    Db db;
+    u_int32_t block_size;
+    bool compressed;
+    std::atomic<bool> closed;
+    bool logged;
+    Db *db;     // a new handle each time the file is opened
+    HeapFileState *state;
+
+    class QueuedWrite {
+    public:
+        explicit QueuedWrite(DbBlock *block) : block(block), written() {}
+
+        DbBlock *block;
+        std::promise<void> written;
+    };
+    typedef std::vector<QueuedWrite> QueuedWrites;
+
+    std::mutex write_mutex;                 // guards the three below
+    std::shared_ptr<QueuedWrites> queued;   // writes not yet handed to BlockIO
+    std::shared_future<void> last_batch;    // the last batch handed over; ready once it is written
+    std::exception_ptr write_error;         // the first failed write since the last flush()
+
+    static thread_local bool uncommitted_reads;
+    static thread_local uint write_intents;     // BlockWriteLatches this thread holds inside a transaction
+
+    friend class UncommittedReads;
+
+    // hand the queued writes to BlockIO, to be written after the batch before them
+    virtual void submit_writes();
 
     virtual void db_open(uint flags = 0);
+
+    // read a block into buffer (block_size bytes), decompressing if need be; returns bytes read from the file
+    virtual u_int32_t db_get(BlockID block_id, char *buffer);
+
+    // write a block, compressing it if need be; returns bytes written to the file
+    virtual u_int32_t db_put(BlockID block_id, Dbt *block);
+
+    // the block size of a compressed file, from the header of its first block
+    virtual u_int32_t read_compressed_block_size();
+
+    static HeapFileState *shared_state(const std::string &dbfilename);
+
+    // set last from the file itself, e.g. once a rollback has taken away blocks get_new added
+    static void recount(const std::string &dbfilename, HeapFileState *state);
+
+    static const char *const ASIDE_SUFFIX;     // added to a file's name while replace_with() has it aside
+
+    static const uint WRITE_BATCH = 32;
+    static const u_int32_t BDB_MAX_PAGESIZE = 65536;
+
+    // header of each record in a compressed file: u8 format, u32 block size
+    static const u_int32_t COMPRESSED_HEADER_SZ = 5;
+    static const char FORMAT_RAW = 0;
+    static const char FORMAT_LZ = 1;
+};
+
+/**
+ * @class ReadAhead - reads a list of a HeapFile's blocks in order, with the next few in flight
+ *
+ * Where BlockIO is not available, each block is simply read when it is asked for.
+ */
+class ReadAhead {
+public:
+    static const uint DEPTH = 8;
+
+    /**
+     * @param file       the file to read (open)
+     * @param block_ids  the blocks to read, in order (takes ownership of it)
+     * @param depth      how many blocks to keep in flight
+     */
+    ReadAhead(HeapFile &file, BlockIDs *block_ids, uint depth = DEPTH);
+
+    virtual ~ReadAhead(); // waits for (and frees) the blocks still in flight
+
+    ReadAhead(const ReadAhead &other) = delete;
+
+    ReadAhead &operator=(const ReadAhead &other) = delete;
+
+    /**
+     * The next block (freed by caller), or nullptr after the last.
+     */
+    virtual SlottedPage *next();
+
+protected:
+    HeapFile &file;
+    BlockIDs *block_ids;
+    uint depth;
+    size_t started;         // blocks asked for so far
+    std::deque<std::future<SlottedPage *>> in_flight;
+};
+
+/**
+ * @class BlockWriteLatch - holds a block of a HeapFile exclusively for its lifetime
+ */
+class BlockWriteLatch {
+public:
+    BlockWriteLatch(HeapFile &file, BlockID block_id) : file(file), block_id(block_id),
+            latched(file.latch_block(block_id)) {}
+
+    ~BlockWriteLatch() { file.unlatch_block(block_id, latched); }
+
+    BlockWriteLatch(const BlockWriteLatch &other) = delete;
+
+    BlockWriteLatch &operator=(const BlockWriteLatch &other) = delete;
+
+protected:
+    HeapFile &file;
+    BlockID block_id;
+    bool latched;
+};
+
+/**
+ * @class UncommittedReads - for its lifetime, this thread's HeapFile gets (and the BlockIO reads
+ * it starts) read blocks as they are, with no BerkeleyDB locks, even inside a -t transaction.
+ * Only for readers that go by row versions, which tell them what to make of uncommitted rows.
+ */
+class UncommittedReads {
+public:
+    explicit UncommittedReads(bool on = true) : saved(HeapFile::uncommitted_reads) { HeapFile::uncommitted_reads = on; }
+
+    ~UncommittedReads() { HeapFile::uncommitted_reads = saved; }
+
+    UncommittedReads(const UncommittedReads &other) = delete;
+
+    UncommittedReads &operator=(const UncommittedReads &other) = delete;
+
+    static bool active() { return HeapFile::uncommitted_reads; }
+
+private:
+    bool saved;
+};
+
+/**
+ * @class TextDictionary - codes for the values of a table's DICTIONARY-encoded TEXT columns
+ *
+ * One per table, shared by all its HeapTable handles (and all its dictionary columns).
+ * The values are kept in their own heap file, <table>_dict, one record per value in
+ * code order; the file is read on first use and only ever appended to. Values are
+ * added outside any open transaction, so a rollback can never take back a code that
+ * another session's rows already use.
+ */
+class TextDictionary {
+public:
+    static const u_int16_t NO_CODE = 0xFFFF;        // no code: the value is stored as is
+    static const u_int32_t MAX_VALUE_SZ = 255;      // longer values are never given a code
+
+    /**
+     * The dictionary for a table (never freed).
+     */
+    static TextDictionary *for_table(const Identifier &table_name);
+
+    /**
+     * The code for a value.
+     * @param add  give the value a new code if it has none yet (and there is room)
+     * @returns    the code, or NO_CODE
+     */
+    virtual u_int16_t encode(const std::string &value, bool add = false);
+
+    /**
+     * The value for a code.
+     * @throws DbRelationError  if there is no such code
+     */
+    virtual std::string decode(u_int16_t code);
+
+    /**
+     * Remove the dictionary's file (with its table).
+     */
+    virtual void drop();
+
+protected:
+    explicit TextDictionary(const Identifier &table_name) : file(table_name + "_dict"), loaded(false),
+            has_file(false) {}
+
+    virtual ~TextDictionary() {}
+
+    std::mutex mutex;       // guards everything below
+    HeapFile file;
+    bool loaded;
+    bool has_file;
+    std::vector<std::string> values;                        // indexed by code
+    std::unordered_map<std::string, u_int16_t> codes;
+
+    virtual void load();
+
+    virtual void append(const std::string &value);
+};
+
+/**
+ * @class BlockSummaries - a heap file of one record per full block of a HeapTable, summing up
+ * the block's rows so a where clause can rule the block out without reading it
+ *
+ * Each record starts with the u32 block id. A block's record is written when the table moves
+ * on to a new block, in the same transaction: no row is added to a block after that (its rows
+ * are only ever deleted, or replaced by versions in later blocks), so a record never misses a
+ * value in its block. The last block, and blocks filled before the summaries were started,
+ * have no record and are always read. The file itself is made outside any transaction (like a
+ * TextDictionary's): a rollback takes back the records, leaving at worst an empty file.
+ */
+class BlockSummaries {
+public:
+    explicit BlockSummaries(const std::string &file_name) : file(file_name) {}
+
+    virtual ~BlockSummaries() {}
+
+    BlockSummaries(const BlockSummaries &other) = delete;
+
+    BlockSummaries &operator=(const BlockSummaries &other) = delete;
+
+    /**
+     * Start with no records (replacing any left behind by an old table of the same name).
+     */
+    virtual void create();
+
+    /**
+     * Remove the file, if there is one.
+     */
+    virtual void drop();
+
+    /**
+     * Close the file, if it is open (it is opened again when next needed).
+     */
+    virtual void close() { this->file.close(); }
+
+protected:
+    HeapFile file;
+
+    // open the file if it is there
+    virtual bool open();
+
+    // add a record, making the file if need be (for a table from before it had one)
+    virtual void append(const char *bytes, u_int32_t size);
+
+    /**
+     * The blocks of block_ids that ruled_out (given a record) says cannot match are taken out.
+     */
+    virtual void skip(BlockIDs &block_ids, const std::function<bool(const char *record, u_int32_t size)> &ruled_out);
+};
+
+/**
+ * @class ZoneMap - the smallest and largest value of each INT column in each full block of a HeapTable
+ *
+ * Kept in <table>_zones, one record per block: u32 block id, then i32 min and i32 max for
+ * each INT column, in column order.
+ */
+class ZoneMap : public BlockSummaries {
+public:
+    ZoneMap(const Identifier &table_name, const ColumnAttributes &column_attributes);
+
+    virtual ~ZoneMap() {}
+
+    /**
+     * Does the table have any INT columns to keep zones for?
+     */
+    bool has_columns() const { return !columns.empty(); }
+
+    /**
+     * Positions of the INT columns among the table's columns, in order.
+     */
+    const std::vector<u_int32_t> &get_columns() const { return columns; }
+
+    /**
+     * Record a full block's zones.
+     * @param bounds  min then max of each INT column, in column order
+     */
+    virtual void put(BlockID block_id, const std::vector<int32_t> &bounds);
+
+    /**
+     * Take out of block_ids the blocks whose zones show they cannot match.
+     * @param terms  (column position, value) of each INT column a where clause asks for
+     */
+    virtual void prune(BlockIDs &block_ids, const std::vector<std::pair<u_int32_t, int32_t>> &terms);
+
+protected:
+    std::vector<u_int32_t> columns;
+};
+
+/**
+ * @class BloomFilter - a Bloom filter over a key of some columns for each full block of a HeapTable
+ *
+ * Kept in <table>_<index>_bloom, one record per block: u32 block id, then the filter's bits,
+ * BITS_PER_ROW for each row version in the block (up to MAX_BYTES), each key setting HASHES
+ * of them. A where clause asking for every key column rules out a block whose filter does not
+ * have all of its key's bits set, so a lookup of a key that is absent from most blocks reads
+ * few of them; about 1 block in 100 that lacks the key is read anyway.
+ */
+class BloomFilter : public BlockSummaries {
+public:
+    static const u_int32_t BITS_PER_ROW = 10;
+    static const u_int32_t HASHES = 7;
+    static const u_int32_t MAX_BYTES = 1024;
+
+    BloomFilter(const Identifier &table_name, const Identifier &index_name, const ColumnNames &column_names)
+            : BlockSummaries(table_name + "_" + index_name + "_bloom"), index_name(index_name), columns(column_names) {}
+
+    virtual ~BloomFilter() {}
+
+    const Identifier &get_index_name() const { return index_name; }
+
+    /**
+     * The key columns, in order.
+     */
+    const ColumnNames &get_columns() const { return columns; }
+
+    /**
+     * The key of a row (which has at least the key columns), as hashed.
+     */
+    virtual std::string key(const ValueDict &row) const;
+
+    /**
+     * Record a full block's filter.
+     * @param keys  the key of each row version in the block
+     */
+    virtual void put(BlockID block_id, const std::vector<std::string> &keys);
+
+    /**
+     * Take out of block_ids the blocks whose filters show they have no row with key.
+     */
+    virtual void prune(BlockIDs &block_ids, const std::string &key);
+
+protected:
+    Identifier index_name;
+    ColumnNames columns;
+
+    // the two hashes each of a key's bits is made from (double hashing)
+    static void hash(const std::string &key, u_int64_t &h1, u_int64_t &h2);
+};
+
+/**
+ * @class OverflowFile - the chains of OverflowPages holding a HeapTable's long TEXT values
+ *
+ * Kept in <table>_overflow, apart from the rows, so a long value never ends the table's
+ * current block early. Block 1 is an OverflowPage with no piece whose next is the first free
+ * block: a freed chain is linked in ahead of the others through its blocks' own next, and
+ * new chains take free blocks before the file grows. Freeing and taking free blocks hold
+ * block 1's latch. The file itself is made outside any transaction when it is first needed
+ * (like a TextDictionary's).
+ */
+class OverflowFile {
+public:
+    explicit OverflowFile(const Identifier &table_name, u_int32_t block_size = DbBlock::BLOCK_SZ)
+            : file(table_name + "_overflow", block_size) {}
+
+    virtual ~OverflowFile() {}
+
+    OverflowFile(const OverflowFile &other) = delete;
+
+    OverflowFile &operator=(const OverflowFile &other) = delete;
+
+    /**
+     * Write value into a new chain.
+     * @returns  the block holding its first piece
+     */
+    virtual BlockID put(const std::string &value);
+
+    /**
+     * Read a value back from its chain.
+     * @throws DbRelationError  if the chain does not hold size bytes
+     */
+    virtual std::string get(BlockID first, u_int32_t size);
+
+    /**
+     * Give back the blocks of a chain, whose row is gone, for new chains to take.
+     */
+    virtual void free(BlockID first);
+
+    /**
+     * Remove the file, if there is one.
+     */
+    virtual void drop();
+
+    /**
+     * Close the file, if it is open (it is opened again when next needed).
+     */
+    virtual void close();
+
+protected:
+    static const BlockID FREE_LIST = 1;
+
+    std::mutex open_mutex;  // so only one thread makes the file
+    HeapFile file;
+
+    // open the file if it is there, or make it if create
+    virtual bool open(bool create = false);
+
+    // a free block, or a new one if there is none (freed by caller)
+    virtual SlottedPage *allocate();
 };
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * Safe to use from several threads at once, each with its own HeapTable: writers
+ * latch just the blocks they change, and readers (select, project) take no latch
+ * unless a writer is in the block they are reading.
+ *
+ * TEXT columns whose attribute is DICTIONARY-encoded are stored as a u16 code into the
+ * table's TextDictionary, or as NO_CODE followed by the value itself when it has no code.
+ *
+ * Each row's values are followed by its RowVersion. Rows are never changed in place:
+ * del() stamps the row's xmax, and update() appends a new version of it and stamps the
+ * old one with its xmax and the new one's handle. select() and project() show only the
+ * versions their thread's snapshot sees (see VersionManager), reading blocks without
+ * BerkeleyDB locks, so a long scan neither waits for writers nor holds them up.
+ * vacuum() removes the versions nobody can see any more. Rows written before row
+ * versions have none (they are shorter than their values): everyone sees them, and
+ * deleting one removes it at once. So do changes made with no version writer running.
+ *
+ * When a block fills up, the range of each INT column in it goes in the table's ZoneMap, and
+ * the keys of its rows in each of the table's BloomFilters; select(where) does not read the
+ * blocks they show cannot hold the values asked for.
  */
 
 class HeapTable : public DbRelation {
 public:
-    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+    /**
+     * @param block_size  block size for create(); an existing table keeps the size it was created with
+     * @param compressed  whether create() uses compressed blocks (likewise kept by an existing table)
+     */
+    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+              u_int32_t block_size = DbBlock::BLOCK_SZ, bool compressed = false);
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable &other) = delete;
 
@@ -149,6 +919,17 @@ public:
 
     virtual void close();
 
+    /**
+     * Rewrite the table into compressed blocks (see HeapFile::compact). Handles stay valid.
+     */
+    virtual void compact();
+
+    /**
+     * Remove the row versions that no running or later snapshot can see.
+     * @returns  how many were removed
+     */
+    virtual u_int32_t vacuum();
+
     virtual Handle insert(const ValueDict *row);
 
     virtual void update(const Handle handle, const ValueDict *new_values);
@@ -159,20 +940,223 @@ public:
 
     virtual Handles *select(const ValueDict *where);
 
+    /**
+     * Start keeping a BloomFilter over the key columns for each block that fills up from now on.
+     * Caller makes sure nothing else is using the table.
+     * @param fresh  start it with no blocks (false when it already has them, e.g. for a table
+     *               loaded from the catalog); build_bloom_filter() then does the ones already full
+     */
+    virtual void add_bloom_filter(const Identifier &index_name, const ColumnNames &key_columns, bool fresh = true);
+
+    /**
+     * Fill in a new BloomFilter for the blocks that were already full, on several threads,
+     * while the table is read and changed as usual. Until then those blocks are always read.
+     */
+    virtual void build_bloom_filter(const Identifier &index_name);
+
+    /**
+     * Stop keeping a BloomFilter, and remove its file.
+     * Caller makes sure nothing else is using the table.
+     */
+    virtual void drop_bloom_filter(const Identifier &index_name);
+
+    /**
+     * The rows in a random sample of the table's blocks (all of them if it has no more than max_blocks).
+     * @param block_count  returned by reference: how many blocks the table has
+     * @returns            handles to the sampled rows (freed by caller)
+     */
+    virtual Handles *sample(u_int32_t max_blocks, u_int32_t &block_count);
+
+    /**
+     * How many blocks the table's file has (not counting its OverflowFile).
+     */
+    virtual u_int32_t get_block_count();
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    /**
+     * Fill in the zone map and BloomFilters (or just the given filters) for every block that
+     * is full now, on several threads, while the table is read and changed as usual.
+     */
+    virtual void summarize(const std::vector<BloomFilter *> *filters = nullptr);
+
+    /**
+     * Fewest blocks for each extra thread scan_in_parallel() uses.
+     */
+    static const u_int32_t PARALLEL_MIN_BLOCKS = 64;
+
 protected:
     HeapFile file;
+    OverflowFile overflow;
+    TextDictionary *dictionary;     // nullptr unless some column is DICTIONARY-encoded
+    ZoneMap zones;
+    std::vector<BloomFilter *> bloom_filters;
+
+    friend class HeapRewrite;
+
+    /**
+     * Threads to scan n_blocks blocks on: one without a free-threaded environment or inside
+     * a transaction (the other threads' reads, not in it, could wait on its locks), as for
+     * HashAggregate::add_all.
+     */
+    static size_t scan_threads(size_t n_blocks);
+
+    /**
+     * Read each of block_ids (with get) and hand it to work along with which of
+     * n_threads threads it is on; each thread takes a run of the blocks, in order.
+     */
+    virtual void scan_in_parallel(const BlockIDs &block_ids, size_t n_threads,
+                                  const std::function<void(size_t thread, SlottedPage *block)> &work);
 
     virtual ValueDict *validate(const ValueDict *row);
 
     virtual Handle append(const ValueDict *row);
 
+    /**
+     * Whether rows carry a RowVersion.
+     */
+    virtual bool versioned() { return true; }
+
+    /**
+     * Whether full blocks' INT column ranges are kept in a ZoneMap.
+     */
+    virtual bool zone_mapped() { return this->zones.has_columns(); }
+
+    // put a block that is full (the table has moved on to a new one) into the zone map and
+    // bloom_filters (just those given, if any)
+    virtual void seal(SlottedPage *block, const std::vector<BloomFilter *> *filters = nullptr);
+
+    virtual void forget_bloom_filter(const Identifier &index_name, bool remove_file);
+
+    // can the filter rule blocks out for where?
+    virtual bool keyed(const BloomFilter *bloom_filter, const ValueDict *where);
+
+    // bytes of a record's values; its RowVersion (if any) follows
+    virtual u_int32_t values_size(const char *bytes);
+
+    // where each overflow value's reference (u32 size, u32 first block) is in a record's bytes
+    virtual void overflow_references(const char *bytes, std::vector<u_int32_t> &offsets);
+
+    // the first block of each of a record's overflow chains
+    virtual std::vector<BlockID> overflow_chains(const Dbt *data);
+
+    // give back the overflow chains of a record that has been taken out of its block
+    virtual void free_overflow(const std::vector<BlockID> &chains);
+
+    // free_overflow for chains left behind by a row that failed to go in; never throws
+    virtual void drop_overflow(const std::vector<BlockID> &chains);
+
+    // the record's RowVersion; false if it has none
+    virtual bool get_version(const Dbt *data, RowVersion &version);
+
+    virtual bool visible(SlottedPage *block, RecordID record_id, const Snapshot &snapshot);
+
+    // move handle (and block) along the row's versions to the one snapshot sees
+    virtual void locate(Handle &handle, const Snapshot &snapshot, SlottedPage *&block);
+
+    virtual ValueDict *project_visible(Handle &handle, const ColumnNames *column_names);
+
+    // stamp the row version at handle as deleted (or replaced by the one at next) by this thread
+    virtual void expire(Handle handle, Handle next = Handle(0, 0));
+
+    // take a record out of its block at once
+    virtual void remove(Handle handle);
+
+    virtual ValueDict *project(SlottedPage *block, Handle handle, const ColumnNames *column_names = nullptr,
+                               bool decode = true);
+
+    virtual bool selected(SlottedPage *block, Handle handle, const ValueDict *where);
+
     virtual Dbt *marshal(const ValueDict *row);
 
-    virtual ValueDict *unmarshal(Dbt *data);
+    /**
+     * @param decode  false to leave DICTIONARY-encoded values as their codes, as INT values
+     */
+    virtual ValueDict *unmarshal(Dbt *data, const ColumnNames *column_names = nullptr, bool decode = true);
+
+    /**
+     * A copy of where with the values of DICTIONARY columns replaced by their codes,
+     * so that selected() compares integers rather than strings.
+     */
+    virtual ValueDict *encode_where(const ValueDict *where);
+
+    /**
+     * TEXT values longer than this are kept in the OverflowFile, with only a reference in the row.
+     */
+    virtual u_int32_t overflow_threshold() { return this->file.get_block_size() / 16; }
+};
+
+/**
+ * @class HeapRewrite - VACUUM FULL of a HeapTable: a new file of just the row versions
+ * someone may still see, packed into as few blocks as they fit in, swapped in under the
+ * table's name. Handles from before the swap no longer find their rows.
+ *
+ * The work is split so the table can be read and changed as usual for nearly all of it:
+ *     copy()    reads the blocks there are now on several threads, each packing what it keeps
+ *               into new blocks of its own, while the file notes the blocks changed meanwhile
+ *     finish()  copies again what was changed or added during copy(), points replaced
+ *               versions at their replacements' new places, and swaps the new file in; the
+ *               caller makes sure nobody else is using the table for this (brief) part
+ * The new blocks start with no zone map or BloomFilter records (so they are always read)
+ * until HeapTable::summarize() fills them in, again alongside everyone else.
+ * A copy refers to the same overflow chains as its record; once the new file is swapped in,
+ * the chains of the versions left behind are freed (those removed meanwhile were freed by
+ * whoever removed them). A rewrite that is not finished removes its file.
+ */
+class HeapRewrite {
+public:
+    explicit HeapRewrite(HeapTable &table);
+
+    virtual ~HeapRewrite();
+
+    HeapRewrite(const HeapRewrite &other) = delete;
+
+    HeapRewrite &operator=(const HeapRewrite &other) = delete;
+
+    virtual void copy();
+
+    virtual void finish();
+
+    /**
+     * The table was dropped since copy(): leave it be, and just remove the copy.
+     */
+    virtual void abandon() { this->abandoned = true; }
+
+protected:
+    HeapTable &table;
+    HeapFile target;
+    VersionID horizon;                  // versions deleted before this are left behind
+    BlockID copied_to;                  // copy() read blocks 1 to this
+    std::map<Handle, Handle> moved;     // where each kept version went
+    std::set<Handle> replaced;          // new places of the kept versions that point at a replacement
+    std::map<Handle, std::vector<BlockID>> left;    // the overflow chains of the versions left behind
+    bool started;
+    bool finished;
+    bool abandoned;
+
+    // is there anyone who may still see the record?
+    virtual bool keep(const Dbt *data);
+
+    // does the record's version point at a replacement?
+    virtual bool has_replacement(const Dbt *data);
+
+    // add a copy of the record to page (or to a new block of target, if it is full or there
+    // is none yet); returns where it went
+    virtual Handle add(SlottedPage *&page, const Dbt *data);
+
+    // write out page, if any
+    virtual void put(SlottedPage *&page);
+
+    // bring the copies of a block's records (and left) up to date with it
+    virtual void recopy(SlottedPage *block, SlottedPage *&page);
+
+    // remove a copy whose record is gone (or no longer kept); returns the next in moved
+    virtual std::map<Handle, Handle>::iterator drop_copy(std::map<Handle, Handle>::iterator copied);
+
+    // give a copy the record's stamps
+    virtual void restamp(Handle copy, const Dbt *data);
 };
 
 bool test_heap_storage();
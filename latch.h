@@ -0,0 +1,77 @@
+/**
+ * @file latch.h - Reader/writer latches for in-memory structures shared between threads.
+ * RWLatch
+ * SharedLatch
+ * ExclusiveLatch
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <pthread.h>
+
+/**
+ * @class RWLatch - a reader/writer latch (many readers or one writer)
+ *
+ * Latches protect in-memory state for short critical sections; they are not
+ * transactional locks (BerkeleyDB's lock manager provides those).
+ */
+class RWLatch {
+public:
+    RWLatch() { pthread_rwlock_init(&rwlock, nullptr); }
+
+    virtual ~RWLatch() { pthread_rwlock_destroy(&rwlock); }
+
+    RWLatch(const RWLatch &other) = delete;
+
+    RWLatch(RWLatch &&temp) = delete;
+
+    RWLatch &operator=(const RWLatch &other) = delete;
+
+    RWLatch &operator=(RWLatch &&temp) = delete;
+
+    void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+
+    void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+
+    void lock() { pthread_rwlock_wrlock(&rwlock); }
+
+    void unlock() { pthread_rwlock_unlock(&rwlock); }
+
+protected:
+    pthread_rwlock_t rwlock;
+};
+
+/**
+ * @class SharedLatch - holds an RWLatch in shared (reader) mode for its lifetime
+ */
+class SharedLatch {
+public:
+    explicit SharedLatch(RWLatch &latch) : latch(latch) { latch.lock_shared(); }
+
+    ~SharedLatch() { latch.unlock_shared(); }
+
+    SharedLatch(const SharedLatch &other) = delete;
+
+    SharedLatch &operator=(const SharedLatch &other) = delete;
+
+protected:
+    RWLatch &latch;
+};
+
+/**
+ * @class ExclusiveLatch - holds an RWLatch in exclusive (writer) mode for its lifetime
+ */
+class ExclusiveLatch {
+public:
+    explicit ExclusiveLatch(RWLatch &latch) : latch(latch) { latch.lock(); }
+
+    ~ExclusiveLatch() { latch.unlock(); }
+
+    ExclusiveLatch(const ExclusiveLatch &other) = delete;
+
+    ExclusiveLatch &operator=(const ExclusiveLatch &other) = delete;
+
+protected:
+    RWLatch &latch;
+};
@@ -0,0 +1,120 @@
+/**
+ * @file mvcc.cpp - implementation of RowVersion, VersionManager
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "mvcc.h"
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+/**
+ * RowVersion implementation
+ */
+const u_int32_t RowVersion::SIZE;
+
+void RowVersion::unpack(const char *bytes) {
+    std::memcpy(&this->xmin, bytes, sizeof(u_int32_t));
+    std::memcpy(&this->xmax, bytes + 4, sizeof(u_int32_t));
+    std::memcpy(&this->next.first, bytes + 8, sizeof(u_int32_t));
+    std::memcpy(&this->next.second, bytes + 12, sizeof(u_int16_t));
+}
+
+void RowVersion::pack(char *bytes) const {
+    std::memcpy(bytes, &this->xmin, sizeof(u_int32_t));
+    std::memcpy(bytes + 4, &this->xmax, sizeof(u_int32_t));
+    std::memcpy(bytes + 8, &this->next.first, sizeof(u_int32_t));
+    std::memcpy(bytes + 12, &this->next.second, sizeof(u_int16_t));
+}
+
+/**
+ * VersionManager implementation
+ */
+const VersionID VersionManager::RESERVE;
+std::mutex VersionManager::mutex;
+std::string VersionManager::home;
+VersionID VersionManager::next_xid = 1;
+VersionID VersionManager::reserved = 0;
+std::map<VersionID, VersionID> VersionManager::running;
+thread_local const Snapshot *VersionManager::snapshot = nullptr;
+
+void VersionManager::open(const std::string &home) {
+    std::lock_guard<std::mutex> lock(mutex);
+    VersionManager::home = home;
+    VersionID limit = 0;
+    int fd = ::open((home + "/versions").c_str(), O_RDONLY);
+    if (fd >= 0) {
+        if (::read(fd, &limit, sizeof(limit)) != sizeof(limit))
+            limit = 0;
+        ::close(fd);
+    }
+    next_xid = std::max<VersionID>(limit, 1);
+    reserve(next_xid + RESERVE);
+}
+
+// caller holds mutex
+void VersionManager::reserve(VersionID limit) {
+    if (!home.empty()) {
+        std::string path = home + "/versions";
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("cannot write " + path);
+        bool ok = ::pwrite(fd, &limit, sizeof(limit), 0) == sizeof(limit) && fdatasync(fd) == 0;
+        ::close(fd);
+        if (!ok)
+            throw std::runtime_error("cannot write " + path);
+    }
+    reserved = limit;
+}
+
+bool VersionManager::begin() {
+    if (snapshot != nullptr)
+        return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (next_xid >= reserved)
+        reserve(next_xid + RESERVE);
+    VersionID xid = next_xid++;
+    Snapshot *taken = new Snapshot(take(xid));
+    running[xid] = taken->xmin;
+    snapshot = taken;
+    return true;
+}
+
+void VersionManager::end() {
+    if (snapshot == nullptr)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running.erase(snapshot->xid);
+    }
+    delete snapshot;
+    snapshot = nullptr;
+}
+
+Snapshot VersionManager::latest() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return take(0);
+}
+
+// caller holds mutex
+Snapshot VersionManager::take(VersionID xid) {
+    Snapshot taken;
+    taken.xid = xid;
+    taken.xmax = next_xid;
+    for (auto const &writer : running)
+        if (writer.first != xid)
+            taken.active.push_back(writer.first); // the map keeps them in order
+    taken.xmin = xid != 0 ? xid : next_xid;
+    if (!taken.active.empty())
+        taken.xmin = std::min(taken.xmin, taken.active.front());
+    return taken;
+}
+
+VersionID VersionManager::horizon() {
+    std::lock_guard<std::mutex> lock(mutex);
+    VersionID oldest = next_xid;
+    for (auto const &writer : running)
+        oldest = std::min(oldest, writer.second);
+    return oldest;
+}
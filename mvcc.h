@@ -0,0 +1,192 @@
+/**
+ * @file mvcc.h - Row versions and snapshots, so scans see one consistent state of a table.
+ * RowVersion
+ * Snapshot
+ * VersionManager
+ * SnapshotScope
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * Identifies a version writer: a statement, or a whole transaction with -t.
+ * 0 is no one: a row stamped 0 is visible to everyone, a row with xmax 0 has not been deleted.
+ */
+typedef u_int32_t VersionID;
+
+/**
+ * @class RowVersion - the stamps a HeapTable keeps after each row's values
+ *
+ * Bytes: u32 xmin (who wrote it), u32 xmax (who deleted or replaced it), then where
+ * the version that replaced it is, u32 block id and u16 record id (0 if none).
+ */
+class RowVersion {
+public:
+    static const u_int32_t SIZE = 14;
+
+    RowVersion() : xmin(0), xmax(0), next(0, 0) {}
+
+    explicit RowVersion(VersionID xmin) : xmin(xmin), xmax(0), next(0, 0) {}
+
+    VersionID xmin;
+    VersionID xmax;
+    Handle next;
+
+    void unpack(const char *bytes);
+
+    void pack(char *bytes) const;
+};
+
+/**
+ * @class Snapshot - which version writers' changes a reader sees: those finished when
+ * the snapshot was taken, and its own
+ */
+class Snapshot {
+public:
+    Snapshot() : xid(0), xmin(1), xmax(1), active() {}
+
+    /**
+     * Did this writer finish before the snapshot was taken (or is it the snapshot's own)?
+     */
+    bool sees(VersionID writer) const {
+        if (writer == 0 || writer == this->xid)
+            return true;
+        if (writer >= this->xmax)
+            return false;
+        if (writer < this->xmin)
+            return true;
+        return !std::binary_search(this->active.begin(), this->active.end(), writer);
+    }
+
+    /**
+     * Was the version written, and not yet deleted, as far as this snapshot can see?
+     */
+    bool visible(const RowVersion &version) const {
+        return sees(version.xmin) && (version.xmax == 0 || !sees(version.xmax));
+    }
+
+    VersionID get_xid() const { return xid; }
+
+protected:
+    VersionID xid;                  // its own writer, or 0 for a reader with none
+    VersionID xmin;                 // every writer before this had finished
+    VersionID xmax;                 // ... and none from here on had started
+    std::vector<VersionID> active;  // writers in between still running, in order
+
+    friend class VersionManager;
+};
+
+/**
+ * @class VersionManager - hands out version writer ids and snapshots
+ *
+ * Each SQL statement (or, with -t, each transaction) is a version writer with an id of
+ * its own and a snapshot taken when it began, kept for this thread until it ends. Ids go
+ * up, and a block of them is reserved in the file "versions" in the environment's home
+ * before they are used, so a restart never hands out an id already stamped on a row; any
+ * id from before the restart is taken as finished.
+ *
+ * A transaction that rolls back leaves no stamps: BerkeleyDB puts its blocks back before
+ * its id stops being active. So an id that is no longer active always finished.
+ */
+class VersionManager {
+public:
+    static const VersionID RESERVE = 4096;
+
+    /**
+     * Carry on from the ids reserved by the last run in home. Without it ids start at 1
+     * and nothing is kept.
+     */
+    static void open(const std::string &home);
+
+    /**
+     * Start a version writer for this thread, with its snapshot.
+     * @returns  false (and does nothing) if this thread already has one
+     */
+    static bool begin();
+
+    /**
+     * End this thread's version writer: its changes are seen by every later snapshot.
+     */
+    static void end();
+
+    /**
+     * This thread's snapshot, or nullptr if it has no version writer.
+     */
+    static const Snapshot *current() { return snapshot; }
+
+    /**
+     * A snapshot of what has finished by now, for a reader with no version writer.
+     */
+    static Snapshot latest();
+
+    /**
+     * Every writer before this had finished before any running writer's snapshot was taken,
+     * so a version they deleted cannot be seen by anyone any more.
+     */
+    static VersionID horizon();
+
+protected:
+    static std::mutex mutex;                        // guards everything below
+    static std::string home;                        // empty without open()
+    static VersionID next_xid;
+    static VersionID reserved;                      // ids below this are reserved in the file
+    static std::map<VersionID, VersionID> running;  // writer -> its snapshot's xmin
+
+    static thread_local const Snapshot *snapshot;
+
+    friend class SharedSnapshot;
+
+    static Snapshot take(VersionID xid);
+
+    static void reserve(VersionID limit);
+};
+
+/**
+ * @class SnapshotScope - for its lifetime this thread is a version writer (unless it
+ * already was, e.g. in a -t transaction), which ends with the outermost scope
+ */
+class SnapshotScope {
+public:
+    SnapshotScope() : outermost(VersionManager::begin()) {}
+
+    ~SnapshotScope() {
+        if (this->outermost)
+            VersionManager::end();
+    }
+
+    SnapshotScope(const SnapshotScope &other) = delete;
+
+    SnapshotScope &operator=(const SnapshotScope &other) = delete;
+
+private:
+    bool outermost;
+};
+
+/**
+ * @class SharedSnapshot - for its lifetime, this thread works as part of another thread's
+ * version writer (with its snapshot), e.g. a worker for a statement; the other thread's
+ * writer must outlast it
+ */
+class SharedSnapshot {
+public:
+    explicit SharedSnapshot(const Snapshot *snapshot) : saved(VersionManager::snapshot) {
+        VersionManager::snapshot = snapshot;
+    }
+
+    ~SharedSnapshot() { VersionManager::snapshot = saved; }
+
+    SharedSnapshot(const SharedSnapshot &other) = delete;
+
+    SharedSnapshot &operator=(const SharedSnapshot &other) = delete;
+
+private:
+    const Snapshot *saved;
+};
@@ -0,0 +1,375 @@
+/**
+ * @file redo_log.cpp - implementation of RedoLog, RedoCommit
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "redo_log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include "storage_stats.h"
+
+/*
+ * A segment is SEGMENT_MAGIC and the LSN of its first record, then the records:
+ *      u32 length of the whole record, u8 type, u64 LSN, u16 length of the file name,
+ *      the file name, the body, and a u32 FNV-1a checksum of everything before it.
+ * A BLOCK body is u32 block id, u32 block size, u32 start and end of the free space
+ * left out, then the bytes of the block before and after it. A DROP body is empty.
+ */
+static const char SEGMENT_MAGIC[8] = {'R', 'E', 'D', 'O', 'L', 'O', 'G', '1'};
+static const size_t SEGMENT_HEADER_SZ = sizeof(SEGMENT_MAGIC) + sizeof(u_int64_t);
+static const size_t RECORD_HEADER_SZ = sizeof(u_int32_t) + 1 + sizeof(u_int64_t) + sizeof(u_int16_t);
+static const size_t BLOCK_HEADER_SZ = 4 * sizeof(u_int32_t);
+
+static u_int32_t checksum(const char *bytes, size_t n) {
+    u_int32_t hash = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void write_all(int fd, const char *bytes, size_t n) {
+    while (n > 0) {
+        ssize_t written = ::write(fd, bytes, n);
+        if (written < 0)
+            throw std::runtime_error("cannot write the redo log");
+        bytes += written;
+        n -= written;
+    }
+}
+
+/**
+ * RedoLog implementation
+ */
+const u_int32_t RedoLog::DEFAULT_CHECKPOINT_SECS;
+const size_t RedoLog::BUFFER_SZ;
+bool RedoLog::is_enabled = false;
+std::string RedoLog::home;
+std::mutex RedoLog::mutex;
+std::condition_variable RedoLog::flushed;
+int RedoLog::fd = -1;
+u_int32_t RedoLog::segment = 0;
+std::vector<char> RedoLog::buffer;
+u_int64_t RedoLog::next_lsn = 1;
+u_int64_t RedoLog::written_lsn = 1;
+u_int64_t RedoLog::durable_lsn = 1;
+bool RedoLog::flushing = false;
+std::mutex RedoLog::checkpoint_mutex;
+RWLatch RedoLog::writes;
+
+void RedoLog::open(const std::string &home, u_int32_t checkpoint_secs) {
+    RedoLog::home = home;
+    recover();
+    is_enabled = true;
+    if (checkpoint_secs > 0)
+        std::thread(run_checkpointer, checkpoint_secs).detach();
+}
+
+std::string RedoLog::segment_path(u_int32_t n) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "redo.%010u.log", n);
+    return home + "/" + name;
+}
+
+std::vector<u_int32_t> RedoLog::segments() {
+    std::vector<u_int32_t> found;
+    DIR *dir = opendir(home.c_str());
+    if (dir == nullptr)
+        throw std::runtime_error("cannot read " + home);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        u_int32_t n;
+        char rest;
+        if (std::sscanf(entry->d_name, "redo.%10u.lo%c", &n, &rest) == 2 && rest == 'g')
+            found.push_back(n);
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+// the new segment (and its directory entry) is on disk before any record goes in it
+void RedoLog::start_segment(u_int32_t n, u_int64_t start_lsn) {
+    std::string path = segment_path(n);
+    int new_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (new_fd < 0)
+        throw std::runtime_error("cannot create " + path);
+    char header[SEGMENT_HEADER_SZ];
+    std::memcpy(header, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    std::memcpy(header + sizeof(SEGMENT_MAGIC), &start_lsn, sizeof(start_lsn));
+    write_all(new_fd, header, sizeof(header));
+    fdatasync(new_fd);
+    int dir_fd = ::open(home.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    fd = new_fd;
+    segment = n;
+}
+
+void RedoLog::write_buffer() {
+    if (!buffer.empty())
+        write_all(fd, buffer.data(), buffer.size());
+    buffer.clear();
+    written_lsn = next_lsn;
+}
+
+void RedoLog::append(RecordType type, const std::string &file_name,
+                     const std::vector<std::pair<const char *, size_t>> &body) {
+    size_t length = RECORD_HEADER_SZ + file_name.size() + sizeof(u_int32_t);
+    for (auto const &piece : body)
+        length += piece.second;
+    size_t start = buffer.size();
+    buffer.resize(start + length);
+    char *record = buffer.data() + start;
+    u_int32_t record_length = (u_int32_t) length;
+    u_int8_t record_type = (u_int8_t) type;
+    u_int16_t name_length = (u_int16_t) file_name.size();
+    char *at = record;
+    std::memcpy(at, &record_length, sizeof(record_length));
+    at += sizeof(record_length);
+    std::memcpy(at, &record_type, sizeof(record_type));
+    at += sizeof(record_type);
+    std::memcpy(at, &next_lsn, sizeof(next_lsn));
+    at += sizeof(next_lsn);
+    std::memcpy(at, &name_length, sizeof(name_length));
+    at += sizeof(name_length);
+    std::memcpy(at, file_name.data(), file_name.size());
+    at += file_name.size();
+    for (auto const &piece : body) {
+        std::memcpy(at, piece.first, piece.second);
+        at += piece.second;
+    }
+    u_int32_t sum = checksum(record, length - sizeof(u_int32_t));
+    std::memcpy(at, &sum, sizeof(sum));
+    next_lsn += length;
+    StorageStats::add(LOG_RECORDS);
+    StorageStats::add(LOG_BYTES, length);
+    if (buffer.size() >= BUFFER_SZ)
+        write_buffer();
+}
+
+void RedoLog::log_block(const std::string &file_name, SlottedPage *page, u_int32_t block_size) {
+    u_int32_t hole_start, hole_end;
+    page->get_free_region(hole_start, hole_end);
+    std::lock_guard<std::mutex> lock(mutex);
+    page->set_lsn(next_lsn); // before the image is copied, so the logged block has it too
+    u_int32_t block_header[4] = {page->get_block_id(), block_size, hole_start, hole_end};
+    const char *bytes = static_cast<const char*>(page->get_data());
+    append(BLOCK, file_name, {{(const char*) block_header, sizeof(block_header)},
+                              {bytes, hole_start},
+                              {bytes + hole_end, block_size - hole_end}});
+}
+
+void RedoLog::log_drop(const std::string &file_name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    append(DROP, file_name, {});
+}
+
+// Either some leader's flush covers our records, or we lead the next one.
+void RedoLog::commit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    u_int64_t target = next_lsn;
+    while (durable_lsn < target) {
+        if (flushing) {
+            flushed.wait(lock);
+            continue;
+        }
+        flushing = true;
+        int ret;
+        u_int64_t upto;
+        try {
+            write_buffer();
+            upto = written_lsn;
+            int flushing_fd = fd;
+            lock.unlock();
+            ret = fdatasync(flushing_fd);
+            lock.lock();
+        } catch (...) {
+            flushing = false;
+            flushed.notify_all();
+            throw;
+        }
+        flushing = false;
+        flushed.notify_all();
+        if (ret != 0)
+            throw std::runtime_error("cannot flush the redo log");
+        durable_lsn = std::max(durable_lsn, upto);
+        StorageStats::add(LOG_FLUSHES);
+    }
+}
+
+// Once BerkeleyDB has written out its cache, every block logged before the new segment
+// began is in its file, so the older segments are no longer needed.
+// Blocks logged but not yet handed to BerkeleyDB (RedoWrite) are waited for first.
+void RedoLog::checkpoint() {
+    std::lock_guard<std::mutex> one_at_a_time(checkpoint_mutex);
+    std::vector<u_int32_t> old;
+    {
+        ExclusiveLatch no_writes(writes);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (flushing)
+            flushed.wait(lock);
+        write_buffer();
+        if (fdatasync(fd) != 0)
+            throw std::runtime_error("cannot flush the redo log");
+        durable_lsn = written_lsn; // commits waiting on these records may count on them now
+        ::close(fd);
+        old = segments();
+        start_segment(segment + 1, next_lsn);
+    }
+    _DB_ENV->memp_sync(nullptr);
+    for (auto n : old)
+        if (n < segment)
+            std::remove(segment_path(n).c_str());
+    StorageStats::add(CHECKPOINTS);
+}
+
+void RedoLog::run_checkpointer(u_int32_t checkpoint_secs) {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(checkpoint_secs));
+        try {
+            checkpoint();
+        } catch (std::exception &e) {
+            std::cerr << "checkpoint failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+u_int64_t RedoLog::scan(std::function<void(RecordType type, u_int64_t lsn, const std::string &file_name,
+                                           const char *body, size_t size)> record) {
+    u_int64_t end_lsn = 1;
+    for (auto n : segments()) {
+        std::ifstream in(segment_path(n), std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (bytes.size() < SEGMENT_HEADER_SZ || std::memcmp(bytes.data(), SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)
+            return end_lsn;
+        std::memcpy(&end_lsn, bytes.data() + sizeof(SEGMENT_MAGIC), sizeof(end_lsn));
+        size_t at = SEGMENT_HEADER_SZ;
+        while (at + RECORD_HEADER_SZ <= bytes.size()) {
+            const char *start = bytes.data() + at;
+            u_int32_t length;
+            u_int8_t type;
+            u_int64_t lsn;
+            u_int16_t name_length;
+            std::memcpy(&length, start, sizeof(length));
+            std::memcpy(&type, start + 4, sizeof(type));
+            std::memcpy(&lsn, start + 5, sizeof(lsn));
+            std::memcpy(&name_length, start + 13, sizeof(name_length));
+            if (length < RECORD_HEADER_SZ + name_length + sizeof(u_int32_t) || at + length > bytes.size())
+                return end_lsn; // torn at the end of the log
+            u_int32_t sum;
+            std::memcpy(&sum, start + length - sizeof(u_int32_t), sizeof(sum));
+            if (sum != checksum(start, length - sizeof(u_int32_t)) || lsn != end_lsn)
+                return end_lsn;
+            std::string file_name(start + RECORD_HEADER_SZ, name_length);
+            const char *body = start + RECORD_HEADER_SZ + name_length;
+            record((RecordType) type, lsn, file_name, body, length - RECORD_HEADER_SZ - name_length - sizeof(u_int32_t));
+            end_lsn = lsn + length;
+            at += length;
+        }
+    }
+    return end_lsn;
+}
+
+// Blocks of a file are only redone after the last time a file of that name was dropped.
+void RedoLog::recover() {
+    std::map<std::string, u_int64_t> dropped;
+    u_int64_t end_lsn = scan([&](RecordType type, u_int64_t lsn, const std::string &file_name, const char *, size_t) {
+        if (type == DROP)
+            dropped[file_name] = lsn;
+    });
+
+    std::map<std::string, HeapFile*> files;     // nullptr for one that is gone
+    u_int64_t redone = 0;
+    scan([&](RecordType type, u_int64_t lsn, const std::string &file_name, const char *body, size_t size) {
+        if (type != BLOCK || size < BLOCK_HEADER_SZ || (dropped.count(file_name) && lsn < dropped[file_name]))
+            return;
+        u_int32_t block_header[4];
+        std::memcpy(block_header, body, sizeof(block_header));
+        u_int32_t block_id = block_header[0], block_size = block_header[1];
+        u_int32_t hole_start = block_header[2], hole_end = block_header[3];
+        if (hole_start > hole_end || hole_end > block_size || size != BLOCK_HEADER_SZ + block_size - (hole_end - hole_start))
+            return;
+        if (files.count(file_name) == 0) {
+            HeapFile *file = new HeapFile(file_name);
+            try {
+                file->open();
+            } catch (DbException &e) {
+                delete file;
+                file = nullptr;
+            }
+            files[file_name] = file;
+        }
+        HeapFile *file = files[file_name];
+        if (file == nullptr || file->get_block_size() != block_size)
+            return;
+        std::vector<char> image(block_size, 0);
+        std::memcpy(image.data(), body + BLOCK_HEADER_SZ, hole_start);
+        std::memcpy(image.data() + hole_end, body + BLOCK_HEADER_SZ + hole_start, block_size - hole_end);
+        if (file->redo(block_id, image.data(), lsn))
+            redone++;
+    });
+    for (auto const &file : files)
+        delete file.second; // closes it
+    if (redone > 0)
+        std::cerr << "redo log: recovered " << redone << " blocks" << std::endl;
+
+    // start afresh after the log, with everything it had in the files
+    std::vector<u_int32_t> old = segments();
+    next_lsn = written_lsn = durable_lsn = end_lsn;
+    _DB_ENV->memp_sync(nullptr);
+    start_segment(old.empty() ? 1 : old.back() + 1, next_lsn);
+    for (auto n : old)
+        std::remove(segment_path(n).c_str());
+}
+
+/**
+ * RedoWrite implementation
+ */
+RedoWrite::RedoWrite(bool logged, const std::string &file_name, SlottedPage *page, u_int32_t block_size)
+        : logged(logged && RedoLog::enabled()) {
+    if (!this->logged)
+        return;
+    RedoLog::writes.lock_shared();
+    try {
+        RedoLog::log_block(file_name, page, block_size);
+    } catch (...) {
+        RedoLog::writes.unlock_shared();
+        throw;
+    }
+}
+
+RedoWrite::~RedoWrite() {
+    if (this->logged)
+        RedoLog::writes.unlock_shared();
+}
+
+/**
+ * RedoCommit implementation
+ */
+thread_local u_int32_t RedoCommit::depth = 0;
+
+RedoCommit::~RedoCommit() {
+    depth--;
+    if (this->outermost && RedoLog::enabled()) {
+        try {
+            RedoLog::commit();
+        } catch (std::exception &e) {
+            std::cerr << "redo log: " << e.what() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,162 @@
+/**
+ * @file redo_log.h - Redo log of heap file blocks, for crash recovery without BerkeleyDB transactions.
+ * RedoLog
+ * RedoCommit
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+#include "latch.h"
+
+/**
+ * @class RedoLog - write-ahead log of every block a HeapFile writes
+ *
+ * Without -t, BerkeleyDB keeps our writes in its cache and writes them to the files
+ * whenever it likes, so a crash can lose some blocks of a statement and keep others.
+ * With the redo log on, each block is logged (its image, less its free space) before it
+ * goes to BerkeleyDB, stamped with the record's LSN. A statement's records are flushed to
+ * disk when it ends (RedoCommit), together with any other sessions' that are waiting.
+ *
+ * The log is kept in segments, redo.<n>.log in the environment's home. Every so often
+ * the checkpointer starts a new segment, has BerkeleyDB write out its cache, and removes
+ * the older segments. At startup, recovery rewrites each logged block that is newer than
+ * the block in the file (by LSN), then checkpoints.
+ *
+ * Dropping a table is logged too, so the blocks of a table that was dropped are never
+ * written into a new table of the same name.
+ *
+ * This is redo only. Nothing stops BerkeleyDB from writing a block to its file before the
+ * block's record is on disk, so a crash can still keep blocks of a statement that had not
+ * ended (and that recovery then has no record to finish). What the log promises is that a
+ * statement that did end is never lost, not that one that did not leaves no trace.
+ */
+class RedoLog {
+public:
+    static const u_int32_t DEFAULT_CHECKPOINT_SECS = 30;
+    static const size_t BUFFER_SZ = 1024 * 1024;    // bytes of records held before they are written
+
+    /**
+     * Recover from the log in home, then start logging (and the checkpointer).
+     * Call once, after _DB_ENV is open and before anything else uses it.
+     * @param checkpoint_secs  seconds between checkpoints
+     */
+    static void open(const std::string &home, u_int32_t checkpoint_secs = DEFAULT_CHECKPOINT_SECS);
+
+    static bool enabled() { return is_enabled; }
+
+    /**
+     * Log a block about to be written to a file, and stamp the record's LSN on it.
+     * @param file_name  the HeapFile's name
+     */
+    static void log_block(const std::string &file_name, SlottedPage *page, u_int32_t block_size);
+
+    /**
+     * Log that a file was removed (before it is).
+     */
+    static void log_drop(const std::string &file_name);
+
+    /**
+     * Wait until everything logged so far is on disk.
+     */
+    static void commit();
+
+    /**
+     * Write out every block logged so far and throw away the log segments that held them.
+     */
+    static void checkpoint();
+
+protected:
+    enum RecordType {
+        BLOCK = 1, DROP = 2
+    };
+
+    static bool is_enabled;
+    static std::string home;
+
+    static std::mutex mutex;                    // guards everything below
+    static std::condition_variable flushed;
+    static int fd;                              // the segment being appended to
+    static u_int32_t segment;                   // its number
+    static std::vector<char> buffer;            // records not yet written to it
+    static u_int64_t next_lsn;                  // LSN of the next record: bytes logged since the log began
+    static u_int64_t written_lsn;               // records before this are written to the segment
+    static u_int64_t durable_lsn;               // ... and on disk
+    static bool flushing;
+
+    static std::mutex checkpoint_mutex;         // one checkpoint at a time
+    static RWLatch writes;                      // shared from logging a block until BerkeleyDB has it,
+                                                // exclusive while a checkpoint starts a new segment
+
+    static std::string segment_path(u_int32_t n);
+
+    // segment numbers in home, in order
+    static std::vector<u_int32_t> segments();
+
+    static void start_segment(u_int32_t n, u_int64_t start_lsn);
+
+    // write the buffer to the segment; caller holds mutex
+    static void write_buffer();
+
+    // add a record (its body in pieces) to the buffer; caller holds mutex
+    static void append(RecordType type, const std::string &file_name,
+                       const std::vector<std::pair<const char *, size_t>> &body);
+
+    // each valid record of the log, in order, until the first torn or missing one
+    // @returns  the LSN after the last one
+    static u_int64_t scan(std::function<void(RecordType type, u_int64_t lsn, const std::string &file_name,
+                                             const char *body, size_t size)> record);
+
+    static void recover();
+
+    static void run_checkpointer(u_int32_t checkpoint_secs);
+
+    friend class RedoWrite;
+};
+
+/**
+ * @class RedoWrite - logs a block and keeps checkpoints from starting until the block has
+ * been handed to BerkeleyDB (its lifetime), so a checkpoint never drops the segment holding
+ * a record whose block is not yet in the cache it writes out
+ */
+class RedoWrite {
+public:
+    /**
+     * @param logged  false when the file is not logged (or the log is off): then nothing is done
+     */
+    RedoWrite(bool logged, const std::string &file_name, SlottedPage *page, u_int32_t block_size);
+
+    ~RedoWrite();
+
+    RedoWrite(const RedoWrite &other) = delete;
+
+    RedoWrite &operator=(const RedoWrite &other) = delete;
+
+private:
+    bool logged;
+};
+
+/**
+ * @class RedoCommit - statements run in its lifetime are made durable together when
+ * the outermost RedoCommit on this thread ends
+ */
+class RedoCommit {
+public:
+    RedoCommit() : outermost(depth++ == 0) {}
+
+    ~RedoCommit();
+
+    RedoCommit(const RedoCommit &other) = delete;
+
+    RedoCommit &operator=(const RedoCommit &other) = delete;
+
+private:
+    static thread_local u_int32_t depth;
+    bool outermost;
+};
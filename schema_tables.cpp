@@ -0,0 +1,535 @@
+/**
+ * @file schema_tables.cpp - implementation of the system catalog: Tables, Columns, Indices, Statistics, Storage
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "schema_tables.h"
+#include <algorithm>
+#include <cstdint>
+
+// the catalog describes itself: it gets rows for each of its own tables it doesn't have yet
+// (all of them when it is new, the ones added since when it is older than this code)
+static void describe(Tables &tables, Columns &columns, const Identifier &table_name, const ColumnNames &column_names,
+                     const ColumnAttributes &column_attributes) {
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    Handles *handles = tables.select(&row);
+    bool described = !handles->empty();
+    delete handles;
+    if (described)
+        return;
+    tables.insert(&row);
+    for (uint i = 0; i < column_names.size(); i++) {
+        row = Columns::row(table_name, column_names[i], column_attributes[i]);
+        columns.insert(&row);
+    }
+}
+
+void initialize_schema_tables() {
+    Tables tables;
+    tables.create_if_not_exists();
+    Columns columns;
+    columns.create_if_not_exists();
+    Indices indices;
+    indices.create_if_not_exists();
+    Statistics statistics;
+    statistics.create_if_not_exists();
+    Storage storage;
+    storage.create_if_not_exists();
+    describe(tables, columns, Tables::TABLE_NAME, Tables::COLUMN_NAMES(), Tables::COLUMN_ATTRIBUTES());
+    describe(tables, columns, Columns::TABLE_NAME, Columns::COLUMN_NAMES(), Columns::COLUMN_ATTRIBUTES());
+    describe(tables, columns, Indices::TABLE_NAME, Indices::COLUMN_NAMES(), Indices::COLUMN_ATTRIBUTES());
+    describe(tables, columns, Statistics::TABLE_NAME, Statistics::COLUMN_NAMES(), Statistics::COLUMN_ATTRIBUTES());
+    describe(tables, columns, Storage::TABLE_NAME, Storage::COLUMN_NAMES(), Storage::COLUMN_ATTRIBUTES());
+}
+
+// the catalog tables the cache reads a table's definition from, each opened once for the
+// process (like SQLExec's) rather than once for every table
+static Columns &catalog_columns() {
+    static Columns *columns = new Columns();
+    return *columns;
+}
+
+static Storage &catalog_storage() {
+    static Storage *storage = new Storage();
+    return *storage;
+}
+
+static Indices &catalog_indices() {
+    static Indices *indices = new Indices();
+    return *indices;
+}
+
+/**
+ * Columns implementation
+ */
+const Identifier Columns::TABLE_NAME = "_columns";
+
+ColumnNames &Columns::COLUMN_NAMES() {
+    static ColumnNames names = {"table_name", "column_name", "data_type", "encoding"};
+    return names;
+}
+
+ColumnAttributes &Columns::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes attributes(4, ColumnAttribute(ColumnAttribute::TEXT));
+    return attributes;
+}
+
+Columns::Columns() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+ValueDict Columns::row(const Identifier &table_name, const Identifier &column_name, ColumnAttribute attribute) {
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    row["column_name"] = Value(column_name);
+    row["data_type"] = Value(attribute.get_data_type() == ColumnAttribute::INT ? "INT" : "TEXT");
+    row["encoding"] = Value(attribute.get_encoding() == ColumnAttribute::DICTIONARY ? "DICTIONARY" : "PLAIN");
+    return row;
+}
+
+ColumnAttribute Columns::attribute(const ValueDict &row) {
+    return ColumnAttribute(row.at("data_type").s == "INT" ? ColumnAttribute::INT : ColumnAttribute::TEXT,
+                           row.at("encoding").s == "DICTIONARY" ? ColumnAttribute::DICTIONARY : ColumnAttribute::PLAIN);
+}
+
+Handle Columns::insert(const ValueDict *row) {
+    std::string data_type = row->at("data_type").s;
+    if (data_type != "INT" && data_type != "TEXT")
+        throw DbRelationError("unrecognized data type " + data_type);
+    ValueDict::const_iterator encoding = row->find("encoding");
+    if (encoding != row->end() && encoding->second.s != "PLAIN" && encoding->second.s != "DICTIONARY")
+        throw DbRelationError("unrecognized encoding " + encoding->second.s);
+
+    ValueDict where;
+    where["table_name"] = row->at("table_name");
+    where["column_name"] = row->at("column_name");
+    Handles *handles = this->select(&where);
+    bool duplicate = !handles->empty();
+    delete handles;
+    if (duplicate)
+        throw DbRelationError("duplicate column " + where["table_name"].s + "." + where["column_name"].s);
+
+    if (encoding == row->end()) {
+        ValueDict full_row(*row);
+        full_row["encoding"] = Value("PLAIN");
+        return HeapTable::insert(&full_row);
+    }
+    return HeapTable::insert(row);
+}
+
+/**
+ * Tables implementation
+ */
+const Identifier Tables::TABLE_NAME = "_tables";
+const size_t Tables::DEFAULT_MAX_OPEN_TABLES;
+size_t Tables::max_open_tables = Tables::DEFAULT_MAX_OPEN_TABLES;
+std::mutex Tables::cache_mutex;
+std::unordered_map<Identifier, Tables::CachedTable> Tables::table_cache;
+std::list<Identifier> Tables::open_tables;
+std::unordered_map<DbRelation *, u_int32_t> Tables::dropped_tables;
+
+ColumnNames &Tables::COLUMN_NAMES() {
+    static ColumnNames names = {"table_name"};
+    return names;
+}
+
+ColumnAttributes &Tables::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes attributes(1, ColumnAttribute(ColumnAttribute::TEXT));
+    return attributes;
+}
+
+Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+bool Tables::is_schema_table(const Identifier &table_name) {
+    return table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME || table_name == Indices::TABLE_NAME
+           || table_name == Statistics::TABLE_NAME || table_name == Storage::TABLE_NAME;
+}
+
+Handle Tables::insert(const ValueDict *row) {
+    Handles *handles = this->select(row);
+    bool duplicate = !handles->empty();
+    delete handles;
+    if (duplicate)
+        throw DbRelationError(row->at("table_name").s + " already exists");
+    return HeapTable::insert(row);
+}
+
+void Tables::del(const Handle handle) {
+    ValueDict *row = this->project(handle);
+    Identifier table_name = row->at("table_name").s;
+    delete row;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        forget(table_name);
+    }
+    HeapTable::del(handle);
+}
+
+void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
+    Columns &columns = catalog_columns();
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = columns.select(&where);
+    for (auto const &handle : *handles) {
+        ValueDict *row = columns.project(handle);
+        column_names.push_back(row->at("column_name").s);
+        column_attributes.push_back(Columns::attribute(*row));
+        delete row;
+    }
+    delete handles;
+}
+
+DbRelation &Tables::get_table(Identifier table_name) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto cached = table_cache.find(table_name);
+    if (cached == table_cache.end()) {
+        ColumnNames column_names;
+        ColumnAttributes column_attributes;
+        this->get_columns(table_name, column_names, column_attributes);
+        if (column_names.empty())
+            throw DbRelationError("unknown table " + table_name);
+        make_table(table_name, column_names, column_attributes, catalog_storage().get(table_name));
+        cached = table_cache.find(table_name);
+    }
+    touch(table_name, cached->second);
+    close_idle();
+    return *cached->second.table;
+}
+
+bool Tables::is_current(const Identifier &table_name, const DbRelation *table) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto cached = table_cache.find(table_name);
+    return cached != table_cache.end() && cached->second.table == table;
+}
+
+ColumnNames *Tables::get_table_names() {
+    ColumnNames *names = new ColumnNames();
+    Handles *handles = this->select();
+    for (auto const &handle : *handles) {
+        ValueDict *row = this->project(handle);
+        Identifier table_name = row->at("table_name").s;
+        delete row;
+        if (!is_schema_table(table_name))
+            names->push_back(table_name);
+    }
+    delete handles;
+    return names;
+}
+
+DbRelation *Tables::make_table(const Identifier &table_name, const ColumnNames &column_names,
+                               const ColumnAttributes &column_attributes, const std::string &storage_type) {
+    DbRelation *table;
+    if (storage_type == Storage::HEAP) {
+        HeapTable *heap_table = new HeapTable(table_name, column_names, column_attributes);
+        if (!is_schema_table(table_name)) {
+            std::map<Identifier, ColumnNames> *bloom_filters = nullptr;
+            try {
+                bloom_filters = catalog_indices().get_bloom_filters(table_name);
+                for (auto const &bloom_filter : *bloom_filters)
+                    heap_table->add_bloom_filter(bloom_filter.first, bloom_filter.second, false);
+            } catch (...) {
+                delete bloom_filters;
+                delete heap_table;
+                throw;
+            }
+            delete bloom_filters;
+        }
+        table = heap_table;
+    } else if (storage_type == Storage::COLUMN)
+        table = new ColumnTable(table_name, column_names, column_attributes);
+    else
+        throw DbRelationError("unknown storage type " + storage_type + " for " + table_name);
+    table_cache[table_name].table = table;
+    return table;
+}
+
+void Tables::touch(const Identifier &table_name, CachedTable &cached) {
+    TablesInUse *in_use = TablesInUse::current;
+    std::pair<Identifier, DbRelation *> used(table_name, cached.table);
+    if (in_use != nullptr && std::find(in_use->used.begin(), in_use->used.end(), used) == in_use->used.end()) {
+        in_use->used.push_back(used);
+        cached.users++;
+    }
+    if (cached.listed)
+        open_tables.erase(cached.position);
+    open_tables.push_front(table_name);
+    cached.position = open_tables.begin();
+    cached.listed = true;
+}
+
+// a table closed here is opened again by whatever next uses it
+void Tables::close_idle() {
+    auto position = open_tables.end();
+    while (open_tables.size() > max_open_tables && position != open_tables.begin()) {
+        position--;
+        CachedTable &cached = table_cache.at(*position);
+        if (cached.users > 0)
+            continue;
+        position = open_tables.erase(position);
+        cached.listed = false;
+        cached.table->close();
+    }
+}
+
+void Tables::forget(const Identifier &table_name) {
+    auto cached = table_cache.find(table_name);
+    if (cached == table_cache.end())
+        return;
+    if (cached->second.listed)
+        open_tables.erase(cached->second.position);
+    if (cached->second.users > 0)
+        dropped_tables[cached->second.table] = cached->second.users;
+    else
+        delete cached->second.table;
+    table_cache.erase(cached);
+}
+
+/**
+ * TablesInUse implementation
+ */
+thread_local TablesInUse *TablesInUse::current = nullptr;
+
+TablesInUse::TablesInUse() : outer(current == nullptr), used() {
+    if (this->outer)
+        current = this;
+}
+
+// a table dropped meanwhile is no longer in the cache, but waits in dropped_tables for its
+// last user
+TablesInUse::~TablesInUse() {
+    if (!this->outer)
+        return;
+    current = nullptr;
+    std::lock_guard<std::mutex> lock(Tables::cache_mutex);
+    for (auto const &used : this->used) {
+        auto cached = Tables::table_cache.find(used.first);
+        if (cached != Tables::table_cache.end() && cached->second.table == used.second) {
+            if (cached->second.users > 0)
+                cached->second.users--;
+            continue;
+        }
+        auto dropped = Tables::dropped_tables.find(used.second);
+        if (dropped != Tables::dropped_tables.end() && --dropped->second == 0) {
+            delete dropped->first;
+            Tables::dropped_tables.erase(dropped);
+        }
+    }
+    try {
+        Tables::close_idle();
+    } catch (...) {
+        // the next get_table will try again
+    }
+}
+
+/**
+ * Indices implementation
+ */
+const Identifier Indices::TABLE_NAME = "_indices";
+const std::string Indices::BLOOM = "BLOOM";
+
+ColumnNames &Indices::COLUMN_NAMES() {
+    static ColumnNames names = {"table_name", "index_name", "column_name", "seq_in_index", "index_type", "is_unique"};
+    return names;
+}
+
+ColumnAttributes &Indices::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes attributes = {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT)};
+    return attributes;
+}
+
+Indices::Indices() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+ColumnNames *Indices::get_index_names(Identifier table_name) {
+    ColumnNames *names = new ColumnNames();
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = this->select(&where);
+    ColumnNames index_name = {"index_name"};
+    for (auto const &handle : *handles) {
+        ValueDict *row = this->project(handle, &index_name);
+        Identifier name = row->at("index_name").s;
+        delete row;
+        if (std::find(names->begin(), names->end(), name) == names->end())
+            names->push_back(name);
+    }
+    delete handles;
+    return names;
+}
+
+ColumnNames *Indices::get_index_columns(Identifier table_name, Identifier index_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    where["index_name"] = Value(index_name);
+    Handles *handles = this->select(&where);
+    std::vector<std::pair<int32_t, Identifier>> columns;
+    for (auto const &handle : *handles) {
+        ValueDict *row = this->project(handle);
+        columns.push_back(std::make_pair(row->at("seq_in_index").n, row->at("column_name").s));
+        delete row;
+    }
+    delete handles;
+    std::sort(columns.begin(), columns.end());
+    ColumnNames *names = new ColumnNames();
+    for (auto const &column : columns)
+        names->push_back(column.second);
+    return names;
+}
+
+std::map<Identifier, ColumnNames> *Indices::get_bloom_filters(Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    where["index_type"] = Value(BLOOM);
+    Handles *handles = this->select(&where);
+    std::map<Identifier, std::vector<std::pair<int32_t, Identifier>>> columns;
+    for (auto const &handle : *handles) {
+        ValueDict *row = this->project(handle);
+        columns[row->at("index_name").s].push_back(std::make_pair(row->at("seq_in_index").n, row->at("column_name").s));
+        delete row;
+    }
+    delete handles;
+    std::map<Identifier, ColumnNames> *bloom_filters = new std::map<Identifier, ColumnNames>();
+    for (auto &index : columns) {
+        std::sort(index.second.begin(), index.second.end());
+        for (auto const &column : index.second)
+            (*bloom_filters)[index.first].push_back(column.second);
+    }
+    return bloom_filters;
+}
+
+/**
+ * Statistics implementation
+ */
+const Identifier Statistics::TABLE_NAME = "_statistics";
+std::mutex Statistics::cache_mutex;
+std::unordered_map<Identifier, TableStatistics *> Statistics::stats_cache;
+
+ColumnNames &Statistics::COLUMN_NAMES() {
+    static ColumnNames names = {"table_name", "column_name", "row_count", "block_count", "n_distinct", "histogram"};
+    return names;
+}
+
+ColumnAttributes &Statistics::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes attributes = {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    return attributes;
+}
+
+Statistics::Statistics() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+void Statistics::put(const TableStatistics &stats) {
+    this->remove(stats.table_name);
+    for (auto const &column : stats.columns) {
+        ValueDict row;
+        row["table_name"] = Value(stats.table_name);
+        row["column_name"] = Value(column.column_name);
+        row["row_count"] = Value((int32_t) std::min<double>(stats.row_count, INT32_MAX));
+        row["block_count"] = Value((int32_t) stats.block_count);
+        row["n_distinct"] = Value((int32_t) std::min<double>(column.n_distinct, INT32_MAX));
+        row["histogram"] = Value(column.histogram.serialize());
+        this->insert(&row);
+    }
+}
+
+const TableStatistics *Statistics::get(const Identifier &table_name) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto cached = stats_cache.find(table_name);
+    if (cached != stats_cache.end())
+        return cached->second;
+
+    TableStatistics *stats = nullptr;
+    Tables tables;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    tables.get_columns(table_name, column_names, column_attributes);
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = this->select(&where);
+    for (auto const &handle : *handles) {
+        ValueDict *row = this->project(handle);
+        if (stats == nullptr)
+            stats = new TableStatistics(table_name, row->at("row_count").n, row->at("block_count").n);
+        Identifier column_name = row->at("column_name").s;
+        auto column = std::find(column_names.begin(), column_names.end(), column_name);
+        if (column != column_names.end()) {
+            ColumnAttribute::DataType data_type = column_attributes[column - column_names.begin()].get_data_type();
+            stats->columns.push_back(ColumnStatistics(column_name, data_type, row->at("n_distinct").n,
+                                                      Histogram::deserialize(row->at("histogram").s, data_type)));
+        }
+        delete row;
+    }
+    delete handles;
+    stats_cache[table_name] = stats;
+    return stats;
+}
+
+void Statistics::remove(const Identifier &table_name) {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto cached = stats_cache.find(table_name);
+        if (cached != stats_cache.end()) {
+            delete cached->second;
+            stats_cache.erase(cached);
+        }
+    }
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = this->select(&where);
+    for (auto const &handle : *handles)
+        this->del(handle);
+    delete handles;
+}
+
+/**
+ * Storage implementation
+ */
+const Identifier Storage::TABLE_NAME = "_storage";
+const std::string Storage::HEAP = "HEAP";
+const std::string Storage::COLUMN = "COLUMN";
+
+ColumnNames &Storage::COLUMN_NAMES() {
+    static ColumnNames names = {"table_name", "storage_type"};
+    return names;
+}
+
+ColumnAttributes &Storage::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes attributes(2, ColumnAttribute(ColumnAttribute::TEXT));
+    return attributes;
+}
+
+Storage::Storage() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {}
+
+Handle Storage::put(const Identifier &table_name, const std::string &storage_type) {
+    if (storage_type == HEAP)
+        return Handle(0, 0);
+    if (storage_type != COLUMN)
+        throw DbRelationError("unknown storage type " + storage_type);
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    row["storage_type"] = Value(storage_type);
+    return this->insert(&row);
+}
+
+std::string Storage::get(const Identifier &table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = this->select(&where);
+    std::string storage_type = HEAP;
+    for (auto const &handle : *handles) {
+        ValueDict *row = this->project(handle);
+        storage_type = row->at("storage_type").s;
+        delete row;
+    }
+    delete handles;
+    return storage_type;
+}
+
+void Storage::remove(const Identifier &table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = this->select(&where);
+    for (auto const &handle : *handles)
+        this->del(handle);
+    delete handles;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file schema_tables.h - The system catalog: the schema of every table, kept in tables of its own.
+ * Tables
+ * TablesInUse
+ * Columns
+ * Indices
+ * Statistics
+ * Storage
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "column_storage.h"
+#include "heap_storage.h"
+#include "statistics.h"
+
+/**
+ * Create the catalog tables (and their rows in the catalog) if they don't exist yet. Other
+ * tables' schemas are read when first used (see Tables::get_table). Call once, after
+ * _DB_ENV is open.
+ */
+void initialize_schema_tables();
+
+/**
+ * @class Columns - the _columns catalog table: one row per column of every table
+ *
+ * (table_name TEXT, column_name TEXT, data_type TEXT, encoding TEXT)
+ */
+class Columns : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    Columns();
+
+    virtual ~Columns() {}
+
+    /**
+     * Checks that the data type and encoding are ones we know and that the
+     * table doesn't already have the column.
+     */
+    virtual Handle insert(const ValueDict *row);
+
+    /**
+     * The catalog row for a column.
+     */
+    static ValueDict row(const Identifier &table_name, const Identifier &column_name, ColumnAttribute attribute);
+
+    /**
+     * The attribute described by a catalog row.
+     */
+    static ColumnAttribute attribute(const ValueDict &row);
+
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+};
+
+/**
+ * @class Tables - the _tables catalog table: one row per table (including the catalog's own)
+ *
+ * (table_name TEXT)
+ *
+ * Also keeps a DbRelation for every table, made from the catalog the first time get_table()
+ * asks for it (so starting up reads none of them) and a lookup from then on. Each opens its
+ * files when first used; once more than max_open_tables are open, the least recently used
+ * ones no statement is using (see TablesInUse) are closed, to be opened again if used again.
+ */
+class Tables : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    Tables();
+
+    virtual ~Tables() {}
+
+    virtual Handle insert(const ValueDict *row);
+
+    /**
+     * Also forgets the table's cached DbRelation.
+     */
+    virtual void del(const Handle handle);
+
+    /**
+     * The column names and attributes of a table, from _columns.
+     */
+    virtual void get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes);
+
+    /**
+     * The DbRelation for a table (owned by the cache), kept open while this thread's
+     * TablesInUse is in scope.
+     * @throws DbRelationError  if there is no such table
+     */
+    virtual DbRelation &get_table(Identifier table_name);
+
+    /**
+     * Is table (got from get_table by this thread's TablesInUse) still the one named
+     * table_name, i.e. not dropped since? While in use it is not deleted, so a table made
+     * since under the same name cannot be at the same address.
+     */
+    static bool is_current(const Identifier &table_name, const DbRelation *table);
+
+    /**
+     * The names of every table (not including the catalog's own).
+     */
+    virtual ColumnNames *get_table_names();
+
+    /**
+     * Is this one of the catalog's own tables?
+     */
+    static bool is_schema_table(const Identifier &table_name);
+
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+
+    static const size_t DEFAULT_MAX_OPEN_TABLES = 256;
+    static size_t max_open_tables;              // tables kept open when no statement is using them
+
+protected:
+    class CachedTable {
+    public:
+        CachedTable() : table(nullptr), users(0), listed(false), position() {}
+
+        DbRelation *table;
+        u_int32_t users;                        // TablesInUse scopes that got it
+        bool listed;                            // in open_tables (it may be open)
+        std::list<Identifier>::iterator position;
+    };
+
+    static std::mutex cache_mutex;              // guards the four below
+    static std::unordered_map<Identifier, CachedTable> table_cache;
+    static std::list<Identifier> open_tables;   // the ones that may be open, most recently used first
+    static std::unordered_map<DbRelation *, u_int32_t> dropped_tables;  // forgotten while in use, and by
+                                                                        // how many: deleted after the last
+
+    // the rest are for callers holding cache_mutex
+
+    static DbRelation *make_table(const Identifier &table_name, const ColumnNames &column_names,
+                                  const ColumnAttributes &column_attributes, const std::string &storage_type);
+
+    // note that the table was just used (by this thread's TablesInUse, if any)
+    static void touch(const Identifier &table_name, CachedTable &cached);
+
+    // close the least recently used tables, down to max_open_tables, that no statement is using
+    static void close_idle();
+
+    // drop the table from the cache; it is deleted now, or once no statement is using it
+    static void forget(const Identifier &table_name);
+
+    friend class TablesInUse;
+};
+
+/**
+ * @class TablesInUse - while in scope, the tables this thread gets from Tables::get_table stay open
+ *
+ * One is held around each statement SQLExec runs; an inner one (e.g. for EXPLAIN ANALYZE)
+ * leaves it to the outer one.
+ */
+class TablesInUse {
+public:
+    TablesInUse();
+
+    virtual ~TablesInUse();
+
+    TablesInUse(const TablesInUse &other) = delete;
+
+    TablesInUse &operator=(const TablesInUse &other) = delete;
+
+protected:
+    bool outer;
+    std::vector<std::pair<Identifier, DbRelation *>> used;
+
+    static thread_local TablesInUse *current;
+
+    friend class Tables;
+};
+
+/**
+ * @class Indices - the _indices catalog table: one row per column of every index
+ *
+ * (table_name TEXT, index_name TEXT, column_name TEXT, seq_in_index INT, index_type TEXT, is_unique INT)
+ */
+class Indices : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+    static const std::string BLOOM;   // index_type of a per-block BloomFilter rather than an index proper
+
+    Indices();
+
+    virtual ~Indices() {}
+
+    /**
+     * The names of a table's indices.
+     */
+    virtual ColumnNames *get_index_names(Identifier table_name);
+
+    /**
+     * The key columns of an index, in order.
+     */
+    virtual ColumnNames *get_index_columns(Identifier table_name, Identifier index_name);
+
+    /**
+     * The key columns of each of a table's BLOOM indices (see BloomFilter), by index name.
+     * @returns  freed by caller
+     */
+    virtual std::map<Identifier, ColumnNames> *get_bloom_filters(Identifier table_name);
+
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+};
+
+/**
+ * @class Statistics - the _statistics catalog table: what ANALYZE found, one row per column of each analyzed table
+ *
+ * (table_name TEXT, column_name TEXT, row_count INT, block_count INT, n_distinct INT, histogram TEXT)
+ *
+ * Like Tables, keeps what it has read in a cache.
+ */
+class Statistics : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+
+    Statistics();
+
+    virtual ~Statistics() {}
+
+    /**
+     * Replace a table's statistics.
+     */
+    virtual void put(const TableStatistics &stats);
+
+    /**
+     * A table's statistics (owned by the cache), or nullptr if it has never been analyzed.
+     */
+    virtual const TableStatistics *get(const Identifier &table_name);
+
+    /**
+     * Forget a table's statistics.
+     */
+    virtual void remove(const Identifier &table_name);
+
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+
+protected:
+    static std::mutex cache_mutex;
+    static std::unordered_map<Identifier, TableStatistics *> stats_cache;  // nullptr: known not analyzed
+};
+
+/**
+ * @class Storage - the _storage catalog table: how each table that is not a HeapTable is stored
+ *
+ * (table_name TEXT, storage_type TEXT)
+ *
+ * A table with no row here is a HeapTable.
+ */
+class Storage : public HeapTable {
+public:
+    static const Identifier TABLE_NAME;
+    static const std::string HEAP;      // HeapTable
+    static const std::string COLUMN;    // ColumnTable
+
+    Storage();
+
+    virtual ~Storage() {}
+
+    /**
+     * Record how a table is stored (nothing is recorded for HEAP).
+     * @returns  the new row's handle, or Handle(0, 0) if none was added
+     */
+    virtual Handle put(const Identifier &table_name, const std::string &storage_type);
+
+    /**
+     * How a table is stored.
+     */
+    virtual std::string get(const Identifier &table_name);
+
+    /**
+     * Forget how a table is stored.
+     */
+    virtual void remove(const Identifier &table_name);
+
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+};
@@ -0,0 +1,203 @@
+/**
+ * @file server.cpp - implementation of SQLServer
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "server.h"
+#include <cctype>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+static int stop_pipe[2] = {-1, -1};   // the handler writes a byte to wake the accept loop
+
+// whichever thread the signal lands on, the accept loop sees it
+static void request_stop(int) {
+    int saved_errno = errno;
+    stop_requested = 1;
+    if (stop_pipe[1] >= 0 && ::write(stop_pipe[1], "", 1) < 0) {
+        // the pipe is full, so the loop has already been woken
+    }
+    errno = saved_errno;
+}
+
+// write all of buf, retrying short writes
+static bool send_all(int fd, const std::string &buf) {
+    size_t sent = 0;
+    while (sent < buf.length()) {
+        ssize_t n = ::send(fd, buf.data() + sent, buf.length() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+SQLServer::SQLServer(std::string address, unsigned n_workers, SessionHandler handler, SessionCloser closer)
+        : address(address), n_workers(n_workers > 0 ? n_workers : 1), handler(handler), closer(closer), listen_fd(-1),
+          stopping(false) {}
+
+SQLServer::~SQLServer() {
+    if (listen_fd >= 0)
+        ::close(listen_fd);
+}
+
+void SQLServer::run() {
+    this->listen();
+    if (::pipe(stop_pipe) != 0)
+        throw std::runtime_error(std::string("cannot make a pipe: ") + std::strerror(errno));
+    for (int end : stop_pipe)
+        ::fcntl(end, F_SETFL, ::fcntl(end, F_GETFL) | O_NONBLOCK);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    // the workers never take the signals (they would only interrupt a session's recv)
+    sigset_t stop_signals, previous;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+    for (unsigned i = 0; i < this->n_workers; i++)
+        this->workers.push_back(std::thread(&SQLServer::work, this));
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+    struct pollfd fds[2];
+    fds[0].fd = this->listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_pipe[0];
+    fds[1].events = POLLIN;
+    while (!stop_requested) {
+        if (::poll(fds, 2, -1) < 0 || !(fds[0].revents & POLLIN))
+            continue;  // EINTR, or woken by the stop pipe
+        int fd = ::accept(this->listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;  // a client that went away
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending.push_back(fd);
+        this->ready.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        for (int fd : this->pending)
+            ::close(fd);
+        this->pending.clear();
+        for (int fd : this->active)
+            ::shutdown(fd, SHUT_RDWR);  // unblocks the worker's recv
+        this->ready.notify_all();
+    }
+    for (std::thread &worker : this->workers)
+        worker.join();
+    this->workers.clear();
+    ::close(this->listen_fd);
+    this->listen_fd = -1;
+    for (int &end : stop_pipe) {
+        ::close(end);
+        end = -1;
+    }
+    if (this->address.find_first_not_of("0123456789") != std::string::npos)
+        ::unlink(this->address.c_str());
+}
+
+void SQLServer::listen() {
+    bool tcp = !this->address.empty() && this->address.find_first_not_of("0123456789") == std::string::npos;
+    if (tcp) {
+        this->listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(this->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t) std::stoi(this->address));
+        if (::bind(this->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+            throw std::runtime_error("cannot bind port " + this->address + ": " + std::strerror(errno));
+    } else {
+        struct sockaddr_un addr;
+        if (this->address.length() >= sizeof(addr.sun_path))
+            throw std::runtime_error("socket path too long: " + this->address);
+        this->listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, this->address.c_str());
+        ::unlink(this->address.c_str());
+        if (::bind(this->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+            throw std::runtime_error("cannot bind " + this->address + ": " + std::strerror(errno));
+    }
+    if (::listen(this->listen_fd, SOMAXCONN) != 0)
+        throw std::runtime_error(std::string("cannot listen: ") + std::strerror(errno));
+}
+
+// worker thread: take the next connection and serve it to completion
+void SQLServer::work() {
+    while (true) {
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            while (!this->stopping && this->pending.empty())
+                this->ready.wait(lock);
+            if (this->stopping)
+                return;
+            fd = this->pending.front();
+            this->pending.pop_front();
+            this->active.insert(fd);
+        }
+        this->serve(fd);
+        if (this->closer)
+            this->closer();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->active.erase(fd);
+        }
+        ::close(fd);
+    }
+}
+
+// one client session: run each line through the handler and send back its output
+void SQLServer::serve(int fd) {
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+        size_t newline;
+        while ((newline = buffer.find('\n')) != std::string::npos) {
+            std::string line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            if (!line.empty() && line[line.length() - 1] == '\r')
+                line.erase(line.length() - 1);
+            std::ostringstream out;
+            bool keep_going;
+            try {
+                keep_going = this->handler(line, out);
+            } catch (std::exception &e) {
+                out << "Error: " << e.what() << std::endl;
+                keep_going = true;
+            }
+            if (!send_all(fd, out.str()) || !keep_going)
+                return;
+        }
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buffer.append(chunk, n);
+    }
+}
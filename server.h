@@ -0,0 +1,83 @@
+/**
+ * @file server.h - Multi-client front end for the SQL shell.
+ * SQLServer
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs one line of client input, writing the response to out.
+ * @returns false to close the client's session
+ */
+typedef std::function<bool(const std::string &line, std::ostream &out)> SessionHandler;
+
+/**
+ * Cleans up after a session ends (on the worker thread that ran it).
+ */
+typedef std::function<void()> SessionCloser;
+
+/**
+ * @class SQLServer - listens on a local socket and serves sessions from a thread pool
+ *
+ * Clients send one command per line (same as the interactive shell) and get
+ * the output back on the same connection. Each accepted connection is queued
+ * for the pool; a worker runs the whole session, so per-thread state such as
+ * the open transaction belongs to the session. More clients than workers wait
+ * in the queue.
+ */
+class SQLServer {
+public:
+    /**
+     * @param address    a TCP port on the loopback interface (all digits) or a Unix socket path
+     * @param n_workers  size of the thread pool
+     * @param handler    runs each line of client input
+     * @param closer     called when a session ends, however it ends
+     */
+    SQLServer(std::string address, unsigned n_workers, SessionHandler handler, SessionCloser closer = nullptr);
+
+    virtual ~SQLServer();
+
+    SQLServer(const SQLServer &other) = delete;
+
+    SQLServer(SQLServer &&temp) = delete;
+
+    SQLServer &operator=(const SQLServer &other) = delete;
+
+    SQLServer &operator=(SQLServer &&temp) = delete;
+
+    /**
+     * Accept and serve clients until SIGINT or SIGTERM.
+     * @throws std::runtime_error if the socket can't be opened
+     */
+    virtual void run();
+
+protected:
+    std::string address;
+    unsigned n_workers;
+    SessionHandler handler;
+    SessionCloser closer;
+    int listen_fd;
+    bool stopping;
+    std::vector<std::thread> workers;
+    std::deque<int> pending;        // accepted connections waiting for a worker
+    std::set<int> active;           // connections being served
+    std::mutex mutex;               // guards stopping, pending and active
+    std::condition_variable ready;
+
+    virtual void listen();
+
+    virtual void work();
+
+    virtual void serve(int fd);
+};
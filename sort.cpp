@@ -0,0 +1,263 @@
+/**
+ * @file sort.cpp - implementation of sorting: SpillTable, ExternalSort
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "sort.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+/**
+ * SpillTable implementation
+ */
+std::atomic<u_int32_t> SpillTable::next_id(0);
+
+// unique among this process's spill tables, and the pid keeps two processes sharing an environment apart
+Identifier SpillTable::unique_name() {
+    return "_spill_" + std::to_string(getpid()) + "_" + std::to_string(next_id++);
+}
+
+// spill tables hold decoded rows, so their columns are all plainly encoded
+static ColumnAttributes plain(const ColumnAttributes &column_attributes) {
+    ColumnAttributes attributes;
+    for (auto attribute : column_attributes)
+        attributes.push_back(ColumnAttribute(attribute.get_data_type()));
+    return attributes;
+}
+
+SpillTable::SpillTable(const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : HeapTable(unique_name(), column_names, plain(column_attributes)), blocks(nullptr), block(nullptr),
+          at(0) {
+    OutsideTransaction outside;
+    this->file.set_logged(false); // of no use after a crash
+    this->create();
+}
+
+SpillTable::~SpillTable() {
+    delete this->block;
+    delete this->blocks;
+}
+
+void SpillTable::write(const ValueDict *row) {
+    OutsideTransaction outside;
+    this->insert(row);
+}
+
+ValueDict *SpillTable::next() {
+    OutsideTransaction outside;
+    if (this->blocks == nullptr)
+        this->blocks = new ReadAhead(this->file, this->file.block_ids());
+    RecordID record_id = this->block == nullptr ? 0 : this->block->next_id(this->at);
+    while (record_id == 0) {
+        delete this->block;
+        this->block = this->blocks->next();
+        if (this->block == nullptr)
+            return nullptr;
+        record_id = this->block->next_id(0);
+    }
+    this->at = record_id;
+    Handle handle(this->block->get_block_id(), record_id);
+    return this->project(this->block, handle);
+}
+
+void SpillTable::drop() {
+    OutsideTransaction outside;
+    delete this->blocks; // its reads must be done before the file goes
+    this->blocks = nullptr;
+    HeapTable::drop();
+}
+
+/**
+ * ExternalSort implementation
+ */
+const size_t ExternalSort::DEFAULT_MEMORY_BUDGET;
+const size_t ExternalSort::MAX_MERGE_WIDTH;
+size_t ExternalSort::memory_budget = ExternalSort::DEFAULT_MEMORY_BUDGET;
+
+ExternalSort::ExternalSort(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                           const SortKeys &keys, size_t limit, size_t budget)
+        : column_names(column_names), column_attributes(column_attributes), keys(keys), limit(limit), budget(budget),
+          rows(), bytes(0), sequence(0), runs(), spilled_runs(0), merging(false), merge_heap(), memory_at(0),
+          returned(0) {}
+
+ExternalSort::~ExternalSort() {
+    for (auto const &entry : this->rows)
+        delete entry.first;
+    for (auto const &entry : this->merge_heap)
+        delete entry.first;
+    for (auto run : this->runs) {
+        try {
+            run->drop();
+        } catch (...) {
+            // a leftover temporary file is no reason to fail the statement
+        }
+        delete run;
+    }
+}
+
+// a rough count of what a decoded row costs in memory
+size_t ExternalSort::row_bytes(const ValueDict *row) {
+    size_t bytes = sizeof(ValueDict);
+    for (auto const &column : *row)
+        bytes += 64 + column.first.size() + column.second.s.size();
+    return bytes;
+}
+
+bool ExternalSort::before(const ValueDict *a, const ValueDict *b) const {
+    for (auto const &key : this->keys) {
+        const Value &x = a->at(key.column_name), &y = b->at(key.column_name);
+        bool less, greater;
+        if (x.data_type == ColumnAttribute::INT) {
+            less = x.n < y.n;
+            greater = y.n < x.n;
+        } else {
+            less = x.s < y.s;
+            greater = y.s < x.s;
+        }
+        if (less || greater)
+            return key.ascending ? less : greater;
+    }
+    return false;
+}
+
+bool ExternalSort::entry_before(const Entry &a, const Entry &b) const {
+    if (this->before(a.first, b.first))
+        return true;
+    if (this->before(b.first, a.first))
+        return false;
+    return a.second < b.second;
+}
+
+void ExternalSort::add(ValueDict *row) {
+    if (this->merging)
+        throw std::logic_error("ExternalSort::add after next");
+    Entry entry(row, this->sequence++);
+    auto after = [this](const Entry &a, const Entry &b) { return this->entry_before(a, b); };
+
+    // top-N: a max-heap of the limit rows that come first so far
+    if (this->limit > 0 && this->rows.size() == this->limit) {
+        if (!this->entry_before(entry, this->rows.front())) {
+            delete row;
+            return;
+        }
+        std::pop_heap(this->rows.begin(), this->rows.end(), after);
+        this->bytes -= row_bytes(this->rows.back().first);
+        delete this->rows.back().first;
+        this->rows.back() = entry;
+        std::push_heap(this->rows.begin(), this->rows.end(), after);
+        this->bytes += row_bytes(row);
+    } else {
+        this->rows.push_back(entry);
+        if (this->limit > 0)
+            std::push_heap(this->rows.begin(), this->rows.end(), after);
+        this->bytes += row_bytes(row);
+    }
+    if (this->bytes > this->budget)
+        this->spill();
+}
+
+// runs are written in input order, so earlier runs hold earlier rows and merging
+// can break ties by run number
+void ExternalSort::spill() {
+    std::sort(this->rows.begin(), this->rows.end(),
+              [this](const Entry &a, const Entry &b) { return this->entry_before(a, b); });
+    SpillTable *run = new SpillTable(this->column_names, this->column_attributes);
+    this->runs.push_back(run);
+    this->spilled_runs++;
+    for (auto &entry : this->rows) {
+        run->write(entry.first);
+        delete entry.first;
+        entry.first = nullptr;
+    }
+    this->rows.clear();
+    this->bytes = 0;
+}
+
+ExternalSort::Entry ExternalSort::next_from(size_t source) {
+    if (source < this->runs.size())
+        return Entry(this->runs[source]->next(), source);
+    if (this->memory_at < this->rows.size()) {
+        ValueDict *row = this->rows[this->memory_at].first;
+        this->rows[this->memory_at++].first = nullptr;
+        return Entry(row, source);
+    }
+    return Entry(nullptr, source);
+}
+
+void ExternalSort::merge_runs(size_t first, size_t count) {
+    SpillTable *merged = new SpillTable(this->column_names, this->column_attributes);
+    std::vector<SpillTable *> inputs(this->runs.begin() + first, this->runs.begin() + first + count);
+    auto later = [this](const Entry &a, const Entry &b) { return this->entry_before(b, a); };
+    std::vector<Entry> heap;
+    try {
+        for (size_t i = 0; i < count; i++) {
+            ValueDict *row = inputs[i]->next();
+            if (row != nullptr)
+                heap.push_back(Entry(row, i));
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Entry entry = heap.back();
+            heap.pop_back();
+            merged->write(entry.first);
+            delete entry.first;
+            ValueDict *row = inputs[entry.second]->next();
+            if (row != nullptr) {
+                heap.push_back(Entry(row, entry.second));
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+        }
+    } catch (...) {
+        for (auto const &entry : heap)
+            delete entry.first;
+        merged->drop();
+        delete merged;
+        throw;
+    }
+    for (auto run : inputs) {
+        run->drop();
+        delete run;
+    }
+    this->runs.erase(this->runs.begin() + first + 1, this->runs.begin() + first + count);
+    this->runs[first] = merged;
+}
+
+// with too many runs to merge at once, merge them in groups first: the earliest runs,
+// so the merged run keeps their place in the order
+void ExternalSort::start_merge() {
+    this->merging = true;
+    std::sort(this->rows.begin(), this->rows.end(),
+              [this](const Entry &a, const Entry &b) { return this->entry_before(a, b); });
+    while (this->runs.size() + 1 > MAX_MERGE_WIDTH)
+        this->merge_runs(0, std::min(MAX_MERGE_WIDTH, this->runs.size()));
+
+    auto later = [this](const Entry &a, const Entry &b) { return this->entry_before(b, a); };
+    for (size_t source = 0; source <= this->runs.size(); source++) {
+        Entry entry = this->next_from(source);
+        if (entry.first != nullptr)
+            this->merge_heap.push_back(entry);
+    }
+    std::make_heap(this->merge_heap.begin(), this->merge_heap.end(), later);
+}
+
+ValueDict *ExternalSort::next() {
+    if (!this->merging)
+        this->start_merge();
+    if (this->merge_heap.empty() || (this->limit > 0 && this->returned == this->limit))
+        return nullptr;
+
+    auto later = [this](const Entry &a, const Entry &b) { return this->entry_before(b, a); };
+    std::pop_heap(this->merge_heap.begin(), this->merge_heap.end(), later);
+    Entry entry = this->merge_heap.back();
+    this->merge_heap.pop_back();
+    Entry following = this->next_from(entry.second);
+    if (following.first != nullptr) {
+        this->merge_heap.push_back(following);
+        std::push_heap(this->merge_heap.begin(), this->merge_heap.end(), later);
+    }
+    this->returned++;
+    return entry.first;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file sort.h - Sorting rows that may not fit in memory, for ORDER BY.
+ * SortKey
+ * SpillTable
+ * ExternalSort
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class SortKey - one column of an ORDER BY
+ */
+class SortKey {
+public:
+    SortKey(Identifier column_name, bool ascending = true) : column_name(column_name), ascending(ascending) {}
+
+    Identifier column_name;
+    bool ascending;
+};
+
+typedef std::vector<SortKey> SortKeys;
+
+/**
+ * @class SpillTable - rows spilled to a temporary heap file by an operator that ran out of memory
+ *
+ * Rows are written once, in order, then read back in the same order, a few blocks
+ * ahead of the reader (see ReadAhead). The file is
+ * created in _DB_ENV, outside any transaction, and removed by drop().
+ */
+class SpillTable : public HeapTable {
+public:
+    SpillTable(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~SpillTable();
+
+    SpillTable(const SpillTable &other) = delete;
+
+    SpillTable &operator=(const SpillTable &other) = delete;
+
+    /**
+     * Append a row to the end of the table.
+     */
+    virtual void write(const ValueDict *row);
+
+    /**
+     * The next row of the table (freed by caller), or nullptr after the last.
+     */
+    virtual ValueDict *next();
+
+    virtual void drop();
+
+protected:
+    static std::atomic<u_int32_t> next_id;
+    ReadAhead *blocks;          // nullptr before the first read
+    SlottedPage *block;         // block being read
+    RecordID at;                // last record read from block
+
+    static Identifier unique_name();
+
+    virtual bool versioned() { return false; } // only ever read by the statement that wrote it
+
+    virtual bool zone_mapped() { return false; } // only ever read in full
+};
+
+/**
+ * @class ExternalSort - sorts rows under a memory budget
+ *
+ * Rows are collected in memory until they reach the budget, then sorted and spilled
+ * as a SpillTable; the runs (and whatever is still in memory) are then k-way merged.
+ * With a limit, only the first limit rows are wanted, so rows are kept in a bounded
+ * heap instead and most of them never get past add().
+ * The sort is stable: rows with equal keys come out in the order they went in.
+ */
+class ExternalSort {
+public:
+    static size_t memory_budget;                    // bytes of rows held in memory, by default
+    static const size_t DEFAULT_MEMORY_BUDGET = 16 * 1024 * 1024;
+    static const size_t MAX_MERGE_WIDTH = 64;       // runs merged at once
+
+    /**
+     * @param column_names       the columns of the rows to sort
+     * @param column_attributes  their attributes
+     * @param keys               what to sort by: columns among column_names
+     * @param limit              only the first limit rows are wanted; 0 for all of them
+     * @param budget             bytes of rows to hold in memory
+     */
+    ExternalSort(const ColumnNames &column_names, const ColumnAttributes &column_attributes, const SortKeys &keys,
+                 size_t limit = 0, size_t budget = memory_budget);
+
+    virtual ~ExternalSort();
+
+    ExternalSort(const ExternalSort &other) = delete;
+
+    ExternalSort &operator=(const ExternalSort &other) = delete;
+
+    /**
+     * Add a row to be sorted (takes ownership of it). Only before the first next().
+     */
+    virtual void add(ValueDict *row);
+
+    /**
+     * The next row in sorted order (freed by caller), or nullptr after the last.
+     */
+    virtual ValueDict *next();
+
+    /**
+     * How many runs were spilled to disk (for the curious).
+     */
+    size_t get_spilled_runs() const { return spilled_runs; }
+
+protected:
+    // a row and where it came from: its sequence number in the input or the run it is the head of
+    typedef std::pair<ValueDict *, size_t> Entry;
+
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    SortKeys keys;
+    size_t limit;
+    size_t budget;
+
+    std::vector<Entry> rows;        // in memory: unsorted, or a heap when there is a limit
+    size_t bytes;                   // estimated size of rows
+    size_t sequence;                // rows added so far
+    std::vector<SpillTable *> runs;
+    size_t spilled_runs;
+
+    bool merging;
+    std::vector<Entry> merge_heap;  // head of each source; the in-memory rows are source runs.size()
+    size_t memory_at;               // next in-memory row to merge
+    size_t returned;
+
+    // the sort order, with sequence (or source) numbers to break ties
+    bool before(const ValueDict *a, const ValueDict *b) const;
+
+    bool entry_before(const Entry &a, const Entry &b) const;
+
+    void spill();
+
+    void start_merge();
+
+    // next row from a source, as an Entry; nullptr row when it is exhausted
+    Entry next_from(size_t source);
+
+    // merge runs[first, first + count) into one run, put in their place
+    void merge_runs(size_t first, size_t count);
+
+    static size_t row_bytes(const ValueDict *row);
+};
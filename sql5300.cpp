@@ -20,11 +20,24 @@ Overall, it provides a basic yet functional interface for executing SQL commands
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <regex>
+#include <thread>
+#include <vector>
 #include "db_cxx.h"
 #include <cassert>
 #include "sqlhelper.h"
 #include "SQLParser.h"
 #include "heap_storage.h"
+#include "mvcc.h"
+#include "redo_log.h"
+#include "sql_exec.h"
+#include "transaction.h"
+#include "server.h"
+#include "storage_stats.h"
 using namespace std;
 using namespace hsql;
 
@@ -32,6 +45,9 @@ DbEnv *_DB_ENV;
 
 string unparseSelect(const SelectStatement* stmt);
 string unparseCreate(const CreateStatement* stmt);
+string unparseInsert(const InsertStatement* stmt);
+string unparseDrop(const DropStatement* stmt);
+string unparseShow(const ShowStatement* stmt);
 string unparseTable(const TableRef* table);
 string unparseOperator( const Expr *expr);
 string printExpression(const Expr *expr);
@@ -124,7 +140,7 @@ string printExpression(const Expr *expr){
 			res += unparseOperator(expr);
 			break;
 		case kExprFunctionRef:
-			res += string(expr->name) + "?" + expr->expr->name;
+			res += string(expr->name) + "(" + (expr->distinct ? "DISTINCT " : "") + printExpression(expr->expr) + ")";
 			break;	
 		default:
 			res += "Invalid expression ";
@@ -216,6 +232,39 @@ string unparseSelect(const SelectStatement* stmt) {
 	if (stmt->whereClause != NULL){
 		res += " WHERE " + printExpression(stmt->whereClause);
 	}
+	if (stmt->groupBy != NULL){
+		res += " GROUP BY ";
+		bool groups = false;
+		for (Expr* expr : *stmt->groupBy->columns) {
+			if(groups){
+				res += ", ";
+			}
+			res += printExpression(expr);
+			groups = true;
+		}
+		if (stmt->groupBy->having != NULL){
+			res += " HAVING " + printExpression(stmt->groupBy->having);
+		}
+	}
+	if (stmt->order != NULL){
+		res += " ORDER BY ";
+		bool keys = false;
+		for (OrderDescription* order : *stmt->order) {
+			if(keys){
+				res += ", ";
+			}
+			res += printExpression(order->expr) + (order->type == kOrderAsc ? " ASC" : " DESC");
+			keys = true;
+		}
+	}
+	if (stmt->limit != NULL){
+		if (stmt->limit->limit != kNoLimit){
+			res += " LIMIT " + to_string(stmt->limit->limit);
+		}
+		if (stmt->limit->offset != kNoOffset){
+			res += " OFFSET " + to_string(stmt->limit->offset);
+		}
+	}
 	return res;
 }
 
@@ -245,7 +294,67 @@ string unparseCreate(const CreateStatement* stmt){
 }
 
 /**
-* handle two different types of quary: Select and Create.
+*unparse INSERT SQL statement
+**/
+string unparseInsert(const InsertStatement* stmt){
+	string res("INSERT INTO ");
+	res += stmt->tableName;
+	if(stmt->columns != NULL){
+		res += " (";
+		bool columns = false;
+		for (char *col : *stmt->columns){
+			if(columns){
+				res += ", ";
+			}
+			res += col;
+			columns = true;
+		}
+		res += ")";
+	}
+	if(stmt->type == InsertStatement::kInsertSelect){
+		return res + " " + unparseSelect(stmt->select);
+	}
+	res += " VALUES (";
+	bool values = false;
+	for (Expr *expr : *stmt->values){
+		if(values){
+			res += ", ";
+		}
+		res += printExpression(expr);
+		values = true;
+	}
+	res += ")";
+	return res;
+}
+
+/**
+*unparse DROP SQL statement
+**/
+string unparseDrop(const DropStatement* stmt){
+	if(stmt->type != DropStatement::kTable){
+		return "DROP ...";
+	}
+	return string("DROP TABLE ") + stmt->name;
+}
+
+/**
+*unparse SHOW SQL statement
+**/
+string unparseShow(const ShowStatement* stmt){
+	switch(stmt->type){
+		case ShowStatement::kTables:
+			return "SHOW TABLES";
+		case ShowStatement::kColumns:
+			return string("SHOW COLUMNS FROM ") + stmt->tableName;
+		case ShowStatement::kIndex:
+			return string("SHOW INDEX FROM ") + stmt->tableName;
+		default:
+			return "SHOW ...";
+	}
+}
+
+/**
+* handle the supported types of query: Select, Create, Insert, Drop and Show.
 **/
 string runsql(const SQLStatement* stmt) {
 
@@ -253,25 +362,501 @@ string runsql(const SQLStatement* stmt) {
 		return unparseSelect((const SelectStatement*)stmt);
 	else if(stmt->type()==kStmtCreate)	
 	    return unparseCreate((const CreateStatement*)stmt);
+	else if(stmt->type()==kStmtInsert)
+		return unparseInsert((const InsertStatement*)stmt);
+	else if(stmt->type()==kStmtDrop)
+		return unparseDrop((const DropStatement*)stmt);
+	else if(stmt->type()==kStmtShow)
+		return unparseShow((const ShowStatement*)stmt);
 	else
 		return " Invalid sql statement" ;
 }
 
+/**
+* strip leading and trailing whitespace
+**/
+string trim(const string &s) {
+	size_t begin = 0, end = s.length();
+	while (begin < end && isspace((unsigned char)s[begin]))
+		begin++;
+	while (end > begin && isspace((unsigned char)s[end - 1]))
+		end--;
+	return s.substr(begin, end - begin);
+}
+
+/**
+* lower-case copy of s (shell keywords are case-insensitive)
+**/
+string lowercase(const string &s) {
+	string res(s);
+	for (char &c : res)
+		c = tolower((unsigned char)c);
+	return res;
+}
+
+/**
+* the parser has no DICTIONARY: take it out of each "<column> TEXT DICTIONARY" of a CREATE TABLE,
+* noting the column in dictionaryColumns
+**/
+string takeDictionary(const string &statement, ColumnNames &dictionaryColumns) {
+	static const std::regex dictionary("(\\w+)(\\s+text)\\s+dictionary\\b", std::regex::icase);
+	for (std::sregex_iterator match(statement.begin(), statement.end(), dictionary), end; match != end; ++match)
+		dictionaryColumns.push_back((*match)[1]);
+	return std::regex_replace(statement, dictionary, "$1$2");
+}
+
+/**
+* shell commands that are not SQL, so the parser never sees them
+**/
+bool isShellKeyword(const string &command) {
+	static const char *keywords[] = {"quit", "test", "begin", "commit", "rollback", "show stats", "reset stats", "show buffer"};
+	for (const char *keyword : keywords)
+		if (command == keyword)
+			return true;
+	return false;
+}
+
+/**
+* outcome of one piece of shell input
+**/
+enum CommandStatus { CMD_OK, CMD_ERROR, CMD_QUIT };
+
+/**
+* echo a parsed statement, then execute it and print its result
+**/
+CommandStatus execute(const SQLStatement* stmt, ostream &out) {
+	ArenaScope statement;
+	RedoCommit durable;
+	SnapshotScope snapshot; // unless a transaction already is one, the statement is a version writer
+	out << runsql(stmt) << endl;
+	try {
+		QueryResult *qr = SQLExec::execute(stmt);
+		out << *qr << endl;
+		delete qr;
+	} catch (std::exception &e) {
+		out << "Error: " << e.what() << endl;
+		return CMD_ERROR;
+	}
+	return CMD_OK;
+}
+
+/**
+* run one command (shell keyword or one or more SQL statements), writing its output to out
+**/
+CommandStatus runCommand(const string &sqlcmd, ostream &out) {
+	ArenaScope statement; // everything the command allocates from the arena goes at once when it is done
+	RedoCommit durable;   // and everything it logged is on disk
+	string command = lowercase(trim(sqlcmd));
+	if (command == "quit") {
+		return CMD_QUIT;
+	}
+	if (command == "test") {
+		bool ok = test_heap_storage();
+		out << "test_heap_storage: " << (ok ? "ok" : "failed") << endl;
+		if (ok) {
+			ok = test_sql_exec();
+			out << "test_sql_exec: " << (ok ? "ok" : "failed") << endl;
+		}
+		return ok ? CMD_OK : CMD_ERROR;
+	}
+	if (command == "begin" || command == "commit" || command == "rollback") {
+		try {
+			if (command == "begin")
+				TransactionManager::begin();
+			else if (command == "commit")
+				TransactionManager::commit();
+			else
+				TransactionManager::abort();
+		} catch (TransactionError &e) {
+			out << "Error: " << e.what() << endl;
+			return CMD_ERROR;
+		} catch (DbException &e) {
+			out << "Error: " << e.what() << endl;
+			return CMD_ERROR;
+		}
+		out << command << " ok" << endl;
+		return CMD_OK;
+	}
+	SnapshotScope snapshot; // after begin/commit/rollback, which start and end their own
+	if (command == "show stats") {
+		StorageStats::totals().print(out);
+		return CMD_OK;
+	}
+	if (command == "show buffer") {
+		BufferPool::print(_DB_ENV, out);
+		return CMD_OK;
+	}
+	if (command == "reset stats") {
+		StorageStats::reset();
+		out << "stats reset" << endl;
+		return CMD_OK;
+	}
+	if (command.compare(0, 13, "vacuum table ") == 0) {
+		//remove the row versions no statement can see any more
+		string table_name = trim(trim(sqlcmd).substr(13));
+		try {
+			QueryResult *qr = SQLExec::vacuum(table_name);
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			return CMD_ERROR;
+		}
+		return CMD_OK;
+	}
+	if (command.compare(0, 18, "vacuum full table ") == 0) {
+		//rewrite the table into just the row versions still in use, packed into fewer blocks
+		string table_name = trim(trim(sqlcmd).substr(18));
+		try {
+			QueryResult *qr = SQLExec::rewrite(table_name);
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			return CMD_ERROR;
+		}
+		return CMD_OK;
+	}
+	if (command.compare(0, 14, "compact table ") == 0) {
+		//rewrite the table's heap file into compressed blocks
+		string table_name = trim(trim(sqlcmd).substr(14));
+		try {
+			QueryResult *qr = SQLExec::compact(table_name);
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			return CMD_ERROR;
+		}
+		return CMD_OK;
+	}
+	bool columnTable = command.compare(0, 20, "create column table ") == 0;
+	ColumnNames dictionaryColumns;
+	string created;
+	if (columnTable || command.compare(0, 13, "create table ") == 0)
+		created = takeDictionary(trim(sqlcmd), dictionaryColumns);
+	if (columnTable || !dictionaryColumns.empty()) {
+		//a CREATE TABLE whose table keeps each column in a file of its own, or has DICTIONARY columns
+		string statement = columnTable ? "create table " + trim(created.substr(20)) : created;
+		hsql::SQLParserResult *result = hsql::SQLParser::parseSQLString(statement);
+		if (!result->isValid() || result->size() != 1 || result->getStatement(0)->type() != kStmtCreate) {
+			out << "Error: only a single CREATE TABLE can be a column table or have DICTIONARY columns" << endl;
+			delete result;
+			return CMD_ERROR;
+		}
+		CommandStatus status = CMD_OK;
+		try {
+			QueryResult *qr = SQLExec::create_table((const CreateStatement*)result->getStatement(0),
+			                                        columnTable ? Storage::COLUMN : Storage::HEAP, dictionaryColumns);
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			status = CMD_ERROR;
+		}
+		delete result;
+		return status;
+	}
+	if (command.compare(0, 19, "create bloom index ") == 0) {
+		//a CREATE INDEX kept as a Bloom filter per block (the parser knows only BTREE and HASH)
+		string statement = "create index " + trim(trim(sqlcmd).substr(19));
+		hsql::SQLParserResult *result = hsql::SQLParser::parseSQLString(statement);
+		if (!result->isValid() || result->size() != 1 || result->getStatement(0)->type() != kStmtCreate
+		    || ((const CreateStatement*)result->getStatement(0))->type != CreateStatement::kIndex) {
+			out << "Error: expected create bloom index <name> on <table> (<columns>)" << endl;
+			delete result;
+			return CMD_ERROR;
+		}
+		CommandStatus status = CMD_OK;
+		try {
+			QueryResult *qr = SQLExec::create_index((const CreateStatement*)result->getStatement(0), Indices::BLOOM);
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			status = CMD_ERROR;
+		}
+		delete result;
+		return status;
+	}
+	if (command.compare(0, 16, "explain analyze ") == 0) {
+		//run the statement, then show what it cost this thread
+		string statement = trim(trim(sqlcmd).substr(16));
+		StatValues before = StorageStats::thread_totals();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		CommandStatus status = runCommand(statement, out);
+		double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		StatValues cost = StorageStats::thread_totals() - before;
+		out << "elapsed_ms: " << elapsed << endl;
+		cost.print(out);
+		return status;
+	}
+	if (command.compare(0, 8, "analyze ") == 0) {
+		//sample the table for the cost model's statistics
+		string table_name = trim(trim(sqlcmd).substr(8));
+		try {
+			QueryResult *qr = SQLExec::analyze(table_name);
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			return CMD_ERROR;
+		}
+		return CMD_OK;
+	}
+	if (command.compare(0, 8, "explain ") == 0) {
+		//show the cost model's plan for a select, without running it
+		string statement = trim(trim(sqlcmd).substr(8));
+		hsql::SQLParserResult *result = hsql::SQLParser::parseSQLString(statement);
+		if (!result->isValid() || result->size() != 1 || result->getStatement(0)->type() != kStmtSelect) {
+			out << "Error: only a single SELECT can be explained" << endl;
+			delete result;
+			return CMD_ERROR;
+		}
+		CommandStatus status = CMD_OK;
+		try {
+			QueryResult *qr = SQLExec::explain((const SelectStatement*)result->getStatement(0));
+			out << *qr << endl;
+			delete qr;
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			status = CMD_ERROR;
+		}
+		delete result;
+		return status;
+	}
+	if (sqlcmd.length() < 1) {
+		return CMD_OK;
+	}
+
+	//uses hsql parser for input statement
+	hsql::SQLParserResult *result = hsql::SQLParser::parseSQLString(sqlcmd);
+	//Check to see if hyrise parse result is valid
+	if (!result->isValid()) {
+		out << "Invalid SQL:" << sqlcmd << endl;
+		delete result;
+		return CMD_ERROR;
+	}
+	CommandStatus status = CMD_OK;
+	for (uint i = 0; i < result->size(); i++) {
+		if (execute(result->getStatement(i), out) == CMD_ERROR)
+			status = CMD_ERROR;
+	}
+	delete result;
+	return status;
+}
+
+/**
+* read the next statement of a script: statements end with ';' outside of quotes,
+* "-- " comments run to end of line, and the shell keywords may stand alone on a
+* line without a ';'
+* @returns false when the input is exhausted
+**/
+bool nextStatement(istream &in, string &stmt) {
+	stmt.clear();
+	char quote = 0;
+	char c;
+	while (in.get(c)) {
+		if (quote != 0) {
+			if (c == quote)
+				quote = 0;
+			stmt += c;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			stmt += c;
+		} else if (c == '-' && in.peek() == '-') {
+			string comment;
+			getline(in, comment);
+			c = '\n';
+			stmt += c;
+		} else if (c == ';') {
+			stmt = trim(stmt);
+			if (stmt.length() > 0)
+				return true;
+		} else {
+			stmt += c;
+		}
+		if (quote == 0 && c == '\n') {
+			string word = trim(stmt);
+			if (isShellKeyword(lowercase(word))) {
+				stmt = word;
+				return true;
+			}
+		}
+	}
+	stmt = trim(stmt);
+	return stmt.length() > 0;
+}
+
+/**
+* is this statement an INSERT (so it may be grouped with its neighbors)?
+**/
+bool isInsert(const string &stmt) {
+	if (stmt.length() < 6)
+		return false;
+	string word;
+	for (uint i = 0; i < 6; i++)
+		word += tolower((unsigned char)stmt[i]);
+	return word == "insert" && (stmt.length() == 6 || isspace((unsigned char)stmt[6]));
+}
+
+/**
+* run a group of consecutive INSERT statements with a single parse;
+* if the group does not parse, rerun them one at a time to report the bad one.
+* Outside an explicit transaction, a transactional environment commits the whole
+* group at once; with the redo log, the group is flushed to it once.
+**/
+CommandStatus runInsertGroup(vector<string> &group, ostream &out) {
+	if (group.empty())
+		return CMD_OK;
+	RedoCommit durable;
+	CommandStatus status = CMD_OK;
+	bool ownTxn = TransactionManager::enabled() && !TransactionManager::in_transaction();
+	if (ownTxn)
+		TransactionManager::begin();
+	// whatever goes wrong, the group's own transaction is ended: committed only if every statement ran
+	try {
+		SnapshotScope snapshot; // without a transaction, the group is one version writer
+		if (group.size() == 1) {
+			status = runCommand(group[0], out);
+		} else {
+			string sqlcmd;
+			for (const string &stmt : group)
+				sqlcmd += stmt + ";\n";
+			hsql::SQLParserResult *result = hsql::SQLParser::parseSQLString(sqlcmd);
+			try {
+				if (result->isValid()) {
+					for (uint i = 0; i < result->size(); i++)
+						if (execute(result->getStatement(i), out) == CMD_ERROR)
+							status = CMD_ERROR;
+				} else {
+					for (const string &stmt : group)
+						if (runCommand(stmt, out) == CMD_ERROR)
+							status = CMD_ERROR;
+				}
+			} catch (...) {
+				delete result;
+				throw;
+			}
+			delete result;
+		}
+	} catch (std::exception &e) {
+		out << "Error: " << e.what() << endl;
+		status = CMD_ERROR;
+	}
+	if (ownTxn && TransactionManager::in_transaction()) {
+		try {
+			if (status == CMD_OK)
+				TransactionManager::commit(); // a commit that fails has been aborted by BerkeleyDB
+			else
+				TransactionManager::abort();
+		} catch (std::exception &e) {
+			out << "Error: " << e.what() << endl;
+			status = CMD_ERROR;
+		}
+	}
+	group.clear();
+	return status;
+}
+
+/**
+* non-interactive mode: run every statement of a script without prompting,
+* grouping up to group_size consecutive INSERTs into one batch
+* @returns number of statements that failed
+**/
+int runScript(istream &in, uint group_size, ostream &out) {
+	int failures = 0;
+	vector<string> group;
+	string stmt;
+	while (nextStatement(in, stmt)) {
+		if (group_size > 1 && isInsert(stmt)) {
+			group.push_back(stmt);
+			if (group.size() >= group_size && runInsertGroup(group, out) == CMD_ERROR)
+				failures++;
+			continue;
+		}
+		if (runInsertGroup(group, out) == CMD_ERROR)
+			failures++;
+		CommandStatus status = runCommand(stmt, out);
+		if (status == CMD_QUIT)
+			return failures;
+		if (status == CMD_ERROR)
+			failures++;
+	}
+	if (runInsertGroup(group, out) == CMD_ERROR)
+		failures++;
+	return failures;
+}
+
 int main(int argc, char **argv)
 {
-	//Check for columnsnd line paramenters if there are more than 1 paramenters.
-	if (argc != 2) {
-		cerr << "Usage: cpsc5300: dvenvpath" << endl;
+	//Check for command line parameters: dbenvpath, then optional script and insert grouping
+	const char *usage = "Usage: cpsc5300: dbenvpath [-f script.sql] [-g insert_group_size] [-t [-w group_commit_usec] | -r [-c checkpoint_secs]]"
+						 " [-l port|socket_path [-n threads]] [-m sort_memory_kb] [-o max_open_tables]"
+						 " [-b cache_mb] [-p bdb_page_size] [-M mmap_mb]";
+	if (argc < 2) {
+		cerr << usage << endl;
+		return 1;
+	}
+	const char *scriptPath = NULL;
+	uint groupSize = 1;
+	bool transactional = false;
+	uint groupCommitWindow = 0;
+	bool redoLogged = false;
+	uint checkpointSecs = RedoLog::DEFAULT_CHECKPOINT_SECS;
+	const char *listenAddress = NULL;
+	uint nThreads = thread::hardware_concurrency();
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			scriptPath = argv[++i];
+		} else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+			groupSize = (uint)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-t") == 0) {
+			transactional = true;
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			groupCommitWindow = (uint)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0) {
+			redoLogged = true;
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			checkpointSecs = (uint)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			listenAddress = argv[++i];
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			nThreads = (uint)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			ExternalSort::memory_budget = (size_t)atoi(argv[++i]) * 1024;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			Tables::max_open_tables = (size_t)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			BufferPool::cache_bytes = (u_int64_t)atoll(argv[++i]) * 1024 * 1024;
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc && BufferPool::valid_page_size((u_int32_t)atoi(argv[i + 1]))) {
+			BufferPool::page_size = (u_int32_t)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+			BufferPool::mmap_bytes = (size_t)atoll(argv[++i]) * 1024 * 1024;
+		} else {
+			cerr << usage << endl;
+			return 1;
+		}
+	}
+	if (transactional && redoLogged) {
+		cerr << usage << endl; // BerkeleyDB's own log already makes -t durable
 		return 1;
 	}
 
 	//arg[1] as directory path
 	char *envDir = argv[1];
 	DbEnv *myEnv = new DbEnv(0U);
+	BufferPool::configure(myEnv); // only takes effect before the environment is opened
 	
-	//create database env if it doesn't exist
+	//create database env if it doesn't exist; -t adds logging and transactions
+	//handles are free-threaded: shared by the server's sessions and by parallel GROUP BY workers
+	u_int32_t envFlags = DB_CREATE | DB_INIT_MPOOL | DB_THREAD;
+	if (transactional)
+		envFlags |= TransactionManager::ENV_FLAGS;
+	else if (listenAddress != NULL)
+		envFlags |= DB_INIT_CDB;  // sessions read and write at once, so BerkeleyDB must lock (-t already does)
 	try {
-		myEnv->open(envDir, DB_CREATE | DB_INIT_MPOOL, 0);
+		myEnv->open(envDir, envFlags, 0);
 	}
 	catch (DbException &e) {
 		std::cerr << "Error opening database"
@@ -285,35 +870,72 @@ int main(int argc, char **argv)
 		std::cerr << e.what() << std::endl;
 		exit(-1);
 	}
+	_DB_ENV = myEnv;
+	try {
+		VersionManager::open(envDir);
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		exit(-1);
+	}
+	if (transactional)
+		TransactionManager::enable(groupCommitWindow);
+	try {
+		HeapFile::recover_swaps(envDir);
+	} catch (std::exception &e) {
+		std::cerr << "Error recovering tables being swapped in " << envDir << std::endl;
+		std::cerr << e.what() << std::endl;
+		exit(-1);
+	}
+	if (redoLogged) {
+		try {
+			RedoLog::open(envDir, checkpointSecs);
+		} catch (std::exception &e) {
+			std::cerr << "Error recovering from the redo log in " << envDir << std::endl;
+			std::cerr << e.what() << std::endl;
+			exit(-1);
+		}
+	}
+
+	//batch mode: a script file, or statements piped into stdin
+	if (scriptPath != NULL) {
+		ifstream script(scriptPath);
+		if (!script) {
+			cerr << "Cannot open script " << scriptPath << endl;
+			return 1;
+		}
+		return runScript(script, groupSize, cout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//server mode: concurrent sessions, one command per line, each on a pool thread
+	if (listenAddress != NULL) {
+		SQLServer server(listenAddress, nThreads,
+			[](const string &line, ostream &out) { return runCommand(line, out) != CMD_QUIT; },
+			[]() {
+				if (TransactionManager::in_transaction())
+					TransactionManager::abort();  // client went away mid-transaction
+			});
+		try {
+			server.run();
+		} catch (std::exception &e) {
+			cerr << e.what() << endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (!isatty(STDIN_FILENO)) {
+		return runScript(cin, groupSize, cout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 	
 	//SQL starts
 	while (true) {
 		string sqlcmd;
 		cout << "SQL>";
-		getline(cin, sqlcmd);
-
-		if (sqlcmd == "quit") {
+		if (!getline(cin, sqlcmd)) {
 			break;
 		}
-		if (sqlcmd == "test") {
-            cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
-            continue;
-        }
-		if (sqlcmd.length() < 1) {
-			continue;
-		}
-
-		//uses hsql parser for input statement
-		hsql::SQLParserResult *result = hsql::SQLParser::parseSQLString(sqlcmd);
-		//Check to see if hyrise parse result is valid
-		if (!result->isValid()) {
-			cout << "Invalid SQL:" << sqlcmd << endl;
-			continue;
-		}
-		else {
-			for (uint i = 0; i < result->size(); i++) {
-				cout << runsql(result->getStatement(i)) << endl;
-			}
+		if (runCommand(sqlcmd, cout) == CMD_QUIT) {
+			break;
 		}
 	}
     return EXIT_SUCCESS;
@@ -0,0 +1,1078 @@
+/**
+ * @file sql_exec.cpp - implementation of SQLExec class
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "sql_exec.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace hsql;
+
+// define static data
+Tables *SQLExec::tables = nullptr;
+Columns *SQLExec::columns = nullptr;
+Indices *SQLExec::indices = nullptr;
+Statistics *SQLExec::statistics = nullptr;
+Storage *SQLExec::storage = nullptr;
+once_flag SQLExec::initialized;
+RWLatch SQLExec::schema_latch;
+
+// make query result be printable
+ostream &operator<<(ostream &out, const QueryResult &qres) {
+    if (qres.column_names != nullptr) {
+        for (auto const &column_name: *qres.column_names)
+            out << column_name << " ";
+        out << endl << "+";
+        for (unsigned int i = 0; i < qres.column_names->size(); i++)
+            out << "----------+";
+        out << endl;
+        for (auto const &row: *qres.rows) {
+            for (auto const &column_name: *qres.column_names) {
+                Value value = row->at(column_name);
+                switch (value.data_type) {
+                    case ColumnAttribute::INT:
+                        out << value.n;
+                        break;
+                    case ColumnAttribute::TEXT:
+                        out << "\"" << value.s << "\"";
+                        break;
+                    default:
+                        out << "???";
+                }
+                out << " ";
+            }
+            out << endl;
+        }
+    }
+    out << qres.message;
+    return out;
+}
+
+QueryResult::~QueryResult() {
+    if (rows != nullptr)
+        for (auto row : *rows)
+            delete row;
+    delete rows;
+    delete column_names;
+    delete column_attributes;
+}
+
+void SQLExec::initialize() {
+    call_once(initialized, []() {
+        initialize_schema_tables();
+        tables = new Tables();
+        columns = new Columns();
+        indices = new Indices();
+        statistics = new Statistics();
+        storage = new Storage();
+    });
+}
+
+QueryResult *SQLExec::execute(const SQLStatement *statement) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        switch (statement->type()) {
+            case kStmtCreate: {
+                ExclusiveLatch latch(schema_latch);
+                return create((const CreateStatement *) statement);
+            }
+            case kStmtDrop: {
+                ExclusiveLatch latch(schema_latch);
+                return drop((const DropStatement *) statement);
+            }
+            case kStmtShow: {
+                SharedLatch latch(schema_latch);
+                return show((const ShowStatement *) statement);
+            }
+            case kStmtInsert: {
+                SharedLatch latch(schema_latch);
+                return insert((const InsertStatement *) statement);
+            }
+            case kStmtSelect: {
+                SharedLatch latch(schema_latch);
+                return select((const SelectStatement *) statement);
+            }
+            default:
+                return new QueryResult("not implemented");
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+QueryResult *SQLExec::create_table(const CreateStatement *statement, const string &storage_type,
+                                   const ColumnNames &dictionary_columns) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        ExclusiveLatch latch(schema_latch);
+        return create(statement, storage_type, dictionary_columns);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// the index is added to the catalog under the exclusive latch, but filled in for the blocks
+// already full under the shared one, so other statements can go on meanwhile
+QueryResult *SQLExec::create_index(const CreateStatement *statement, const string &index_type) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        if (index_type != Indices::BLOOM)
+            throw SQLExecError("only " + Indices::BLOOM + " indices are implemented");
+        QueryResult *result;
+        {
+            ExclusiveLatch latch(schema_latch);
+            result = create_bloom_index(statement);
+        }
+        try {
+            SharedLatch latch(schema_latch);
+            HeapTable *table = dynamic_cast<HeapTable *>(&tables->get_table(statement->tableName));
+            if (table == nullptr)
+                throw SQLExecError(string(statement->tableName) + " was dropped while it was being indexed");
+            table->build_bloom_filter(statement->indexName);
+        } catch (...) {
+            delete result;
+            throw;
+        }
+        return result;
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+QueryResult *SQLExec::compact(const Identifier &table_name) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        ExclusiveLatch latch(schema_latch);
+        if (Tables::is_schema_table(table_name))
+            throw SQLExecError("cannot compact a schema table");
+        HeapTable *table = dynamic_cast<HeapTable *>(&tables->get_table(table_name));
+        if (table == nullptr)
+            throw SQLExecError(table_name + " is not a heap table");
+        table->compact();
+        return new QueryResult("compacted " + table_name);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// under the shared latch: other statements, even on this table, go on meanwhile
+QueryResult *SQLExec::vacuum(const Identifier &table_name) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        SharedLatch latch(schema_latch);
+        HeapTable *table = dynamic_cast<HeapTable *>(&tables->get_table(table_name));
+        if (table == nullptr)
+            throw SQLExecError(table_name + " is not a heap table");
+        u_int32_t removed = table->vacuum();
+        return new QueryResult("vacuumed " + table_name + ": removed " + to_string(removed) + " row versions");
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// Copying the table and filling in its summaries again are done under the shared latch, so
+// other statements (even on this table) go on meanwhile; only catching up with what they
+// changed and swapping the new file in is exclusive. TablesInUse keeps the table from being
+// deleted in between, even if it is dropped.
+QueryResult *SQLExec::rewrite(const Identifier &table_name) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        if (Tables::is_schema_table(table_name))
+            throw SQLExecError("cannot rewrite a schema table");
+        HeapTable *table;
+        HeapRewrite *rewrite;
+        u_int32_t blocks_before;
+        {
+            SharedLatch latch(schema_latch);
+            table = dynamic_cast<HeapTable *>(&tables->get_table(table_name));
+            if (table == nullptr)
+                throw SQLExecError(table_name + " is not a heap table");
+            table->open();
+            blocks_before = table->get_block_count();
+            rewrite = new HeapRewrite(*table);
+            try {
+                rewrite->copy();
+            } catch (...) {
+                delete rewrite;
+                throw;
+            }
+        }
+        u_int32_t blocks_after;
+        try {
+            ExclusiveLatch latch(schema_latch);
+            if (!Tables::is_current(table_name, table)) {
+                rewrite->abandon();
+                throw SQLExecError(table_name + " was dropped while it was being rewritten");
+            }
+            rewrite->finish();
+            blocks_after = table->get_block_count();
+        } catch (...) {
+            delete rewrite;
+            throw;
+        }
+        delete rewrite;
+        {
+            SharedLatch latch(schema_latch);
+            if (Tables::is_current(table_name, table))
+                table->summarize();
+        }
+        return new QueryResult("rewrote " + table_name + ": " + to_string(blocks_before) + " blocks to "
+                               + to_string(blocks_after));
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// the table is sampled under the shared latch, so other statements can go on meanwhile;
+// only replacing its statistics, which the cost model may be reading, is exclusive
+QueryResult *SQLExec::analyze(const Identifier &table_name) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        if (Tables::is_schema_table(table_name))
+            throw SQLExecError("cannot analyze a schema table");
+        TableStatistics *stats;
+        {
+            SharedLatch latch(schema_latch);
+            HeapTable *table = dynamic_cast<HeapTable *>(&tables->get_table(table_name));
+            if (table == nullptr)
+                throw SQLExecError(table_name + " is not a heap table");
+            stats = TableStatistics::analyze(*table);
+        }
+        try {
+            ExclusiveLatch latch(schema_latch);
+            tables->get_table(table_name);  // not dropped in the meantime
+            statistics->put(*stats);
+        } catch (...) {
+            delete stats;
+            throw;
+        }
+
+        ColumnNames *column_names = new ColumnNames({"column_name", "n_distinct"});
+        ColumnAttributes *column_attributes = new ColumnAttributes(
+                {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT)});
+        ValueDicts *rows = new ValueDicts();
+        for (auto const &column : stats->columns) {
+            ValueDict *row = new ValueDict();
+            (*row)["column_name"] = Value(column.column_name);
+            (*row)["n_distinct"] = Value((int32_t) column.n_distinct);
+            rows->push_back(row);
+        }
+        string message = "analyzed " + table_name + ": about " + to_string((long) stats->row_count) + " rows in "
+                         + to_string(stats->block_count) + " blocks";
+        delete stats;
+        return new QueryResult(column_names, column_attributes, rows, message);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+void SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_name,
+                                ColumnAttribute &column_attribute) {
+    column_name = col->name;
+    switch (col->type) {
+        case ColumnDefinition::INT:
+            column_attribute.set_data_type(ColumnAttribute::INT);
+            break;
+        case ColumnDefinition::TEXT:
+            column_attribute.set_data_type(ColumnAttribute::TEXT);
+            break;
+        default:
+            throw SQLExecError("unrecognized data type for column " + column_name);
+    }
+}
+
+QueryResult *SQLExec::create(const CreateStatement *statement, const string &storage_type,
+                             const ColumnNames &dictionary_columns) {
+    if (statement->type == CreateStatement::kIndex)
+        throw SQLExecError("only " + Indices::BLOOM + " indices are implemented (create bloom index ...)");
+    if (statement->type != CreateStatement::kTable)
+        return new QueryResult("only CREATE TABLE is implemented");
+    Identifier table_name = statement->tableName;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot create a schema table");
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    for (ColumnDefinition *col : *statement->columns) {
+        Identifier column_name;
+        ColumnAttribute column_attribute(ColumnAttribute::INT);
+        column_definition(col, column_name, column_attribute);
+        if (find(dictionary_columns.begin(), dictionary_columns.end(), column_name) != dictionary_columns.end()) {
+            if (column_attribute.get_data_type() != ColumnAttribute::TEXT)
+                throw SQLExecError("only TEXT columns can be DICTIONARY-encoded");
+            if (storage_type != Storage::HEAP)
+                throw SQLExecError("only heap tables have DICTIONARY-encoded columns");
+            column_attribute.set_encoding(ColumnAttribute::DICTIONARY);
+        }
+        column_names.push_back(column_name);
+        column_attributes.push_back(column_attribute);
+    }
+    for (auto const &column_name : dictionary_columns)
+        if (find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            throw SQLExecError("unknown column " + column_name);
+
+    // update the catalog, undoing it if the table can't be created
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    Handle table_handle;
+    try {
+        table_handle = tables->insert(&row);
+    } catch (DbRelationError &e) {
+        if (statement->ifNotExists)
+            return new QueryResult(table_name + " already exists");
+        throw;
+    }
+    Handles column_handles;
+    Handle storage_handle(0, 0);
+    try {
+        for (uint i = 0; i < column_names.size(); i++) {
+            row = Columns::row(table_name, column_names[i], column_attributes[i]);
+            column_handles.push_back(columns->insert(&row));
+        }
+        storage_handle = storage->put(table_name, storage_type);
+        DbRelation &table = tables->get_table(table_name);
+        if (statement->ifNotExists)
+            table.create_if_not_exists();
+        else
+            table.create();
+    } catch (...) {
+        try {
+            if (storage_handle.first != 0)
+                storage->del(storage_handle);
+            for (auto const &handle : column_handles)
+                columns->del(handle);
+            tables->del(table_handle);
+        } catch (...) {
+            // the original error is the one to report
+        }
+        throw;
+    }
+    return new QueryResult("created " + table_name);
+}
+
+// under the exclusive schema latch, so no statement is using the table while the filter is added
+QueryResult *SQLExec::create_bloom_index(const CreateStatement *statement) {
+    Identifier table_name = statement->tableName;
+    Identifier index_name = statement->indexName;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot index a schema table");
+    HeapTable *table = dynamic_cast<HeapTable *>(&tables->get_table(table_name));
+    if (table == nullptr)
+        throw SQLExecError(table_name + " is not a heap table");
+    ColumnNames index_columns;
+    for (auto const &column_name : *statement->indexColumns) {
+        const ColumnNames &column_names = table->get_column_names();
+        if (find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            throw SQLExecError("unknown column " + string(column_name));
+        if (find(index_columns.begin(), index_columns.end(), column_name) != index_columns.end())
+            throw SQLExecError("column " + string(column_name) + " is in the index twice");
+        index_columns.push_back(column_name);
+    }
+    ColumnNames *index_names = indices->get_index_names(table_name);
+    bool exists = find(index_names->begin(), index_names->end(), index_name) != index_names->end();
+    delete index_names;
+    if (exists)
+        throw SQLExecError(index_name + " already exists on " + table_name);
+
+    // update the catalog, undoing it if the filter can't be built
+    Handles index_handles;
+    try {
+        int32_t seq_in_index = 1;
+        for (auto const &column_name : index_columns) {
+            ValueDict row;
+            row["table_name"] = Value(table_name);
+            row["index_name"] = Value(index_name);
+            row["column_name"] = Value(column_name);
+            row["seq_in_index"] = Value(seq_in_index++);
+            row["index_type"] = Value(Indices::BLOOM);
+            row["is_unique"] = Value(0);
+            index_handles.push_back(indices->insert(&row));
+        }
+        table->add_bloom_filter(index_name, index_columns);
+    } catch (...) {
+        try {
+            for (auto const &handle : index_handles)
+                indices->del(handle);
+        } catch (...) {
+            // the original error is the one to report
+        }
+        throw;
+    }
+    return new QueryResult("created index " + index_name);
+}
+
+QueryResult *SQLExec::drop_index(const DropStatement *statement) {
+    Identifier table_name = statement->name;
+    Identifier index_name = statement->indexName;
+    HeapTable *table = dynamic_cast<HeapTable *>(&tables->get_table(table_name));
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    where["index_name"] = Value(index_name);
+    Handles *handles = indices->select(&where);
+    bool exists = !handles->empty();
+    for (auto const &handle : *handles)
+        indices->del(handle);
+    delete handles;
+    if (!exists)
+        throw SQLExecError("unknown index " + index_name + " on " + table_name);
+    if (table != nullptr)
+        table->drop_bloom_filter(index_name);
+    return new QueryResult("dropped index " + index_name);
+}
+
+QueryResult *SQLExec::drop(const DropStatement *statement) {
+    if (statement->type == DropStatement::kIndex)
+        return drop_index(statement);
+    if (statement->type != DropStatement::kTable)
+        return new QueryResult("only DROP TABLE and DROP INDEX are implemented");
+    Identifier table_name = statement->name;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot drop a schema table");
+    DbRelation &table = tables->get_table(table_name);
+
+    // the table goes first: if it can't be dropped, its catalog rows are all still there
+    table.drop();
+
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = indices->select(&where);
+    for (auto const &handle : *handles)
+        indices->del(handle);
+    delete handles;
+    handles = columns->select(&where);
+    for (auto const &handle : *handles)
+        columns->del(handle);
+    delete handles;
+
+    statistics->remove(table_name);
+    storage->remove(table_name);
+
+    handles = tables->select(&where);
+    for (auto const &handle : *handles)
+        tables->del(handle); // also forgets table
+    delete handles;
+    return new QueryResult("dropped " + table_name);
+}
+
+QueryResult *SQLExec::show(const ShowStatement *statement) {
+    switch (statement->type) {
+        case ShowStatement::kTables:
+            return show_tables();
+        case ShowStatement::kColumns:
+            return show_columns(statement);
+        case ShowStatement::kIndex:
+            return show_index(statement);
+        default:
+            throw SQLExecError("unrecognized SHOW type");
+    }
+}
+
+QueryResult *SQLExec::show_tables() {
+    ColumnNames *column_names = new ColumnNames(Tables::COLUMN_NAMES());
+    ColumnAttributes *column_attributes = new ColumnAttributes(Tables::COLUMN_ATTRIBUTES());
+    ValueDicts *rows = new ValueDicts();
+    ColumnNames *table_names = tables->get_table_names();
+    for (auto const &table_name : *table_names) {
+        ValueDict *row = new ValueDict();
+        (*row)["table_name"] = Value(table_name);
+        rows->push_back(row);
+    }
+    delete table_names;
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
+    ColumnNames *column_names = new ColumnNames({"table_name", "column_name", "data_type"});
+    ColumnAttributes *column_attributes = new ColumnAttributes(3, ColumnAttribute(ColumnAttribute::TEXT));
+    ValueDicts *rows = new ValueDicts();
+    ValueDict where;
+    where["table_name"] = Value(statement->tableName);
+    Handles *handles = columns->select(&where);
+    for (auto const &handle : *handles)
+        rows->push_back(columns->project(handle, column_names));
+    delete handles;
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+QueryResult *SQLExec::show_index(const ShowStatement *statement) {
+    ColumnNames *column_names = new ColumnNames(Indices::COLUMN_NAMES());
+    ColumnAttributes *column_attributes = new ColumnAttributes(Indices::COLUMN_ATTRIBUTES());
+    ValueDicts *rows = new ValueDicts();
+    ValueDict where;
+    where["table_name"] = Value(statement->tableName);
+    Handles *handles = indices->select(&where);
+    for (auto const &handle : *handles)
+        rows->push_back(indices->project(handle));
+    delete handles;
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+Value SQLExec::literal(const Expr *expr, ColumnAttribute column_attribute) {
+    switch (expr->type) {
+        case kExprLiteralInt:
+            if (column_attribute.get_data_type() != ColumnAttribute::INT)
+                throw SQLExecError("expected a TEXT value");
+            return Value((int32_t) expr->ival);
+        case kExprLiteralString:
+            if (column_attribute.get_data_type() != ColumnAttribute::TEXT)
+                throw SQLExecError("expected an INT value");
+            return Value(string(expr->name));
+        default:
+            throw SQLExecError("only INT and TEXT literals are supported");
+    }
+}
+
+// the attribute of a column of table
+static ColumnAttribute column_attribute(DbRelation &table, const Identifier &column_name) {
+    const ColumnNames &names = table.get_column_names();
+    ColumnNames::const_iterator column = find(names.begin(), names.end(), column_name);
+    if (column == names.end())
+        throw SQLExecError("unknown column " + column_name);
+    return table.get_column_attributes()[column - names.begin()];
+}
+
+QueryResult *SQLExec::insert(const InsertStatement *statement) {
+    if (statement->type != InsertStatement::kInsertValues)
+        throw SQLExecError("only INSERT ... VALUES is implemented");
+    Identifier table_name = statement->tableName;
+    if (Tables::is_schema_table(table_name))
+        throw SQLExecError("cannot insert into a schema table");
+    DbRelation &table = tables->get_table(table_name);
+    ColumnNames column_names;
+    if (statement->columns != nullptr)
+        for (char *column_name : *statement->columns)
+            column_names.push_back(column_name);
+    else
+        column_names = table.get_column_names();
+    if (column_names.size() != statement->values->size())
+        throw SQLExecError("expected " + to_string(column_names.size()) + " values");
+
+    ValueDict row;
+    for (uint i = 0; i < column_names.size(); i++)
+        row[column_names[i]] = literal((*statement->values)[i], column_attribute(table, column_names[i]));
+    table.insert(&row);
+    return new QueryResult("successfully inserted 1 row into " + table_name);
+}
+
+void SQLExec::get_where_conjunction(const Expr *expr, DbRelation &table, ValueDict &where) {
+    if (expr->type != kExprOperator)
+        throw SQLExecError("unsupported where clause");
+    if (expr->opType == Expr::AND) {
+        get_where_conjunction(expr->expr, table, where);
+        get_where_conjunction(expr->expr2, table, where);
+    } else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=' && expr->expr->type == kExprColumnRef) {
+        Identifier column_name = expr->expr->name;
+        where[column_name] = literal(expr->expr2, column_attribute(table, column_name));
+    } else {
+        throw SQLExecError("only equality predicates joined by AND are supported");
+    }
+}
+
+QueryResult *SQLExec::select(const SelectStatement *statement) {
+    if (statement->fromTable->type != kTableName)
+        throw SQLExecError("only single-table SELECT is implemented");
+    DbRelation &table = tables->get_table(statement->fromTable->name);
+    bool aggregating = statement->groupBy != nullptr;
+    for (Expr *expr : *statement->selectList)
+        if (expr->type == kExprFunctionRef)
+            aggregating = true;
+
+    ColumnNames *column_names = new ColumnNames();
+    ColumnAttributes *column_attributes = new ColumnAttributes();
+    ValueDicts *rows = new ValueDicts();
+    try {
+        if (!aggregating) {
+            for (Expr *expr : *statement->selectList) {
+                if (expr->type == kExprStar) {
+                    for (auto const &column_name : table.get_column_names())
+                        column_names->push_back(column_name);
+                } else if (expr->type == kExprColumnRef) {
+                    column_names->push_back(expr->name);
+                } else {
+                    throw SQLExecError("only column names, * or aggregates may be selected");
+                }
+            }
+            for (auto const &column_name : *column_names)
+                column_attributes->push_back(column_attribute(table, column_name));
+        }
+
+        ValueDict where;
+        if (statement->whereClause != nullptr)
+            get_where_conjunction(statement->whereClause, table, where);
+        size_t limit = 0, offset = 0;
+        bool none = false;
+        if (statement->limit != nullptr) {
+            if (statement->limit->limit != kNoLimit)
+                limit = statement->limit->limit;
+            if (statement->limit->offset != kNoOffset)
+                offset = statement->limit->offset;
+            none = limit == 0 && statement->limit->limit != kNoLimit;
+        }
+
+        Handles *handles = none ? new Handles() : where.empty() ? table.select() : table.select(&where);
+        try {
+            if (aggregating) {
+                aggregated(table, *handles, statement, *column_names, *column_attributes, limit, offset, *rows);
+            } else if (statement->order != nullptr) {
+                sorted(table, *handles, *statement->order, *column_names, limit, offset, *rows);
+            } else {
+                size_t first = offset < handles->size() ? offset : handles->size();
+                size_t last = limit > 0 && limit < handles->size() - first ? first + limit : handles->size();
+                table.project_rows(handles->begin() + first, handles->begin() + last, column_names, *rows);
+            }
+        } catch (...) {
+            delete handles;
+            throw;
+        }
+        delete handles;
+        if (none) {
+            for (auto row : *rows)
+                delete row;
+            rows->clear();
+        }
+    } catch (...) {
+        for (auto row : *rows)
+            delete row;
+        delete rows;
+        delete column_names;
+        delete column_attributes;
+        throw;
+    }
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+// the sort needs the ORDER BY columns too, whether or not they were selected
+void SQLExec::sorted(DbRelation &table, const Handles &handles, const vector<OrderDescription *> &order,
+                     const ColumnNames &column_names, size_t limit, size_t offset, ValueDicts &rows) {
+    SortKeys keys;
+    ColumnNames sort_columns(column_names);
+    for (OrderDescription *description : order) {
+        if (description->expr->type != kExprColumnRef)
+            throw SQLExecError("only column names may be in ORDER BY");
+        Identifier column_name = description->expr->name;
+        column_attribute(table, column_name);
+        keys.push_back(SortKey(column_name, description->type == kOrderAsc));
+        if (find(sort_columns.begin(), sort_columns.end(), column_name) == sort_columns.end())
+            sort_columns.push_back(column_name);
+    }
+    ColumnAttributes sort_attributes;
+    for (auto const &column_name : sort_columns)
+        sort_attributes.push_back(column_attribute(table, column_name));
+
+    ExternalSort sort(sort_columns, sort_attributes, keys, limit == 0 ? 0 : limit + offset);
+    for (size_t first = 0; first < handles.size(); first += DbRelation::PROJECT_BATCH) {
+        size_t last = handles.size() - first > DbRelation::PROJECT_BATCH ? first + DbRelation::PROJECT_BATCH
+                                                                         : handles.size();
+        ValueDicts batch;
+        size_t added = 0;
+        try {
+            table.project_rows(handles.begin() + first, handles.begin() + last, &sort_columns, batch);
+            for (; added < batch.size(); added++)
+                sort.add(batch[added]);
+        } catch (...) {
+            for (; added < batch.size(); added++)
+                delete batch[added];
+            throw;
+        }
+    }
+    drain(sort, column_names, offset, rows);
+}
+
+// rows no one selected are only there to sort by
+void SQLExec::drain(ExternalSort &sort, const ColumnNames &column_names, size_t offset, ValueDicts &rows) {
+    while (ValueDict *row = sort.next()) {
+        if (offset > 0) {
+            offset--;
+            delete row;
+            continue;
+        }
+        for (ValueDict::iterator column = row->begin(); column != row->end();) {
+            if (find(column_names.begin(), column_names.end(), column->first) == column_names.end())
+                column = row->erase(column);
+            else
+                column++;
+        }
+        rows.push_back(row);
+    }
+}
+
+Aggregate SQLExec::aggregate_function(const Expr *expr) {
+    string function = expr->name;
+    transform(function.begin(), function.end(), function.begin(), ::toupper);
+    Aggregate::Function kind;
+    if (function == "COUNT")
+        kind = Aggregate::COUNT;
+    else if (function == "SUM")
+        kind = Aggregate::SUM;
+    else if (function == "MIN")
+        kind = Aggregate::MIN;
+    else if (function == "MAX")
+        kind = Aggregate::MAX;
+    else
+        throw SQLExecError("unknown aggregate function " + function);
+    if (expr->distinct)
+        throw SQLExecError(function + "(DISTINCT ...) is not implemented");
+    const Expr *argument = expr->expr;
+    if (argument != nullptr && argument->type == kExprStar && kind == Aggregate::COUNT)
+        return Aggregate(kind, "", expr->alias != nullptr ? expr->alias : function + "(*)");
+    if (argument == nullptr || argument->type != kExprColumnRef)
+        throw SQLExecError(function + " takes a column name");
+    return Aggregate(kind, argument->name, expr->alias != nullptr ? expr->alias : function + "(" + argument->name + ")");
+}
+
+// every selected column must be grouped on; ORDER BY may use the grouped columns and the aggregates
+void SQLExec::aggregated(DbRelation &table, const Handles &handles, const SelectStatement *statement,
+                         ColumnNames &column_names, ColumnAttributes &column_attributes, size_t limit, size_t offset,
+                         ValueDicts &rows) {
+    ColumnNames group_columns;
+    ColumnAttributes group_attributes;
+    if (statement->groupBy != nullptr) {
+        if (statement->groupBy->having != nullptr)
+            throw SQLExecError("HAVING is not implemented");
+        for (Expr *expr : *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef)
+                throw SQLExecError("only column names may be in GROUP BY");
+            group_columns.push_back(expr->name);
+            group_attributes.push_back(column_attribute(table, expr->name));
+        }
+    }
+
+    Aggregates aggregates;
+    ColumnAttributes aggregate_attributes;
+    ColumnNames result_columns(group_columns), needed(group_columns);
+    ColumnAttributes result_attributes(group_attributes);
+    for (Expr *expr : *statement->selectList) {
+        if (expr->type == kExprColumnRef) {
+            if (find(group_columns.begin(), group_columns.end(), expr->name) == group_columns.end())
+                throw SQLExecError(string(expr->name) + " must be in GROUP BY or in an aggregate");
+            column_names.push_back(expr->name);
+            column_attributes.push_back(column_attribute(table, expr->name));
+        } else if (expr->type == kExprFunctionRef) {
+            Aggregate aggregate = aggregate_function(expr);
+            ColumnAttribute attribute(ColumnAttribute::INT);
+            if (!aggregate.column_name.empty()) {
+                attribute = column_attribute(table, aggregate.column_name);
+                if (find(needed.begin(), needed.end(), aggregate.column_name) == needed.end())
+                    needed.push_back(aggregate.column_name);
+            }
+            if (aggregate.function == Aggregate::SUM && attribute.get_data_type() != ColumnAttribute::INT)
+                throw SQLExecError("SUM needs an INT column");
+            ColumnAttribute result_attribute = aggregate.function == Aggregate::MIN
+                                               || aggregate.function == Aggregate::MAX
+                                               ? ColumnAttribute(attribute.get_data_type())
+                                               : ColumnAttribute(ColumnAttribute::INT);
+            aggregates.push_back(aggregate);
+            aggregate_attributes.push_back(attribute);
+            result_columns.push_back(aggregate.result_name);
+            result_attributes.push_back(result_attribute);
+            column_names.push_back(aggregate.result_name);
+            column_attributes.push_back(result_attribute);
+        } else {
+            throw SQLExecError("only grouped columns and COUNT, SUM, MIN or MAX may be selected with GROUP BY");
+        }
+    }
+
+    SortKeys keys;
+    if (statement->order != nullptr) {
+        for (OrderDescription *description : *statement->order) {
+            Identifier column_name;
+            if (description->expr->type == kExprColumnRef)
+                column_name = description->expr->name;
+            else if (description->expr->type == kExprFunctionRef)
+                column_name = aggregate_function(description->expr).result_name;
+            if (find(result_columns.begin(), result_columns.end(), column_name) == result_columns.end())
+                throw SQLExecError("ORDER BY must name a grouped column or a selected aggregate");
+            keys.push_back(SortKey(column_name, description->type == kOrderAsc));
+        }
+    }
+
+    // the ORDER BY is checked before any group is made, so a bad one has nothing to free
+    HashAggregate aggregate(group_columns, group_attributes, aggregates, aggregate_attributes);
+    aggregate.add_all(table, handles, needed);
+    ValueDicts *groups = aggregate.results();
+
+    try {
+        // without GROUP BY there is one group even of no rows, but MIN and MAX of no rows have no value
+        if (groups->empty() && group_columns.empty() && none_of(aggregates.begin(), aggregates.end(),
+                [](const Aggregate &a) { return a.function == Aggregate::MIN || a.function == Aggregate::MAX; })) {
+            groups->push_back(nullptr);
+            ValueDict *row = new ValueDict();
+            groups->back() = row;
+            for (auto const &a : aggregates)
+                (*row)[a.result_name] = Value(0);
+        }
+
+        // no keys: a stable sort leaves the groups as they are, and still applies LIMIT and OFFSET
+        ExternalSort sort(result_columns, result_attributes, keys, limit == 0 ? 0 : limit + offset);
+        for (size_t i = 0; i < groups->size(); i++) {
+            ValueDict *row = (*groups)[i];
+            (*groups)[i] = nullptr;
+            sort.add(row);
+        }
+        delete groups;
+        groups = nullptr;
+        drain(sort, column_names, offset, rows);
+    } catch (...) {
+        if (groups != nullptr) {
+            for (auto row : *groups)
+                delete row;  // the ones already given to the sort are null
+            delete groups;
+        }
+        throw;
+    }
+}
+
+void SQLExec::get_from_tables(const TableRef *table_ref, vector<pair<Identifier, Identifier>> &from,
+                              vector<const Expr *> &conditions) {
+    switch (table_ref->type) {
+        case kTableName:
+            from.push_back(make_pair(table_ref->name, table_ref->alias == nullptr ? table_ref->name : table_ref->alias));
+            break;
+        case kTableJoin:
+            get_from_tables(table_ref->join->left, from, conditions);
+            get_from_tables(table_ref->join->right, from, conditions);
+            if (table_ref->join->condition != nullptr)
+                conditions.push_back(table_ref->join->condition);
+            break;
+        case kTableCrossProduct:
+            for (TableRef *each : *table_ref->list)
+                get_from_tables(each, from, conditions);
+            break;
+        default:
+            throw SQLExecError("only tables and joins of tables are supported in FROM");
+    }
+}
+
+// which of the FROM tables a column reference is to: by table name or alias if it has one,
+// otherwise the only table with such a column
+static size_t table_of(const Expr *column_ref, const vector<pair<Identifier, Identifier>> &from,
+                       const vector<DbRelation *> &relations) {
+    size_t found = from.size();
+    for (size_t i = 0; i < from.size(); i++) {
+        if (column_ref->table != nullptr) {
+            if (from[i].second == column_ref->table)
+                return i;
+            continue;
+        }
+        const ColumnNames &names = relations[i]->get_column_names();
+        if (find(names.begin(), names.end(), Identifier(column_ref->name)) != names.end()) {
+            if (found != from.size())
+                throw SQLExecError(string("ambiguous column ") + column_ref->name);
+            found = i;
+        }
+    }
+    if (found == from.size())
+        throw SQLExecError(string("unknown column ") + column_ref->name);
+    return found;
+}
+
+QueryResult *SQLExec::explain(const SelectStatement *statement) {
+    initialize();
+    try {
+        TablesInUse in_use;
+        SharedLatch latch(schema_latch);
+        vector<pair<Identifier, Identifier>> from;
+        vector<const Expr *> conditions;
+        get_from_tables(statement->fromTable, from, conditions);
+        if (statement->whereClause != nullptr)
+            conditions.push_back(statement->whereClause);
+        vector<DbRelation *> relations;
+        for (auto const &table : from)
+            relations.push_back(&tables->get_table(table.first));
+
+        // split the ANDed conditions into each table's own predicates and the join predicates
+        vector<ValueDict> wheres(from.size());
+        vector<CostModel::JoinPredicate> joins;
+        while (!conditions.empty()) {
+            const Expr *expr = conditions.back();
+            conditions.pop_back();
+            if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+                conditions.push_back(expr->expr);
+                conditions.push_back(expr->expr2);
+                continue;
+            }
+            if (expr->type != kExprOperator || expr->opType != Expr::SIMPLE_OP || expr->opChar != '='
+                || expr->expr->type != kExprColumnRef)
+                throw SQLExecError("only equality predicates joined by AND are supported");
+            size_t left = table_of(expr->expr, from, relations);
+            if (expr->expr2->type == kExprColumnRef) {
+                size_t right = table_of(expr->expr2, from, relations);
+                joins.push_back({from[left].first, expr->expr->name, from[right].first, expr->expr2->name});
+            } else {
+                wheres[left][expr->expr->name] = literal(expr->expr2, column_attribute(*relations[left],
+                                                                                       expr->expr->name));
+            }
+        }
+
+        vector<AccessPath> paths;
+        vector<const TableStatistics *> stats;
+        string message;
+        for (size_t i = 0; i < from.size(); i++) {
+            HeapTable *table = dynamic_cast<HeapTable *>(relations[i]);
+            if (table == nullptr)
+                throw SQLExecError(from[i].first + " is not a heap table");
+            vector<pair<Identifier, ColumnNames>> table_indices;
+            ColumnNames *index_names = indices->get_index_names(from[i].first);
+            map<Identifier, ColumnNames> *bloom_filters = indices->get_bloom_filters(from[i].first);
+            for (auto const &index_name : *index_names) {
+                if (bloom_filters->count(index_name) > 0)
+                    continue; // not an access path: it only lets a scan skip blocks
+                ColumnNames *index_columns = indices->get_index_columns(from[i].first, index_name);
+                table_indices.push_back(make_pair(index_name, *index_columns));
+                delete index_columns;
+            }
+            delete index_names;
+            delete bloom_filters;
+            stats.push_back(statistics->get(from[i].first));
+            paths.push_back(CostModel::choose_access_path(from[i].first, table->get_block_count(), stats.back(),
+                                                          wheres[i], table_indices));
+            message += paths.back().to_string() + (stats.back() == nullptr ? " [not analyzed]" : "") + "\n";
+        }
+        if (paths.size() > 1) {
+            message += "join order:";
+            for (auto i : CostModel::join_order(paths, stats, joins))
+                message += " " + from[i].first;
+            message += "\n";
+        }
+        message.pop_back();
+        return new QueryResult(message);
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (DbException &e) {
+        throw SQLExecError(string("DbException: ") + e.what());
+    }
+}
+
+// run one statement through the parser and SQLExec
+static QueryResult *run_sql(const string &sql) {
+    hsql::SQLParserResult *parse = hsql::SQLParser::parseSQLString(sql);
+    if (parse == nullptr || !parse->isValid() || parse->size() != 1) {
+        delete parse;
+        throw SQLExecError("cannot parse " + sql);
+    }
+    QueryResult *result;
+    try {
+        result = SQLExec::execute(parse->getStatement(0));
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    delete parse;
+    return result;
+}
+
+// how many rows a statement returns
+static size_t count_rows(const string &sql) {
+    QueryResult *result = run_sql(sql);
+    size_t n = result->get_rows() == nullptr ? 0 : result->get_rows()->size();
+    delete result;
+    return n;
+}
+
+// test function -- returns true if all tests pass
+bool test_sql_exec() {
+    const string table = "_test_exec_cpp";
+    try {
+        // the catalog follows CREATE and DROP, and a dropped table's name can be used again
+        delete run_sql("create table " + table + " (a int, b text)");
+        if (count_rows("show columns from " + table) != 2)
+            return false;
+
+        // sessions on several threads share the table (and its file handle)
+        const int n_threads = 4, n_rows = 50;
+        std::vector<std::thread> sessions;
+        std::atomic<int> failures(0);
+        for (int t = 0; t < n_threads; t++) {
+            sessions.push_back(std::thread([&, t]() {
+                for (int i = 0; i < n_rows; i++) {
+                    try {
+                        delete run_sql("insert into " + table + " values (" + to_string(t * n_rows + i) + ", 'row')");
+                    } catch (std::exception &e) {
+                        failures++;
+                    }
+                }
+            }));
+        }
+        for (auto &session : sessions)
+            session.join();
+        if (failures > 0 || count_rows("select * from " + table) != (size_t) (n_threads * n_rows)
+            || count_rows("select * from " + table + " where a = 7") != 1)
+            return false;
+        std::cout << "sessions ok" << std::endl;
+
+        // far more groups than the budget holds: spilled, and each partition partitioned again
+        const int n_groups = 3000;
+        HashAggregate aggregate(ColumnNames{"g"}, ColumnAttributes{ColumnAttribute(ColumnAttribute::INT)},
+                                Aggregates{Aggregate(Aggregate::COUNT, "", "n"), Aggregate(Aggregate::SUM, "v", "s")},
+                                ColumnAttributes{ColumnAttribute(ColumnAttribute::INT),
+                                                 ColumnAttribute(ColumnAttribute::INT)}, 4096);
+        for (int i = 0; i < 2 * n_groups; i++) {
+            ValueDict row;
+            row["g"] = Value(i % n_groups);
+            row["v"] = Value(i);
+            aggregate.add(row);
+        }
+        ValueDicts *groups = aggregate.results();
+        bool grouped = groups->size() == (size_t) n_groups;
+        for (auto row : *groups) {
+            int32_t g = row->at("g").n;
+            grouped = grouped && row->at("n").n == 2 && row->at("s").n == 2 * g + n_groups;
+            delete row;
+        }
+        delete groups;
+        if (!grouped)
+            return false;
+        std::cout << "aggregate ok" << std::endl;
+
+        delete run_sql("drop table " + table);
+        if (count_rows("show columns from " + table) != 0)
+            return false;
+        QueryResult *result = run_sql("show tables");
+        for (auto const &row : *result->get_rows())
+            if (row->at("table_name").s == table) {
+                delete result;
+                return false;
+            }
+        delete result;
+        delete run_sql("create table " + table + " (c int)");
+        bool recreated = count_rows("show columns from " + table) == 1 && count_rows("select * from " + table) == 0;
+        delete run_sql("drop table " + table);
+        if (!recreated)
+            return false;
+        std::cout << "catalog ok" << std::endl;
+    } catch (std::exception &e) {
+        std::cout << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,220 @@
+/**
+ * @file sql_exec.h - Execution of parsed SQL statements against the catalog and heap storage.
+ * SQLExecError
+ * QueryResult
+ * SQLExec
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <exception>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include "SQLParser.h"
+#include "latch.h"
+#include "aggregate.h"
+#include "schema_tables.h"
+#include "sort.h"
+
+/**
+ * @class SQLExecError - exception for SQLExec methods
+ */
+class SQLExecError : public std::runtime_error {
+public:
+    explicit SQLExecError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class QueryResult - data structure to hold all the returned data for a query execution
+ */
+class QueryResult {
+public:
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+
+    QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
+                                       message(message) {}
+
+    /**
+     * Takes ownership of column_names, column_attributes and rows.
+     */
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows,
+                std::string message) : column_names(column_names), column_attributes(column_attributes), rows(rows),
+                                       message(message) {}
+
+    virtual ~QueryResult();
+
+    QueryResult(const QueryResult &other) = delete;
+
+    QueryResult &operator=(const QueryResult &other) = delete;
+
+    ColumnNames *get_column_names() const { return column_names; }
+
+    ColumnAttributes *get_column_attributes() const { return column_attributes; }
+
+    ValueDicts *get_rows() const { return rows; }
+
+    const std::string &get_message() const { return message; }
+
+    friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
+
+protected:
+    ColumnNames *column_names;
+    ColumnAttributes *column_attributes;
+    ValueDicts *rows;
+    std::string message;
+};
+
+/**
+ * @class SQLExec - execution engine
+ *
+ * Safe to call from several threads at once: statements share the schema latch,
+ * and statements that change the schema (CREATE, DROP, COMPACT) hold it exclusively.
+ */
+class SQLExec {
+public:
+    /**
+     * Execute the given SQL statement.
+     * @param statement   the Hyrise AST of the SQL statement to execute
+     * @returns           the query result (freed by caller)
+     * @throws SQLExecError  if the statement cannot be executed
+     */
+    static QueryResult *execute(const hsql::SQLStatement *statement);
+
+    /**
+     * Execute a CREATE TABLE, storing the table as storage_type (see Storage), e.g. as a ColumnTable.
+     * @param dictionary_columns  TEXT columns of a heap table to DICTIONARY-encode (the parser has no syntax for it)
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *create_table(const hsql::CreateStatement *statement, const std::string &storage_type,
+                                     const ColumnNames &dictionary_columns = ColumnNames());
+
+    /**
+     * Execute a CREATE INDEX as an index of index_type; only Indices::BLOOM (a BloomFilter
+     * per block of a heap table) is implemented.
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *create_index(const hsql::CreateStatement *statement, const std::string &index_type);
+
+    /**
+     * Rewrite a table into compressed blocks (see HeapTable::compact).
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *compact(const Identifier &table_name);
+
+    /**
+     * Remove the row versions of a table nobody can see any more (see HeapTable::vacuum).
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *vacuum(const Identifier &table_name);
+
+    /**
+     * VACUUM FULL: rewrite a table into just the row versions someone may still see, while
+     * it is read and changed as usual but for a brief pause (see HeapRewrite).
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *rewrite(const Identifier &table_name);
+
+    /**
+     * Sample a table and keep its statistics in the catalog for the cost model (see TableStatistics::analyze).
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *analyze(const Identifier &table_name);
+
+    /**
+     * How a select statement would read its tables: the access path the cost model picks
+     * for each, and the order it would join them in.
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *explain(const hsql::SelectStatement *statement);
+
+protected:
+    // the catalog, shared by every statement
+    static Tables *tables;
+    static Columns *columns;
+    static Indices *indices;
+    static Statistics *statistics;
+    static Storage *storage;
+    static std::once_flag initialized;
+    static RWLatch schema_latch;
+
+    static void initialize();
+
+    // recursive descent into the AST
+    static QueryResult *create(const hsql::CreateStatement *statement, const std::string &storage_type = Storage::HEAP,
+                               const ColumnNames &dictionary_columns = ColumnNames());
+
+    static QueryResult *drop(const hsql::DropStatement *statement);
+
+    static QueryResult *create_bloom_index(const hsql::CreateStatement *statement);
+
+    static QueryResult *drop_index(const hsql::DropStatement *statement);
+
+    static QueryResult *show(const hsql::ShowStatement *statement);
+
+    static QueryResult *show_tables();
+
+    static QueryResult *show_columns(const hsql::ShowStatement *statement);
+
+    static QueryResult *show_index(const hsql::ShowStatement *statement);
+
+    static QueryResult *insert(const hsql::InsertStatement *statement);
+
+    static QueryResult *select(const hsql::SelectStatement *statement);
+
+    /**
+     * Rows for handles in ORDER BY order, through an ExternalSort.
+     * @param limit   rows wanted after the first offset; 0 for all of them
+     * @param rows    the rows, projected to column_names, are added to this
+     */
+    static void sorted(DbRelation &table, const Handles &handles, const std::vector<hsql::OrderDescription *> &order,
+                       const ColumnNames &column_names, size_t limit, size_t offset, ValueDicts &rows);
+
+    /**
+     * Add the rest of a sort's rows after the first offset, projected to column_names.
+     */
+    static void drain(ExternalSort &sort, const ColumnNames &column_names, size_t offset, ValueDicts &rows);
+
+    /**
+     * Rows of a select with GROUP BY or aggregates, through a HashAggregate.
+     * @param column_names       the result's columns are added to this
+     * @param column_attributes  and their attributes to this
+     */
+    static void aggregated(DbRelation &table, const Handles &handles, const hsql::SelectStatement *statement,
+                           ColumnNames &column_names, ColumnAttributes &column_attributes, size_t limit,
+                           size_t offset, ValueDicts &rows);
+
+    /**
+     * The Aggregate for a COUNT, SUM, MIN or MAX in the AST.
+     */
+    static Aggregate aggregate_function(const hsql::Expr *expr);
+
+    /**
+     * Pull out column name and attributes from AST's column definition clause
+     * @param col                AST column definition
+     * @param column_name        returned by reference
+     * @param column_attribute   returned by reference
+     */
+    static void column_definition(const hsql::ColumnDefinition *col, Identifier &column_name,
+                                  ColumnAttribute &column_attribute);
+
+    /**
+     * The value of a literal, checked against the type of the column it is for.
+     */
+    static Value literal(const hsql::Expr *expr, ColumnAttribute column_attribute);
+
+    /**
+     * Turn a where clause of ANDed column = literal comparisons into a ValueDict.
+     * @throws SQLExecError  for anything else
+     */
+    static void get_where_conjunction(const hsql::Expr *expr, DbRelation &table, ValueDict &where);
+
+    /**
+     * The tables a FROM clause names (table name, alias) and the conditions of its joins.
+     */
+    static void get_from_tables(const hsql::TableRef *table_ref, std::vector<std::pair<Identifier, Identifier>> &from,
+                                std::vector<const hsql::Expr *> &conditions);
+};
+
+bool test_sql_exec();
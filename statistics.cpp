@@ -0,0 +1,307 @@
+/**
+ * @file statistics.cpp - implementation of statistics and the cost model:
+ * HyperLogLog, Histogram, ColumnStatistics, TableStatistics, AccessPath, CostModel
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <sstream>
+
+/**
+ * HyperLogLog implementation
+ */
+
+// splitmix64 finalizer: std::hash of an int is the int itself, which would put every
+// small key in register 0
+static u_int64_t mix(u_int64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+u_int64_t HyperLogLog::hash(const Value &value) {
+    if (value.data_type == ColumnAttribute::INT)
+        return mix((u_int64_t) (u_int32_t) value.n);
+    return mix(std::hash<std::string>()(value.s));
+}
+
+// the top P bits pick a register; it keeps the longest run of leading zeros seen in the rest
+void HyperLogLog::add(const Value &value) {
+    u_int64_t h = hash(value);
+    uint index = (uint) (h >> (64 - P));
+    u_int64_t rest = (h << P) | (1ULL << (P - 1));  // the sentinel bit caps the run
+    u_int8_t rank = (u_int8_t) (__builtin_clzll(rest) + 1);
+    if (rank > this->registers[index])
+        this->registers[index] = rank;
+}
+
+// harmonic mean of the registers, with linear counting for small cardinalities
+double HyperLogLog::estimate() const {
+    double sum = 0.0;
+    uint zeros = 0;
+    for (auto const &rank : this->registers) {
+        sum += std::ldexp(1.0, -rank);
+        if (rank == 0)
+            zeros++;
+    }
+    double alpha = 0.7213 / (1.0 + 1.079 / M);
+    double estimate = alpha * M * M / sum;
+    if (estimate <= 2.5 * M && zeros > 0)
+        estimate = M * std::log((double) M / zeros);
+    return estimate;
+}
+
+/**
+ * Histogram implementation
+ */
+bool Histogram::less(const Value &a, const Value &b) {
+    if (a.data_type == ColumnAttribute::INT)
+        return a.n < b.n;
+    return a.s < b.s;
+}
+
+Histogram Histogram::build(std::vector<Value> &values, uint n_buckets) {
+    Histogram histogram;
+    if (values.empty())
+        return histogram;
+    std::sort(values.begin(), values.end(), less);
+    histogram.bounds.push_back(values.front());
+    for (uint i = 1; i <= n_buckets; i++)
+        histogram.bounds.push_back(values[(values.size() * i + n_buckets - 1) / n_buckets - 1]);
+    return histogram;
+}
+
+bool Histogram::covers(const Value &value) const {
+    if (this->bounds.empty())
+        return true;
+    return !less(value, this->bounds.front()) && !less(this->bounds.back(), value);
+}
+
+double Histogram::fraction_at_most(const Value &value) const {
+    if (this->bounds.empty())
+        return 0.5;
+    if (less(value, this->bounds.front()))
+        return 0.0;
+    if (!less(value, this->bounds.back()))
+        return 1.0;
+    uint n_buckets = this->bounds.size() - 1;
+    uint i = 1;
+    while (!less(value, this->bounds[i]))
+        i++;
+    const Value &low = this->bounds[i - 1], &high = this->bounds[i];
+    double within = 0.5;
+    if (value.data_type == ColumnAttribute::INT && high.n > low.n)
+        within = (double) ((int64_t) value.n - low.n) / ((int64_t) high.n - low.n);
+    return (i - 1 + within) / n_buckets;
+}
+
+std::string Histogram::serialize() const {
+    std::string text;
+    for (auto const &bound : this->bounds) {
+        std::string value = bound.data_type == ColumnAttribute::INT ? std::to_string(bound.n) : bound.s;
+        text += std::to_string(value.size()) + ":" + value;
+    }
+    return text;
+}
+
+Histogram Histogram::deserialize(const std::string &text, ColumnAttribute::DataType data_type) {
+    Histogram histogram;
+    size_t at = 0;
+    while (at < text.size()) {
+        size_t colon = text.find(':', at);
+        if (colon == std::string::npos)
+            throw DbRelationError("bad histogram in catalog");
+        size_t size = std::stoul(text.substr(at, colon - at));
+        std::string value = text.substr(colon + 1, size);
+        if (data_type == ColumnAttribute::INT)
+            histogram.bounds.push_back(Value((int32_t) std::stol(value)));
+        else
+            histogram.bounds.push_back(Value(value));
+        at = colon + 1 + size;
+    }
+    return histogram;
+}
+
+/**
+ * ColumnStatistics implementation
+ */
+
+// a value outside what the sample saw may still be there, so guess one row rather than none
+double ColumnStatistics::selectivity_eq(const Value &value, double row_count) const {
+    if (row_count < 1.0)
+        return 1.0;
+    if (!this->histogram.covers(value))
+        return 1.0 / row_count;
+    return 1.0 / std::max(1.0, this->n_distinct);
+}
+
+/**
+ * TableStatistics implementation
+ */
+const ColumnStatistics *TableStatistics::column(const Identifier &column_name) const {
+    for (auto const &column : this->columns)
+        if (column.column_name == column_name)
+            return &column;
+    return nullptr;
+}
+
+TableStatistics *TableStatistics::analyze(HeapTable &table, uint sample_blocks) {
+    u_int32_t block_count;
+    Handles *handles = table.sample(sample_blocks, block_count);
+    u_int32_t sampled_blocks = std::min<u_int32_t>(sample_blocks, block_count);
+    double sampled_rows = handles->size();
+    double row_count = sampled_blocks == 0 ? 0.0 : sampled_rows * block_count / sampled_blocks;
+    TableStatistics *stats = new TableStatistics(table.get_table_name(), row_count, block_count);
+
+    const ColumnNames &column_names = table.get_column_names();
+    const ColumnAttributes &column_attributes = table.get_column_attributes();
+    std::vector<HyperLogLog> sketches(column_names.size());
+    std::vector<std::vector<Value>> samples(column_names.size());
+    for (auto const &handle : *handles) {
+        ValueDict *row = table.project(handle);
+        for (uint i = 0; i < column_names.size(); i++) {
+            const Value &value = row->at(column_names[i]);
+            sketches[i].add(value);
+            samples[i].push_back(value);
+        }
+        delete row;
+    }
+    delete handles;
+
+    for (uint i = 0; i < column_names.size(); i++) {
+        double n_distinct = std::min(sketches[i].estimate(), sampled_rows);
+        // a column that is nearly unique in the sample is taken to be nearly unique in the
+        // whole table; otherwise the sample has probably already seen most of its values
+        if (sampled_rows > 0 && sampled_rows < row_count && n_distinct > 0.9 * sampled_rows)
+            n_distinct *= row_count / sampled_rows;
+        ColumnAttribute attribute = column_attributes[i];
+        stats->columns.push_back(ColumnStatistics(column_names[i], attribute.get_data_type(), std::round(n_distinct),
+                                                  Histogram::build(samples[i])));
+    }
+    return stats;
+}
+
+/**
+ * AccessPath implementation
+ */
+std::string AccessPath::to_string() const {
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    if (this->method == INDEX)
+        out << "index " << this->table_name << "." << this->index_name;
+    else
+        out << "scan " << this->table_name;
+    out << " (rows " << this->rows << ", cost " << this->cost << ")";
+    return out.str();
+}
+
+/**
+ * CostModel implementation
+ */
+constexpr double CostModel::RANDOM_READ_COST;
+constexpr double CostModel::DEFAULT_SELECTIVITY;
+constexpr double CostModel::DEFAULT_ROWS_PER_BLOCK;
+constexpr double CostModel::INDEX_FANOUT;
+
+AccessPath CostModel::choose_access_path(const Identifier &table_name, u_int32_t block_count,
+                                         const TableStatistics *stats, const ValueDict &where,
+                                         const std::vector<std::pair<Identifier, ColumnNames>> &indices) {
+    // statistics may be from when the table was smaller or larger
+    double rows = block_count * DEFAULT_ROWS_PER_BLOCK;
+    if (stats != nullptr)
+        rows = stats->block_count == 0 ? 0.0 : stats->row_count * block_count / stats->block_count;
+
+    auto selectivity = [&](const Identifier &column_name) {
+        const ColumnStatistics *column = stats == nullptr ? nullptr : stats->column(column_name);
+        return column == nullptr ? DEFAULT_SELECTIVITY : column->selectivity_eq(where.at(column_name), rows);
+    };
+
+    AccessPath path(table_name);
+    path.rows = rows;
+    for (auto const &predicate : where)
+        path.rows *= selectivity(predicate.first);
+    path.cost = block_count;
+
+    // an index helps with the predicates on a leading prefix of its key
+    for (auto const &index : indices) {
+        double matches = rows;
+        uint prefix = 0;
+        for (auto const &column_name : index.second) {
+            if (where.count(column_name) == 0)
+                break;
+            matches *= selectivity(column_name);
+            prefix++;
+        }
+        if (prefix == 0)
+            continue;
+        double depth = std::max(1.0, std::ceil(std::log(std::max(rows, 1.0)) / std::log(INDEX_FANOUT)));
+        double cost = (depth + matches) * RANDOM_READ_COST;
+        if (cost < path.cost) {
+            path.method = AccessPath::INDEX;
+            path.index_name = index.first;
+            path.cost = cost;
+        }
+    }
+    return path;
+}
+
+std::vector<size_t> CostModel::join_order(const std::vector<AccessPath> &inputs,
+                                          const std::vector<const TableStatistics *> &stats,
+                                          const std::vector<JoinPredicate> &predicates) {
+    std::vector<size_t> order;
+    if (inputs.empty())
+        return order;
+
+    auto input = [&](const Identifier &table_name) {
+        for (size_t i = 0; i < inputs.size(); i++)
+            if (inputs[i].table_name == table_name)
+                return i;
+        return inputs.size();
+    };
+    // without statistics, a join column is taken to be a key of its table
+    auto n_distinct = [&](size_t i, const Identifier &column_name) {
+        const ColumnStatistics *column = stats[i] == nullptr ? nullptr : stats[i]->column(column_name);
+        return std::max(1.0, column == nullptr ? inputs[i].rows : column->n_distinct);
+    };
+
+    std::vector<bool> joined(inputs.size(), false);
+    size_t first = 0;
+    for (size_t i = 1; i < inputs.size(); i++)
+        if (inputs[i].rows < inputs[first].rows)
+            first = i;
+    order.push_back(first);
+    joined[first] = true;
+    double rows = inputs[first].rows;
+
+    while (order.size() < inputs.size()) {
+        size_t best = inputs.size();
+        double best_rows = std::numeric_limits<double>::infinity();
+        for (size_t next = 0; next < inputs.size(); next++) {
+            if (joined[next])
+                continue;
+            double result = rows * inputs[next].rows;
+            for (auto const &predicate : predicates) {
+                size_t left = input(predicate.left_table), right = input(predicate.right_table);
+                if (left == inputs.size() || right == inputs.size())
+                    continue;
+                if ((left == next && joined[right]) || (right == next && joined[left]))
+                    result /= std::max(n_distinct(left, predicate.left_column),
+                                       n_distinct(right, predicate.right_column));
+            }
+            if (result < best_rows) {
+                best = next;
+                best_rows = result;
+            }
+        }
+        order.push_back(best);
+        joined[best] = true;
+        rows = best_rows;
+    }
+    return order;
+}
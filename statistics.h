@@ -0,0 +1,192 @@
+/**
+ * @file statistics.h - Table and column statistics, and the cost model that uses them.
+ * HyperLogLog
+ * Histogram
+ * ColumnStatistics
+ * TableStatistics
+ * AccessPath
+ * CostModel
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class HyperLogLog - estimates the number of distinct values in a stream, in 4KB
+ */
+class HyperLogLog {
+public:
+    static const uint P = 12;           // 2^P registers; standard error about 1.04 / sqrt(2^P), under 2%
+    static const uint M = 1 << P;
+
+    HyperLogLog() : registers(M, 0) {}
+
+    void add(const Value &value);
+
+    double estimate() const;
+
+    /**
+     * A well-mixed 64-bit hash of a value.
+     */
+    static u_int64_t hash(const Value &value);
+
+protected:
+    std::vector<u_int8_t> registers;
+};
+
+/**
+ * @class Histogram - equi-depth histogram: each bucket holds about the same number of values
+ *
+ * bounds[0] is the smallest value seen and bounds[i] is the largest value in bucket i.
+ */
+class Histogram {
+public:
+    static const uint N_BUCKETS = 10;
+
+    Histogram() {}
+
+    /**
+     * Build from a sample of values (sorts them).
+     */
+    static Histogram build(std::vector<Value> &values, uint n_buckets = N_BUCKETS);
+
+    bool empty() const { return bounds.empty(); }
+
+    /**
+     * Could value be in the column at all (is it between the smallest and largest values seen)?
+     */
+    bool covers(const Value &value) const;
+
+    /**
+     * Fraction of the values that are less than or equal to value, interpolated within a bucket for INT.
+     */
+    double fraction_at_most(const Value &value) const;
+
+    /**
+     * For the catalog: length-prefixed bounds, "3:abc5:defgh"; INT bounds in decimal.
+     */
+    std::string serialize() const;
+
+    static Histogram deserialize(const std::string &text, ColumnAttribute::DataType data_type);
+
+    const std::vector<Value> &get_bounds() const { return bounds; }
+
+    static bool less(const Value &a, const Value &b);
+
+protected:
+    std::vector<Value> bounds;
+};
+
+/**
+ * @class ColumnStatistics - what ANALYZE found for one column
+ */
+class ColumnStatistics {
+public:
+    ColumnStatistics(Identifier column_name, ColumnAttribute::DataType data_type, double n_distinct,
+                     Histogram histogram) : column_name(column_name), data_type(data_type), n_distinct(n_distinct),
+                                            histogram(histogram) {}
+
+    Identifier column_name;
+    ColumnAttribute::DataType data_type;
+    double n_distinct;
+    Histogram histogram;
+
+    /**
+     * Estimated fraction of rows where this column = value.
+     */
+    double selectivity_eq(const Value &value, double row_count) const;
+};
+
+/**
+ * @class TableStatistics - what ANALYZE found for a table
+ */
+class TableStatistics {
+public:
+    static const uint SAMPLE_BLOCKS = 256;  // ANALYZE reads at most this many blocks
+
+    TableStatistics(Identifier table_name, double row_count, u_int32_t block_count) : table_name(table_name),
+            row_count(row_count), block_count(block_count) {}
+
+    Identifier table_name;
+    double row_count;
+    u_int32_t block_count;
+    std::vector<ColumnStatistics> columns;
+
+    /**
+     * Statistics for a column, or nullptr.
+     */
+    const ColumnStatistics *column(const Identifier &column_name) const;
+
+    /**
+     * Sample up to sample_blocks of a table's blocks and estimate its statistics from them.
+     * @returns  the statistics (freed by caller)
+     */
+    static TableStatistics *analyze(HeapTable &table, uint sample_blocks = SAMPLE_BLOCKS);
+};
+
+/**
+ * @class AccessPath - how to read one table for a query, with its estimated rows and cost
+ */
+class AccessPath {
+public:
+    enum Method {
+        SCAN, INDEX
+    };
+
+    AccessPath(Identifier table_name) : table_name(table_name), method(SCAN), rows(0), cost(0) {}
+
+    Identifier table_name;
+    Method method;
+    Identifier index_name;      // when method is INDEX
+    double rows;                // estimated rows that pass the table's own predicates
+    double cost;                // in block reads (see CostModel)
+
+    std::string to_string() const;
+};
+
+/**
+ * @class CostModel - estimates for choosing how a select statement reads its tables
+ *
+ * Costs are in sequential block reads. A scan reads every block; an index lookup
+ * descends the index and then reads one (random) block per matching row. Tables
+ * that were never ANALYZEd get System R-style defaults.
+ */
+class CostModel {
+public:
+    static constexpr double RANDOM_READ_COST = 4.0;     // one random block read, in sequential reads
+    static constexpr double DEFAULT_SELECTIVITY = 0.1;  // of an equality predicate without statistics
+    static constexpr double DEFAULT_ROWS_PER_BLOCK = 50.0;
+    static constexpr double INDEX_FANOUT = 200.0;
+
+    /**
+     * Cheapest way to read a table with the given equality predicates.
+     * @param stats    the table's statistics, or nullptr
+     * @param indices  each index on the table: its name and key columns
+     */
+    static AccessPath choose_access_path(const Identifier &table_name, u_int32_t block_count,
+                                         const TableStatistics *stats, const ValueDict &where,
+                                         const std::vector<std::pair<Identifier, ColumnNames>> &indices);
+
+    /**
+     * @class JoinPredicate - left_table.left_column = right_table.right_column
+     */
+    struct JoinPredicate {
+        Identifier left_table, left_column, right_table, right_column;
+    };
+
+    /**
+     * Greedy left-deep join order: start with the smallest input, then repeatedly join
+     * whichever remaining input gives the smallest estimated result.
+     * @param inputs      one access path per table
+     * @param stats       statistics per input (entries may be nullptr)
+     * @param predicates  equi-join predicates between the inputs
+     * @returns           indexes into inputs, in join order
+     */
+    static std::vector<size_t> join_order(const std::vector<AccessPath> &inputs,
+                                          const std::vector<const TableStatistics *> &stats,
+                                          const std::vector<JoinPredicate> &predicates);
+};
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <exception>
+#include <future>
 #include <map>
 #include <utility>
 #include <vector>
@@ -134,6 +135,9 @@ typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an
  * 	get_new()
  *	get(block_id)
  *	put(block)
+ *	get_async(block_id)
+ *	put_async(block)
+ *	flush()
  *	block_ids()
  */
 class DbFile {
@@ -182,6 +186,46 @@ public:
      */
     virtual void put(DbBlock *block) = 0;
 
+    /**
+     * Start getting a block; wait for (or poll) the future for it.
+     * Unless a subclass can do better, the block is read before this returns.
+     * @param block_id  which block to get
+     * @returns         future of the DbBlock (freed by caller)
+     */
+    virtual std::future<DbBlock *> get_async(BlockID block_id) {
+        std::promise<DbBlock *> block;
+        try {
+            block.set_value(this->get(block_id));
+        } catch (...) {
+            block.set_exception(std::current_exception());
+        }
+        return block.get_future();
+    }
+
+    /**
+     * Start writing a block. Writes reach the file in the order they are started, but
+     * may be queued until flush(), so until then get() may still see the old block.
+     * @param block  block to write (takes ownership of it)
+     * @returns      future that is ready once it is written
+     */
+    virtual std::future<void> put_async(DbBlock *block) {
+        std::promise<void> written;
+        try {
+            this->put(block);
+            written.set_value();
+        } catch (...) {
+            written.set_exception(std::current_exception());
+        }
+        delete block;
+        return written.get_future();
+    }
+
+    /**
+     * Wait until every block started with put_async is written.
+     * @throws  whatever the first failed write since the last flush() threw
+     */
+    virtual void flush() {}
+
     /**
      * Get a list of all the valid BlockID's in the file
      * FIXME - not a good long-term approach, but we'll do this until we put in iterators
@@ -203,7 +247,15 @@ public:
         INT, TEXT
     };
 
-    ColumnAttribute(DataType data_type) : data_type(data_type) {}
+    /**
+     * How a column's values are stored: PLAIN as they are, or (TEXT only) DICTIONARY as
+     * small codes into a dictionary kept for the table, for columns with few distinct values.
+     */
+    enum Encoding {
+        PLAIN, DICTIONARY
+    };
+
+    ColumnAttribute(DataType data_type, Encoding encoding = PLAIN) : data_type(data_type), encoding(encoding) {}
 
     virtual ~ColumnAttribute() {}
 
@@ -211,8 +263,13 @@ public:
 
     virtual void set_data_type(DataType data_type) { this->data_type = data_type; }
 
+    virtual Encoding get_encoding() { return encoding; }
+
+    virtual void set_encoding(Encoding encoding) { this->encoding = encoding; }
+
 protected:
     DataType data_type;
+    Encoding encoding;
 };
 
 
@@ -239,6 +296,7 @@ typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
+typedef std::vector<ValueDict *> ValueDicts;
 
 
 /**
@@ -268,9 +326,12 @@ public:
  *	select(where)
  *	project(handle)
  *	project(handle, column_names)
+ *	project_rows(begin, end, column_names, rows)
  */
 class DbRelation {
 public:
+    static const size_t PROJECT_BATCH = 1024;   // rows callers hand project_rows at a time
+
     // ctor/dtor
     DbRelation(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : table_name(
             table_name), column_names(column_names), column_attributes(column_attributes) {}
@@ -359,6 +420,28 @@ public:
      */
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) = 0;
 
+    /**
+     * Project a run of rows, in order (SELECT <column_names> for each of them).
+     * Unless a subclass can do better, each row is projected by itself.
+     * @param begin, end    the handles of the rows
+     * @param column_names  list of column names to project (all of them if nullptr or empty)
+     * @param rows          gets a dictionary of values for each row appended (freed by caller)
+     */
+    virtual void project_rows(Handles::const_iterator begin, Handles::const_iterator end,
+                              const ColumnNames *column_names, ValueDicts &rows) {
+        for (Handles::const_iterator handle = begin; handle != end; handle++)
+            rows.push_back(this->project(*handle, column_names));
+    }
+
+    /**
+     * Accessors for the relation's schema.
+     */
+    virtual const Identifier &get_table_name() const { return table_name; }
+
+    virtual const ColumnNames &get_column_names() const { return column_names; }
+
+    virtual const ColumnAttributes &get_column_attributes() const { return column_attributes; }
+
 protected:
     Identifier table_name;
     ColumnNames column_names;
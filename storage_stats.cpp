@@ -0,0 +1,126 @@
+/**
+ * @file storage_stats.cpp - implementation of StorageStats and BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "storage_stats.h"
+#include <cstdlib>
+
+std::mutex StorageStats::registry_mutex;
+StorageStats::ThreadCounters *StorageStats::registry = nullptr;
+StatValues StorageStats::retired;
+
+static const char *counter_names[N_STAT_COUNTERS] = {
+        "block_gets", "block_puts", "block_news", "bytes_read", "bytes_written", "block_get_ns", "block_put_ns",
+        "records_added", "rows_marshaled", "rows_unmarshaled", "rows_examined", "rows_filtered",
+        "overflow_reads", "overflow_writes", "async_gets", "async_puts",
+        "log_records", "log_bytes", "log_flushes", "checkpoints", "blocks_skipped"
+};
+
+StatValues StatValues::operator-(const StatValues &other) const {
+    StatValues difference;
+    for (uint i = 0; i < N_STAT_COUNTERS; i++)
+        difference.values[i] = values[i] - other.values[i];
+    return difference;
+}
+
+void StatValues::print(std::ostream &out) const {
+    for (uint i = 0; i < N_STAT_COUNTERS; i++)
+        out << StorageStats::name((StatCounter) i) << ": " << values[i] << std::endl;
+}
+
+StorageStats::ThreadCounters::ThreadCounters() {
+    for (uint i = 0; i < N_STAT_COUNTERS; i++)
+        counters[i].store(0);
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    next = registry;
+    registry = this;
+}
+
+StorageStats::ThreadCounters::~ThreadCounters() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (uint i = 0; i < N_STAT_COUNTERS; i++)
+        retired.values[i] += counters[i].load(std::memory_order_relaxed);
+    for (ThreadCounters **p = &registry; *p != nullptr; p = &(*p)->next) {
+        if (*p == this) {
+            *p = next;
+            break;
+        }
+    }
+}
+
+StatValues StorageStats::thread_totals() {
+    StatValues result;
+    ThreadCounters &counters = mine();
+    for (uint i = 0; i < N_STAT_COUNTERS; i++)
+        result.values[i] = counters.counters[i].load(std::memory_order_relaxed);
+    return result;
+}
+
+StatValues StorageStats::totals() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    StatValues result = retired;
+    for (ThreadCounters *counters = registry; counters != nullptr; counters = counters->next)
+        for (uint i = 0; i < N_STAT_COUNTERS; i++)
+            result.values[i] += counters->counters[i].load(std::memory_order_relaxed);
+    return result;
+}
+
+// A thread adding at the same moment may lose that one increment; that's fine for stats.
+void StorageStats::reset() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    retired.clear();
+    for (ThreadCounters *counters = registry; counters != nullptr; counters = counters->next)
+        for (uint i = 0; i < N_STAT_COUNTERS; i++)
+            counters->counters[i].store(0, std::memory_order_relaxed);
+}
+
+const char *StorageStats::name(StatCounter counter) {
+    return counter_names[counter];
+}
+
+u_int64_t BufferPool::cache_bytes = 0;
+size_t BufferPool::mmap_bytes = 0;
+u_int32_t BufferPool::page_size = 0;
+
+void BufferPool::configure(DbEnv *env) {
+    static const u_int64_t GB = 1024 * 1024 * 1024;
+    if (cache_bytes != 0)
+        env->set_cachesize((u_int32_t) (cache_bytes / GB), (u_int32_t) (cache_bytes % GB), 1);
+    if (mmap_bytes != 0)
+        env->set_mp_mmapsize(mmap_bytes);
+}
+
+static double hit_ratio(u_int64_t hits, u_int64_t misses) {
+    return hits + misses == 0 ? 0.0 : (double) hits / (double) (hits + misses);
+}
+
+void BufferPool::print(DbEnv *env, std::ostream &out) {
+    DB_MPOOL_STAT *pool = nullptr;
+    DB_MPOOL_FSTAT **files = nullptr;
+    env->memp_stat(&pool, &files, 0);
+    if (pool != nullptr) {
+        u_int64_t hits = pool->st_cache_hit, misses = pool->st_cache_miss;
+        out << "cache_bytes: " << (u_int64_t) pool->st_gbytes * 1024 * 1024 * 1024 + pool->st_bytes << std::endl;
+        out << "caches: " << (u_int64_t) pool->st_ncache << std::endl;
+        out << "pages: " << (u_int64_t) pool->st_pages << std::endl;
+        out << "hits: " << hits << std::endl;
+        out << "misses: " << misses << std::endl;
+        out << "hit_ratio: " << hit_ratio(hits, misses) << std::endl;
+        out << "pages_in: " << (u_int64_t) pool->st_page_in << std::endl;
+        out << "pages_out: " << (u_int64_t) pool->st_page_out << std::endl;
+        out << "clean_evictions: " << (u_int64_t) pool->st_ro_evict << std::endl;
+        out << "dirty_evictions: " << (u_int64_t) pool->st_rw_evict << std::endl;
+        free(pool);
+    }
+    if (files != nullptr) {
+        for (DB_MPOOL_FSTAT **file = files; *file != nullptr; file++) {
+            u_int64_t hits = (*file)->st_cache_hit, misses = (*file)->st_cache_miss;
+            out << (*file)->file_name << ": page_size " << (u_int64_t) (*file)->st_pagesize
+                << " hits " << hits << " misses " << misses << " hit_ratio " << hit_ratio(hits, misses)
+                << " pages_in " << (u_int64_t) (*file)->st_page_in << " pages_out " << (u_int64_t) (*file)->st_page_out
+                << " mapped " << (u_int64_t) (*file)->st_map << std::endl;
+        }
+        free(files);
+    }
+}
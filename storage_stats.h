@@ -0,0 +1,177 @@
+/**
+ * @file storage_stats.h - Counters and timers for the storage engine.
+ * StorageStats
+ * BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include "db_cxx.h"
+
+/**
+ * What we count. The *_NS counters are nanoseconds spent in that call.
+ */
+enum StatCounter {
+    BLOCK_GETS,         // HeapFile::get
+    BLOCK_PUTS,         // HeapFile::put
+    BLOCK_NEWS,         // HeapFile::get_new
+    BYTES_READ,         // block bytes copied out of BerkeleyDB
+    BYTES_WRITTEN,      // block bytes copied into BerkeleyDB
+    BLOCK_GET_NS,
+    BLOCK_PUT_NS,
+    RECORDS_ADDED,      // SlottedPage::add
+    ROWS_MARSHALED,     // HeapTable::marshal
+    ROWS_UNMARSHALED,   // HeapTable::unmarshal
+    ROWS_EXAMINED,      // rows tested against a where clause
+    ROWS_FILTERED,      // ... and rejected by it
+    OVERFLOW_READS,     // blocks read for out-of-line TEXT values
+    OVERFLOW_WRITES,    // ... and written
+    ASYNC_GETS,         // block reads handed to BlockIO (counted again by the I/O thread that does the get)
+    ASYNC_PUTS,         // ... and writes
+    LOG_RECORDS,        // RedoLog records
+    LOG_BYTES,          // ... and their bytes
+    LOG_FLUSHES,        // RedoLog::commit syncs of the log (one per group of commits)
+    CHECKPOINTS,        // RedoLog::checkpoint
+    BLOCKS_SKIPPED,     // blocks a where clause passed over by their zone maps
+    N_STAT_COUNTERS
+};
+
+/**
+ * A copy of every counter, e.g. for comparing before and after a statement.
+ */
+class StatValues {
+public:
+    StatValues() { clear(); }
+
+    u_int64_t values[N_STAT_COUNTERS];
+
+    void clear() {
+        for (uint i = 0; i < N_STAT_COUNTERS; i++)
+            values[i] = 0;
+    }
+
+    u_int64_t operator[](StatCounter counter) const { return values[counter]; }
+
+    StatValues operator-(const StatValues &other) const;
+
+    /**
+     * One "name: value" line per counter.
+     */
+    void print(std::ostream &out) const;
+};
+
+/**
+ * @class StorageStats - process-wide storage engine counters
+ *
+ * Each thread counts into its own counters (no shared cache lines, no locked
+ * instructions), so counting can stay on all the time. Totals are summed over
+ * all threads, including ones that have exited, when asked for.
+ */
+class StorageStats {
+public:
+    /**
+     * Count n more of counter on this thread.
+     */
+    static void add(StatCounter counter, u_int64_t n = 1) {
+        std::atomic<u_int64_t> &c = mine().counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /**
+     * This thread's counters so far.
+     */
+    static StatValues thread_totals();
+
+    /**
+     * All threads' counters so far.
+     */
+    static StatValues totals();
+
+    /**
+     * Zero every thread's counters.
+     */
+    static void reset();
+
+    /**
+     * Name of a counter, as shown by SHOW STATS.
+     */
+    static const char *name(StatCounter counter);
+
+protected:
+    class ThreadCounters {
+    public:
+        ThreadCounters();
+
+        ~ThreadCounters();
+
+        std::atomic<u_int64_t> counters[N_STAT_COUNTERS];
+        ThreadCounters *next;
+    };
+
+    // every live thread's counters, plus what exited threads counted
+    static std::mutex registry_mutex;
+    static ThreadCounters *registry;
+    static StatValues retired;
+
+    static ThreadCounters &mine() {
+        static thread_local ThreadCounters counters;
+        return counters;
+    }
+};
+
+/**
+ * @class StatTimer - adds the nanoseconds of its lifetime to a counter
+ */
+class StatTimer {
+public:
+    explicit StatTimer(StatCounter counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+
+    ~StatTimer() {
+        StorageStats::add(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+
+    StatTimer(const StatTimer &other) = delete;
+
+    StatTimer &operator=(const StatTimer &other) = delete;
+
+protected:
+    StatCounter counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * @class BufferPool - how BerkeleyDB's memory pool, which every HeapFile's blocks are read
+ * through, is sized, and how well it is doing
+ *
+ * The sizes are set (e.g. from the command line) before the environment is opened, and
+ * configure() hands them to it; page_size is used as each new file is created.
+ */
+class BufferPool {
+public:
+    static u_int64_t cache_bytes;   // 0 for BerkeleyDB's default (256KB)
+    static size_t mmap_bytes;       // largest read-only file mapped instead of read into the cache; 0 for the default
+    static u_int32_t page_size;     // BerkeleyDB page size for new files of blocks up to DbBlock::BLOCK_SZ; 0 to let it choose
+
+    /**
+     * Size env's memory pool; call before env->open().
+     */
+    static void configure(DbEnv *env);
+
+    /**
+     * Is n a page size BerkeleyDB takes (a power of two from 512 to 64KB)?
+     */
+    static bool valid_page_size(u_int32_t n) { return n >= 512 && n <= 65536 && (n & (n - 1)) == 0; }
+
+    /**
+     * The pool's size and its hits, misses and evictions, then the hits, misses and pages read
+     * and written of each file in it, as shown by SHOW BUFFER. BerkeleyDB counts evictions for
+     * the whole pool only; a file's pages_out are its dirty pages written back (evicted or synced).
+     */
+    static void print(DbEnv *env, std::ostream &out);
+};
@@ -0,0 +1,129 @@
+/**
+ * @file transaction.cpp - implementation of TransactionManager
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#include "transaction.h"
+#include <chrono>
+#include <thread>
+#include "mvcc.h"
+#include "storage_engine.h"
+
+bool TransactionManager::is_enabled = false;
+u_int32_t TransactionManager::group_window_us = 0;
+thread_local DbTxn *TransactionManager::txn = nullptr;
+thread_local std::map<const void *, std::function<void()>> TransactionManager::undos;
+std::mutex TransactionManager::group_mutex;
+std::condition_variable TransactionManager::group_flushed;
+u_int64_t TransactionManager::commit_seq = 0;
+u_int64_t TransactionManager::flushed_seq = 0;
+u_int64_t TransactionManager::flushes = 0;
+bool TransactionManager::flushing = false;
+
+// a deadlock (e.g. two sessions' transactions each waiting on a page the other has locked)
+// aborts one of them with DbDeadlockException, rather than leaving both waiting for good
+void TransactionManager::enable(u_int32_t group_window_us) {
+    _DB_ENV->set_lk_detect(DB_LOCK_DEFAULT);
+    TransactionManager::group_window_us = group_window_us;
+    is_enabled = true;
+}
+
+void TransactionManager::begin() {
+    if (!is_enabled)
+        throw TransactionError("transactions are not enabled (start sql5300 with -t)");
+    if (txn != nullptr)
+        throw TransactionError("a transaction is already open");
+    _DB_ENV->txn_begin(nullptr, &txn, 0);
+    VersionManager::begin(); // the whole transaction is one version writer
+}
+
+void TransactionManager::commit() {
+    if (txn == nullptr)
+        throw TransactionError("no open transaction");
+    DbTxn *committing = txn;
+    txn = nullptr;
+    try {
+        committing->commit(DB_TXN_NOSYNC);  // commit record goes to the log buffer only
+    } catch (...) {
+        ended(true); // a commit that fails aborts it, so it is over either way
+        VersionManager::end();
+        throw;
+    }
+    ended(false);
+    VersionManager::end();
+
+    std::unique_lock<std::mutex> lock(group_mutex);
+    wait_for_flush(lock, ++commit_seq);
+}
+
+void TransactionManager::abort() {
+    if (txn == nullptr)
+        throw TransactionError("no open transaction");
+    DbTxn *aborting = txn;
+    txn = nullptr;
+    try {
+        aborting->abort();
+    } catch (...) {
+        ended(true);
+        VersionManager::end();
+        throw;
+    }
+    ended(true);
+    VersionManager::end(); // only now, with its blocks back as they were
+}
+
+void TransactionManager::on_rollback(const void *key, std::function<void()> undo) {
+    undos[key] = undo;
+}
+
+// an undo that fails leaves the rest to run; the transaction is over all the same
+void TransactionManager::ended(bool rolled_back) {
+    std::map<const void *, std::function<void()>> to_run;
+    to_run.swap(undos);
+    if (!rolled_back)
+        return;
+    for (auto const &undo : to_run) {
+        try {
+            undo.second();
+        } catch (...) {
+            // nothing more to be done about it here
+        }
+    }
+}
+
+void TransactionManager::get_counts(u_int64_t &commits, u_int64_t &flushes) {
+    std::lock_guard<std::mutex> lock(group_mutex);
+    commits = commit_seq;
+    flushes = TransactionManager::flushes;
+}
+
+// Either some leader's flush covers seq, or we lead the next one.
+void TransactionManager::wait_for_flush(std::unique_lock<std::mutex> &lock, u_int64_t seq) {
+    while (flushed_seq < seq) {
+        if (flushing) {
+            group_flushed.wait(lock);
+            continue;
+        }
+        flushing = true;
+        if (group_window_us > 0) {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(group_window_us));
+            lock.lock();
+        }
+        u_int64_t target = commit_seq;  // everyone up to here has a commit record in the log buffer
+        lock.unlock();
+        int ret;
+        try {
+            ret = _DB_ENV->log_flush(nullptr);
+        } catch (DbException &e) {
+            ret = e.get_errno();
+        }
+        lock.lock();
+        flushing = false;
+        group_flushed.notify_all();
+        if (ret != 0)
+            throw TransactionError("log flush failed for group commit");
+        flushed_seq = target;
+        flushes++;
+    }
+}
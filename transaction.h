@@ -0,0 +1,140 @@
+/**
+ * @file transaction.h - Transactions over the BerkeleyDB environment, with group commit.
+ * TransactionManager
+ *
+ * @see "Seattle University, CPSC5300, Winter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include "db_cxx.h"
+
+/**
+ * @class TransactionError - generic exception class for TransactionManager
+ */
+class TransactionError : public std::runtime_error {
+public:
+    explicit TransactionError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class TransactionManager - begin/commit/abort of BerkeleyDB transactions
+ *
+ * Only active when the environment was opened with logging and transactions
+ * (see enable()). Each thread has at most one open transaction, which HeapFile
+ * passes to every get/put. With no open transaction, BerkeleyDB auto-commits.
+ *
+ * Group commit: transactions commit without syncing the log, then wait for a
+ * log flush that covers their commit record. The first waiter becomes the leader
+ * and does one log_flush for everyone who committed before it started, so many
+ * concurrent commits share a single fsync.
+ */
+class TransactionManager {
+public:
+    /**
+     * Environment open flags needed for transactions (in addition to DB_CREATE | DB_INIT_MPOOL).
+     */
+    static const u_int32_t ENV_FLAGS = DB_INIT_TXN | DB_INIT_LOG | DB_INIT_LOCK | DB_RECOVER;
+
+    /**
+     * Turn on transactions. Call after opening _DB_ENV with ENV_FLAGS.
+     * @param group_window_us  microseconds a group commit leader waits for more
+     *                         commits to join before flushing (0 flushes at once)
+     */
+    static void enable(u_int32_t group_window_us = 0);
+
+    /**
+     * Is the environment transactional?
+     */
+    static bool enabled() { return is_enabled; }
+
+    /**
+     * Start a transaction for this thread.
+     * @throws TransactionError if transactions are not enabled or one is already open
+     */
+    static void begin();
+
+    /**
+     * Commit this thread's transaction; returns once its log records are durable.
+     * @throws TransactionError if there is no open transaction
+     */
+    static void commit();
+
+    /**
+     * Roll back this thread's transaction.
+     * @throws TransactionError if there is no open transaction
+     */
+    static void abort();
+
+    /**
+     * This thread's open transaction, or nullptr to auto-commit.
+     */
+    static DbTxn *current() { return txn; }
+
+    /**
+     * Is there an open transaction on this thread?
+     */
+    static bool in_transaction() { return txn != nullptr; }
+
+    /**
+     * Flags for a BerkeleyDB call made outside of any transaction: DB_AUTO_COMMIT
+     * when the environment is transactional and this thread has none open.
+     */
+    static u_int32_t auto_commit() { return is_enabled && txn == nullptr ? DB_AUTO_COMMIT : 0; }
+
+    /**
+     * Have undo run once this thread's open transaction is rolled back (by abort(), or by a
+     * commit that fails), to put back in-memory state its changes had moved on. One undo per
+     * key: registering another for the same key replaces it.
+     */
+    static void on_rollback(const void *key, std::function<void()> undo);
+
+    /**
+     * Number of commits and of log flushes done for them (commits / flushes is the group size).
+     */
+    static void get_counts(u_int64_t &commits, u_int64_t &flushes);
+
+private:
+    friend class OutsideTransaction;
+
+    static bool is_enabled;
+    static u_int32_t group_window_us;
+    static thread_local DbTxn *txn;
+    static thread_local std::map<const void *, std::function<void()>> undos;  // for txn's rollback
+
+    // group commit state, guarded by group_mutex
+    static std::mutex group_mutex;
+    static std::condition_variable group_flushed;
+    static u_int64_t commit_seq;    // commits whose records are in the log buffer
+    static u_int64_t flushed_seq;   // commits known to be on disk
+    static u_int64_t flushes;
+    static bool flushing;
+
+    static void wait_for_flush(std::unique_lock<std::mutex> &lock, u_int64_t seq);
+
+    // the transaction is over: run the undos if it was rolled back, and forget them either way
+    static void ended(bool rolled_back);
+};
+
+/**
+ * @class OutsideTransaction - for its lifetime, this thread's gets and puts run outside
+ * its open transaction (if any), each one auto-committed, so a rollback cannot undo them
+ */
+class OutsideTransaction {
+public:
+    OutsideTransaction() : suspended(TransactionManager::txn) { TransactionManager::txn = nullptr; }
+
+    ~OutsideTransaction() { TransactionManager::txn = suspended; }
+
+    OutsideTransaction(const OutsideTransaction &other) = delete;
+
+    OutsideTransaction &operator=(const OutsideTransaction &other) = delete;
+
+private:
+    DbTxn *suspended;
+};